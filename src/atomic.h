@@ -30,6 +30,18 @@ atomic_exchange(volatile int *ptr, int new)
   return  __sync_lock_test_and_set(ptr, new);
 }
 
+static inline int
+atomic_get(volatile int *ptr)
+{
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+atomic_set(volatile int *ptr, int val)
+{
+  __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
 static inline uint64_t
 atomic_add_u64(volatile uint64_t *ptr, uint64_t incr)
 {
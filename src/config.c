@@ -1324,3 +1324,18 @@ int config_set_picon_path ( const char *str )
 {
   return _config_set_str("piconpath", str);
 }
+
+int config_get_descrambler_threads ( void )
+{
+  return htsmsg_get_u32_or_default(config, "descrambler_threads", 0);
+}
+
+int config_set_descrambler_threads ( int threads )
+{
+  if (threads < 0)
+    threads = 0;
+  if (config_get_descrambler_threads() == threads)
+    return 0;
+  htsmsg_set_u32(config, "descrambler_threads", threads);
+  return 1;
+}
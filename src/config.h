@@ -41,4 +41,8 @@ const char *config_get_picon_path  ( void );
 int         config_set_picon_path  ( const char *str )
   __attribute__((warn_unused_result));
 
+int         config_get_descrambler_threads ( void );
+int         config_set_descrambler_threads ( int threads )
+  __attribute__((warn_unused_result));
+
 #endif /* __TVH_CONFIG__H__ */
@@ -71,7 +71,9 @@ typedef struct th_descrambler_runtime {
   time_t   dr_ecm_start;
   time_t   dr_ecm_key_time;
   time_t   dr_last_err;
-  sbuf_t   dr_buf;
+  uint8_t *dr_ring;        /* TS packets waiting for the first key */
+  int      dr_ring_head;   /* oldest packet */
+  int      dr_ring_count;
   tvhlog_limit_t dr_loglimit_key;
 } th_descrambler_runtime_t;
 
@@ -21,6 +21,10 @@
 #include "caclient.h"
 #include "ffdecsa/FFdecsa.h"
 #include "input.h"
+#include "config.h"
+
+#define DESCRAMBLER_RING_PKTS  3000  /* pre-key backlog */
+#define DESCRAMBLER_RING_DROP   300  /* dropped at once when full */
 
 struct caid_tab {
   const char *name;
@@ -81,6 +85,9 @@ descrambler_init ( void )
 {
 #if (ENABLE_CWC || ENABLE_CAPMT) && !ENABLE_DVBCSA
   ffdecsa_init();
+#endif
+#if ENABLE_TVHCSA
+  tvhcsa_pool_init(config_get_descrambler_threads());
 #endif
   caclient_init();
 }
@@ -89,6 +96,9 @@ void
 descrambler_done ( void )
 {
   caclient_done();
+#if ENABLE_TVHCSA
+  tvhcsa_pool_done();
+#endif
 }
 
 /*
@@ -113,7 +123,6 @@ descrambler_service_start ( service_t *t )
   ((mpegts_service_t *)t)->s_dvb_mux->mm_descrambler_flush = 0;
   if (t->s_descramble == NULL) {
     t->s_descramble = dr = calloc(1, sizeof(th_descrambler_runtime_t));
-    sbuf_init(&dr->dr_buf);
     dr->dr_key_index = 0xff;
     tvhcsa_init(&dr->dr_csa);
   }
@@ -131,7 +140,7 @@ descrambler_service_stop ( service_t *t )
   t->s_descramble = NULL;
   if (dr) {
     tvhcsa_destroy(&dr->dr_csa);
-    sbuf_free(&dr->dr_buf);
+    free(dr->dr_ring);
     free(dr);
   }
 }
@@ -276,6 +285,55 @@ descrambler_flush_table_data( service_t *t )
   pthread_mutex_unlock(&mux->mm_descrambler_lock);
 }
 
+/*
+ * Pre-key backlog, a fixed ring of TS packets
+ */
+
+static inline uint8_t *
+ring_pkt( th_descrambler_runtime_t *dr, int idx )
+{
+  return dr->dr_ring +
+         ((dr->dr_ring_head + idx) % DESCRAMBLER_RING_PKTS) * 188;
+}
+
+static inline void
+ring_drop( th_descrambler_runtime_t *dr, int count )
+{
+  if (count > dr->dr_ring_count)
+    count = dr->dr_ring_count;
+  dr->dr_ring_head = (dr->dr_ring_head + count) % DESCRAMBLER_RING_PKTS;
+  dr->dr_ring_count -= count;
+}
+
+static inline void
+ring_append( th_descrambler_runtime_t *dr, const uint8_t *tsb )
+{
+  if (dr->dr_ring == NULL)
+    dr->dr_ring = malloc(DESCRAMBLER_RING_PKTS * 188);
+  memcpy(ring_pkt(dr, dr->dr_ring_count), tsb, 188);
+  dr->dr_ring_count++;
+}
+
+static inline void
+ring_replay( th_descrambler_runtime_t *dr, th_descrambler_t *td,
+             const uint8_t *run, int *len )
+{
+  if (*len) {
+    dr->dr_csa.csa_descramble(&dr->dr_csa,
+                              (mpegts_service_t *)td->td_service,
+                              run, *len);
+    *len = 0;
+  }
+}
+
+static inline void
+ring_free( th_descrambler_runtime_t *dr )
+{
+  free(dr->dr_ring);
+  dr->dr_ring = NULL;
+  dr->dr_ring_head = dr->dr_ring_count = 0;
+}
+
 static inline void
 key_update( th_descrambler_runtime_t *dr, uint8_t key )
 {
@@ -317,8 +375,8 @@ descrambler_descramble ( service_t *t,
 {
   th_descrambler_t *td;
   th_descrambler_runtime_t *dr = t->s_descramble;
-  int count, failed, off, size, flush_data = 0;
-  uint8_t *tsb2, ki;
+  int count, failed, off, len, flush_data = 0;
+  uint8_t *tsb2, *run, ki;
 
   lock_assert(&t->s_stream_mutex);
 
@@ -333,13 +391,15 @@ descrambler_descramble ( service_t *t,
     }
     if (td->td_keystate != DS_RESOLVED)
       continue;
-    if (dr->dr_buf.sb_ptr > 0) {
-      for (off = 0, size = dr->dr_buf.sb_ptr; off < size; off += 188) {
-        tsb2 = dr->dr_buf.sb_data + off;
+    if (dr->dr_ring_count > 0) {
+      /* replay the backlog, contiguous runs go to the cluster at once */
+      for (off = 0, run = NULL, len = 0; off < dr->dr_ring_count; off++) {
+        tsb2 = ring_pkt(dr, off);
         ki = tsb2[3];
         if ((ki & 0x80) != 0x00) {
           if (key_valid(dr, ki) == 0) {
-            sbuf_cut(&dr->dr_buf, off);
+            ring_replay(dr, td, run, &len);
+            ring_drop(dr, off);
             goto next2;
           }
           if (dr->dr_key_index != (ki & 0x40) &&
@@ -348,8 +408,9 @@ descrambler_descramble ( service_t *t,
                                     (ki & 0x40) ? "odd" : "even",
                                     ((mpegts_service_t *)t)->s_dvb_svcname);
             if (key_late(dr, ki)) {
-              sbuf_cut(&dr->dr_buf, off);
+              ring_replay(dr, td, run, &len);
               if (!td->td_ecm_reset(td)) {
+                ring_drop(dr, off);
                 dr->dr_key_valid = 0;
                 goto next;
               }
@@ -357,12 +418,17 @@ descrambler_descramble ( service_t *t,
             key_update(dr, ki);
           }
         }
-        dr->dr_csa.csa_descramble(&dr->dr_csa,
-                                  (mpegts_service_t *)td->td_service,
-                                  tsb2);
+        if (len && tsb2 == run + len) {
+          len += 188;
+        } else {
+          ring_replay(dr, td, run, &len);
+          run = tsb2;
+          len = 188;
+        }
       }
+      ring_replay(dr, td, run, &len);
       service_reset_streaming_status_flags(t, TSS_NO_ACCESS);
-      sbuf_free(&dr->dr_buf);
+      ring_free(dr);
     }
     ki = tsb[3];
     if ((ki & 0x80) != 0x00) {
@@ -393,7 +459,7 @@ descrambler_descramble ( service_t *t,
     }
     dr->dr_csa.csa_descramble(&dr->dr_csa,
                               (mpegts_service_t *)td->td_service,
-                              tsb);
+                              tsb, 188);
     service_reset_streaming_status_flags(t, TSS_NO_ACCESS);
     return 1;
 next:
@@ -406,17 +472,17 @@ next2:
     if ((ki & 0x80) != 0x00) {
       if (dr->dr_key_start == 0) {
         /* do not use the first TS packet to decide - it may be wrong */
-        if (dr->dr_buf.sb_ptr > 20 * 188) {
-          for (off = 0; off < 20 * 188; off += 188)
-            if ((dr->dr_buf.sb_data[off + 3] & 0xc0) != (ki & 0xc0))
+        if (dr->dr_ring_count > 20) {
+          for (off = 0; off < 20; off++)
+            if ((ring_pkt(dr, off)[3] & 0xc0) != (ki & 0xc0))
               break;
-          if (off >= 20 * 188) {
+          if (off >= 20) {
             tvhtrace("descrambler", "initial stream key set to %s for service \"%s\"",
                                     (ki & 0x40) ? "odd" : "even",
                                     ((mpegts_service_t *)t)->s_dvb_svcname);
             key_update(dr, ki);
           } else {
-            sbuf_cut(&dr->dr_buf, 188);
+            ring_drop(dr, 1);
           }
         }
       } else if (dr->dr_key_index != (ki & 0x40) &&
@@ -432,8 +498,8 @@ next2:
        * Fill a temporary buffer until the keys are known to make
        * streaming faster.
        */
-      if (dr->dr_buf.sb_ptr >= 3000 * 188) {
-        sbuf_cut(&dr->dr_buf, 300 * 188);
+      if (dr->dr_ring_count >= DESCRAMBLER_RING_PKTS) {
+        ring_drop(dr, DESCRAMBLER_RING_DROP);
         if (dr->dr_last_err + 10 < dispatch_clock) {
           dr->dr_last_err = dispatch_clock;
           tvherror("descrambler", "cannot decode packets for service \"%s\"",
@@ -443,7 +509,7 @@ next2:
                    ((mpegts_service_t *)t)->s_dvb_svcname);
         }
       }
-      sbuf_append(&dr->dr_buf, tsb, 188);
+      ring_append(dr, tsb);
       service_set_streaming_status_flags(t, TSS_NO_ACCESS);
     }
   } else {
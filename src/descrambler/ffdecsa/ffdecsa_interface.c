@@ -67,6 +67,14 @@ MAKEFUNCS(64mmx);
 MAKEFUNCS(128sse2);
 #endif
 
+#ifdef CONFIG_AVX2
+MAKEFUNCS(256avx2);
+#endif
+
+#ifdef CONFIG_AVX512
+MAKEFUNCS(512avx512);
+#endif
+
 static csafuncs_t current;
 
 
@@ -126,6 +134,23 @@ typedef int x86_reg;
            "=c" (ecx), "=d" (edx)\
          : "0" (index));
 
+/* cpuid with subleaf (ecx) */
+#define cpuid_count(index,count,eax,ebx,ecx,edx)\
+    __asm__ volatile\
+        ("mov %%"REG_b", %%"REG_S"\n\t"\
+         "cpuid\n\t"\
+         "xchg %%"REG_b", %%"REG_S\
+         : "=a" (eax), "=S" (ebx),\
+           "=c" (ecx), "=d" (edx)\
+         : "0" (index), "2" (count));
+
+/* OS enabled register state (XCR0) */
+#define xgetbv(index,eax,edx)\
+    __asm__ volatile\
+        ("xgetbv"\
+         : "=a" (eax), "=d" (edx)\
+         : "c" (index));
+
 
 
 void
@@ -138,6 +163,9 @@ ffdecsa_init(void)
 
   int eax, ebx, ecx, edx;
   int max_std_level, std_caps=0;
+#if defined(CONFIG_AVX2) || defined(CONFIG_AVX512)
+  int ext_caps=0, xcr0=0;
+#endif
   
 #if defined(__i386__)
 
@@ -170,6 +198,30 @@ ffdecsa_init(void)
     if(max_std_level >= 1){
       cpuid(1, eax, ebx, ecx, std_caps);
 
+#if defined(CONFIG_AVX2) || defined(CONFIG_AVX512)
+      /* OSXSAVE - the YMM/ZMM state must be enabled by the OS, too */
+      if (max_std_level >= 7 && (ecx & (1<<27))) {
+        xgetbv(0, xcr0, edx);
+        cpuid_count(7, 0, eax, ext_caps, ecx, edx);
+      }
+#endif
+
+#ifdef CONFIG_AVX512
+      if ((ext_caps & (1<<16)) && (xcr0 & 0xe6) == 0xe6) {
+	current = funcs_512avx512;
+	tvhlog(LOG_INFO, "CSA", "Using AVX-512 512bit parallel descrambling");
+	return;
+      }
+#endif
+
+#ifdef CONFIG_AVX2
+      if ((ext_caps & (1<<5)) && (xcr0 & 0x06) == 0x06) {
+	current = funcs_256avx2;
+	tvhlog(LOG_INFO, "CSA", "Using AVX2 256bit parallel descrambling");
+	return;
+      }
+#endif
+
 #ifdef CONFIG_SSE2
       if (std_caps & (1<<26)) {
 	current = funcs_128sse2;
@@ -432,6 +432,124 @@ static inline void trasp64_128_88cw(unsigned char *data){
   }
 #undef halfrow
 }
+
+//64-N (N=64*words: 256, 512)-------------------------------------
+// every 64-bit column is transposed on its own, as in the 128 case
+static inline void trasp64_wide_88ccw(unsigned char *data, int words){
+/* 64 rows of N bits transposition (bytes transp. - 8x8 rotate counterclockwise)*/
+#define qrow(r,k) (((unsigned long long int *)data)[words*(r)+(k)])
+  int i,j,k;
+  unsigned long long int t,b;
+  for(k=0;k<words;k++){
+    for(j=0;j<64;j+=64){
+      for(i=0;i<32;i++){
+        t=qrow(j+i,k);
+        b=qrow(j+32+i,k);
+        qrow(j+i,k)   = (t&0x00000000ffffffffULL)      | ((b                      )<<32);
+        qrow(j+32+i,k)=((t                      )>>32) |  (b&0xffffffff00000000ULL) ;
+      }
+    }
+    for(j=0;j<64;j+=32){
+      for(i=0;i<16;i++){
+        t=qrow(j+i,k);
+        b=qrow(j+16+i,k);
+        qrow(j+i,k)   = (t&0x0000ffff0000ffffULL)      | ((b&0x0000ffff0000ffffULL)<<16);
+        qrow(j+16+i,k)=((t&0xffff0000ffff0000ULL)>>16) |  (b&0xffff0000ffff0000ULL) ;
+      }
+    }
+    for(j=0;j<64;j+=16){
+      for(i=0;i<8;i++){
+        t=qrow(j+i,k);
+        b=qrow(j+8+i,k);
+        qrow(j+i,k)   = (t&0x00ff00ff00ff00ffULL)     | ((b&0x00ff00ff00ff00ffULL)<<8);
+        qrow(j+8+i,k) =((t&0xff00ff00ff00ff00ULL)>>8) |  (b&0xff00ff00ff00ff00ULL);
+      }
+    }
+    for(j=0;j<64;j+=8){
+      for(i=0;i<4;i++){
+        t=qrow(j+i,k);
+        b=qrow(j+4+i,k);
+        qrow(j+i,k)   =((t&0x0f0f0f0f0f0f0f0fULL)<<4) |  (b&0x0f0f0f0f0f0f0f0fULL);
+        qrow(j+4+i,k) = (t&0xf0f0f0f0f0f0f0f0ULL)     | ((b&0xf0f0f0f0f0f0f0f0ULL)>>4);
+      }
+    }
+    for(j=0;j<64;j+=4){
+      for(i=0;i<2;i++){
+        t=qrow(j+i,k);
+        b=qrow(j+2+i,k);
+        qrow(j+i,k)   =((t&0x3333333333333333ULL)<<2) |  (b&0x3333333333333333ULL);
+        qrow(j+2+i,k) = (t&0xccccccccccccccccULL)     | ((b&0xccccccccccccccccULL)>>2);
+      }
+    }
+    for(j=0;j<64;j+=2){
+      for(i=0;i<1;i++){
+        t=qrow(j+i,k);
+        b=qrow(j+1+i,k);
+        qrow(j+i,k)   =((t&0x5555555555555555ULL)<<1) |  (b&0x5555555555555555ULL);
+        qrow(j+1+i,k) = (t&0xaaaaaaaaaaaaaaaaULL)     | ((b&0xaaaaaaaaaaaaaaaaULL)>>1);
+      }
+    }
+  }
+#undef qrow
+}
+
+static inline void trasp64_wide_88cw(unsigned char *data, int words){
+/* 64 rows of N bits transposition (bytes transp. - 8x8 rotate clockwise)*/
+#define qrow(r,k) (((unsigned long long int *)data)[words*(r)+(k)])
+  int i,j,k;
+  unsigned long long int t,b;
+  for(k=0;k<words;k++){
+    for(j=0;j<64;j+=64){
+      for(i=0;i<32;i++){
+        t=qrow(j+i,k);
+        b=qrow(j+32+i,k);
+        qrow(j+i,k)   = (t&0x00000000ffffffffULL)      | ((b                      )<<32);
+        qrow(j+32+i,k)=((t                      )>>32) |  (b&0xffffffff00000000ULL) ;
+      }
+    }
+    for(j=0;j<64;j+=32){
+      for(i=0;i<16;i++){
+        t=qrow(j+i,k);
+        b=qrow(j+16+i,k);
+        qrow(j+i,k)   = (t&0x0000ffff0000ffffULL)      | ((b&0x0000ffff0000ffffULL)<<16);
+        qrow(j+16+i,k)=((t&0xffff0000ffff0000ULL)>>16) |  (b&0xffff0000ffff0000ULL) ;
+      }
+    }
+    for(j=0;j<64;j+=16){
+      for(i=0;i<8;i++){
+        t=qrow(j+i,k);
+        b=qrow(j+8+i,k);
+        qrow(j+i,k)   = (t&0x00ff00ff00ff00ffULL)     | ((b&0x00ff00ff00ff00ffULL)<<8);
+        qrow(j+8+i,k) =((t&0xff00ff00ff00ff00ULL)>>8) |  (b&0xff00ff00ff00ff00ULL);
+      }
+    }
+    for(j=0;j<64;j+=8){
+      for(i=0;i<4;i++){
+        t=qrow(j+i,k);
+        b=qrow(j+4+i,k);
+        qrow(j+i,k)   =((t&0xf0f0f0f0f0f0f0f0ULL)>>4) |   (b&0xf0f0f0f0f0f0f0f0ULL);
+        qrow(j+4+i,k) = (t&0x0f0f0f0f0f0f0f0fULL)     |  ((b&0x0f0f0f0f0f0f0f0fULL)<<4);
+      }
+    }
+    for(j=0;j<64;j+=4){
+      for(i=0;i<2;i++){
+        t=qrow(j+i,k);
+        b=qrow(j+2+i,k);
+        qrow(j+i,k)   =((t&0xccccccccccccccccULL)>>2) |  (b&0xccccccccccccccccULL);
+        qrow(j+2+i,k) = (t&0x3333333333333333ULL)     | ((b&0x3333333333333333ULL)<<2);
+      }
+    }
+    for(j=0;j<64;j+=2){
+      for(i=0;i<1;i++){
+        t=qrow(j+i,k);
+        b=qrow(j+1+i,k);
+        qrow(j+i,k)   =((t&0xaaaaaaaaaaaaaaaaULL)>>1) |  (b&0xaaaaaaaaaaaaaaaaULL);
+        qrow(j+1+i,k) = (t&0x5555555555555555ULL)     | ((b&0x5555555555555555ULL)<<1);
+      }
+    }
+  }
+#undef qrow
+}
 #endif
 
 
@@ -489,6 +607,12 @@ trasp64_64_88ccw(sb);
 #if GROUP_PARALLELISM==128
 trasp64_128_88ccw(sb);
 #endif
+#if GROUP_PARALLELISM==256
+trasp64_wide_88ccw(sb,4);
+#endif
+#if GROUP_PARALLELISM==512
+trasp64_wide_88ccw(sb,8);
+#endif
 DBG(dump_mem("stream_postrot",sb,GROUP_PARALLELISM*8,BYPG));
 
 for(j=0;j<64;j++){
@@ -888,6 +1012,12 @@ trasp64_64_88cw(cb);
 #if GROUP_PARALLELISM==128
 trasp64_128_88cw(cb);
 #endif
+#if GROUP_PARALLELISM==256
+trasp64_wide_88cw(cb,4);
+#endif
+#if GROUP_PARALLELISM==512
+trasp64_wide_88cw(cb,8);
+#endif
 
 for(j=0;j<64;j++){
   DBG(fprintf(stderr,"postcall postrot cb[%2i]=",j));
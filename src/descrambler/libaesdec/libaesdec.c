@@ -10,31 +10,42 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#include "openssl/aes.h"
+#include "openssl/evp.h"
 
 #include "libaesdec.h"
 
 //-----key structure
+//-----the EVP contexts use the AES-NI (pipelined ECB) code when available
 struct aes_keys_t {
-  AES_KEY even;
-  AES_KEY odd;
+  EVP_CIPHER_CTX *even;
+  EVP_CIPHER_CTX *odd;
+  unsigned char *buf;   // gathered payload blocks of a cluster
+  int *pos;             // position of the packet blocks in buf
+  short *off;           // payload offset per packet
+  short *len;           // encrypted length per packet (0 = clear)
+  int size;             // packets the buffers above can hold
 };
 
+static void aes_set_key(EVP_CIPHER_CTX *ctx, const unsigned char *pk) {
+  EVP_DecryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, pk, NULL);
+  EVP_CIPHER_CTX_set_padding(ctx, 0);
+}
+
 //-----even cw represents one full 128-bit AES key
 void aes_set_even_control_word(void *keys, const unsigned char *pk) {
-  AES_set_decrypt_key(pk, 128, &((struct aes_keys_t *) keys)->even);
+  aes_set_key(((struct aes_keys_t *) keys)->even, pk);
 }
 
 //-----odd cw represents one full 128-bit AES key
 void aes_set_odd_control_word(void *keys, const unsigned char *pk) {
-  AES_set_decrypt_key(pk, 128, &((struct aes_keys_t *) keys)->odd);
+  aes_set_key(((struct aes_keys_t *) keys)->odd, pk);
 }
 
 //-----set control words
 void aes_set_control_words(void *keys, const unsigned char *ev,
 		const unsigned char *od) {
-  AES_set_decrypt_key(ev, 128, &((struct aes_keys_t *) keys)->even);
-  AES_set_decrypt_key(od, 128, &((struct aes_keys_t *) keys)->odd);
+  aes_set_key(((struct aes_keys_t *) keys)->even, ev);
+  aes_set_key(((struct aes_keys_t *) keys)->odd, od);
 }
 
 //-----allocate key structure
@@ -43,6 +54,16 @@ void * aes_get_key_struct(void) {
 			sizeof(struct aes_keys_t));
   if (keys) {
     static const unsigned char pk[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    keys->buf = NULL;
+    keys->pos = NULL;
+    keys->off = keys->len = NULL;
+    keys->size = 0;
+    keys->even = EVP_CIPHER_CTX_new();
+    keys->odd = EVP_CIPHER_CTX_new();
+    if (keys->even == NULL || keys->odd == NULL) {
+      aes_free_key_struct(keys);
+      return NULL;
+    }
     aes_set_control_words(keys, pk, pk);
   }
   return keys;
@@ -50,56 +71,112 @@ void * aes_get_key_struct(void) {
 
 //-----free key structure
 void aes_free_key_struct(void *keys) {
-  if (keys)
-    free(keys);
+  struct aes_keys_t *k = keys;
+  if (k) {
+    EVP_CIPHER_CTX_free(k->even);
+    EVP_CIPHER_CTX_free(k->odd);
+    free(k->buf);
+    free(k->pos);
+    free(k->off);
+    free(k->len);
+    free(k);
+  }
 }
 
-//----- decrypt
-void aes_decrypt_packet(void *keys, unsigned char *packet) {
-  unsigned char *pkt;
-  unsigned char ev_od = 0;
-  int xc0, offset, n;
-  int len;
-  pkt = packet;
-  AES_KEY k;
+//-----check the packet, return the number of bytes to decrypt (0 = none)
+static int aes_packet_prepare(unsigned char *pkt, int *offset, int *ev_od) {
+  int xc0, len;
 
   xc0 = pkt[3] & 0xc0;
 
-  //skip clear pkt
-  if (xc0 == 0x00)
-    return;
+  //skip clear and reserved pkt
+  if (xc0 == 0x00 || xc0 == 0x40)
+    return 0;
+
+  // encrypted
+  *ev_od = (xc0 & 0x40) >> 6; // 0 even, 1 odd
+  pkt[3] &= 0x3f;  // consider it decrypted now
+  if (pkt[3] & 0x20) { // incomplete packet
+    *offset = 4 + pkt[4] + 1;
+    if (*offset >= 188)
+      return 0;
+    len = 188 - *offset;
+  } else {
+    *offset = 4;
+    len = 184;
+  }
+  // only the full blocks are encrypted, the residue is clear
+  return len & ~15;
+}
 
-  //skip reserved pkt
-  if (xc0 == 0x40)
-    return;
+//----- decrypt
+void aes_decrypt_packet(void *keys, unsigned char *packet) {
+  aes_decrypt_packets(keys, packet, 1);
+}
 
-  if (xc0 == 0x80 || xc0 == 0xc0) { // encrypted
-    ev_od = (xc0 & 0x40) >> 6; // 0 even, 1 odd
-    pkt[3] &= 0x3f;  // consider it decrypted now
-    if (pkt[3] & 0x20) { // incomplete packet
-      offset = 4 + pkt[4] + 1;
-      len = 188 - offset;
-      n = len >> 3;
-      if (n == 0) { // decrypted==encrypted!
-        return;  // this doesn't need more processing
-      }
-    } else {
-        len = 184;
-	offset = 4;
-      }
-  } else {
+//----- grow the gather buffers to hold count packets
+static int aes_gather_alloc(struct aes_keys_t *k, int count) {
+  unsigned char *buf;
+  int *pos;
+  short *off, *len;
+
+  if (count <= k->size)
+    return 0;
+  if ((buf = realloc(k->buf, count * 176)) != NULL) k->buf = buf;
+  if ((pos = realloc(k->pos, count * sizeof(int))) != NULL) k->pos = pos;
+  if ((off = realloc(k->off, count * sizeof(short))) != NULL) k->off = off;
+  if ((len = realloc(k->len, count * sizeof(short))) != NULL) k->len = len;
+  if (!buf || !pos || !off || !len)
+    return -1;
+  k->size = count;
+  return 0;
+}
+
+//----- decrypt a cluster of packets
+//----- the encrypted blocks of all packets are gathered into one buffer,
+//----- even parity from the start and odd parity from the end, so each
+//----- parity is a single EVP call over the whole cluster
+void aes_decrypt_packets(void *keys, unsigned char *packets, int count) {
+  struct aes_keys_t *k = keys;
+  unsigned char *pkt;
+  int i, len, offset = 4, ev_od = 0, outl, even, odd, top, end;
+
+  if (count == 1 || aes_gather_alloc(k, count)) {
+    for (i = 0, pkt = packets; i < count; i++, pkt += 188) {
+      len = aes_packet_prepare(pkt, &offset, &ev_od);
+      if (len == 0)
+        continue;
+      EVP_DecryptUpdate(ev_od ? k->odd : k->even,
+                        pkt + offset, &outl, pkt + offset, len);
+    }
     return;
   }
 
-  if (ev_od == 0) {
-    k = ((struct aes_keys_t *) keys)->even;
-  } else {
-    k = ((struct aes_keys_t *) keys)->odd;
+  top = odd = count * 176;
+  even = end = 0;
+  for (i = 0, pkt = packets; i < count; i++, pkt += 188) {
+    len = aes_packet_prepare(pkt, &offset, &ev_od);
+    k->len[i] = len;
+    if (len == 0)
+      continue;
+    if (ev_od) {
+      odd -= len;
+      k->pos[i] = odd;
+    } else {
+      k->pos[i] = even;
+      even += len;
+    }
+    k->off[i] = offset;
+    memcpy(k->buf + k->pos[i], pkt + offset, len);
+    end = i + 1;
   }
 
-  // TODO room for improvement?
-  int i;
-  for (i = offset; i <= (len - 16); i += 16) {
-    AES_ecb_encrypt(pkt + i, pkt + i, &k, AES_DECRYPT);
-  }
+  if (even)
+    EVP_DecryptUpdate(k->even, k->buf, &outl, k->buf, even);
+  if (odd < top)
+    EVP_DecryptUpdate(k->odd, k->buf + odd, &outl, k->buf + odd, top - odd);
+
+  for (i = 0, pkt = packets; i < end; i++, pkt += 188)
+    if (k->len[i])
+      memcpy(pkt + k->off[i], k->buf + k->pos[i], k->len[i]);
 }
@@ -18,6 +18,7 @@ void aes_set_control_words(void *keys, const unsigned char *even, const unsigned
 void aes_set_even_control_word(void *keys, const unsigned char *even);
 void aes_set_odd_control_word(void *keys, const unsigned char *odd);
 void aes_decrypt_packet(void *keys, unsigned char *packet);
+void aes_decrypt_packets(void *keys, unsigned char *packets, int count);
 
 #else
 
@@ -28,6 +29,7 @@ static inline void aes_set_control_words(void *keys, const unsigned char *even,
 static inline void aes_set_even_control_word(void *keys, const unsigned char *even) { return; };
 static inline void aes_set_odd_control_word(void *keys, const unsigned char *odd) { return; };
 static inline void aes_decrypt_packet(void *keys, unsigned char *packet) { return; };
+static inline void aes_decrypt_packets(void *keys, unsigned char *packets, int count) { return; };
 
 #endif
 
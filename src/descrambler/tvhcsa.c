@@ -24,31 +24,66 @@
 #include <unistd.h>
 #include <assert.h>
 
+#define TVHCSA_POOL_MAX_THREADS 32
+#define TVHCSA_POOL_MAX_JOBS    4   /* clusters in flight per service */
+
+typedef struct tvhcsa_job
+{
+  TAILQ_ENTRY(tvhcsa_job)    cj_link;       /*< csa_jobs / csa_jobs_free */
+  TAILQ_ENTRY(tvhcsa_job)    cj_pool_link;  /*< tvhcsa_pool_queue */
+  tvhcsa_t                  *cj_csa;
+  int                        cj_fill;
+  int                        cj_done;
+#if ENABLE_DVBCSA
+  struct dvbcsa_bs_batch_s  *cj_batch_even;
+  struct dvbcsa_bs_batch_s  *cj_batch_odd;
+#endif
+  uint8_t                    cj_tsb[0];
+} tvhcsa_job_t;
+
+static pthread_mutex_t          tvhcsa_pool_lock;
+static pthread_cond_t           tvhcsa_pool_cond;
+static pthread_cond_t           tvhcsa_pool_done_cond;
+static struct tvhcsa_job_queue  tvhcsa_pool_queue;
+static pthread_t               *tvhcsa_pool_tids;
+static int                      tvhcsa_pool_threads;
+static int                      tvhcsa_pool_running;
+
 static void
 tvhcsa_aes_descramble
-  ( tvhcsa_t *csa, struct mpegts_service *s, const uint8_t *tsb )
+  ( tvhcsa_t *csa, struct mpegts_service *s, const uint8_t *tsb, int len )
 {
-  aes_decrypt_packet(csa->csa_aes_keys, (unsigned char *)tsb);
-  ts_recv_packet2(s, tsb);
+  const uint8_t *t0;
+  int i, l;
+
+  for ( ; len > 0; tsb += l, len -= l) {
+    l = MIN(len, (csa->csa_cluster_size - csa->csa_fill) * 188);
+    memcpy(csa->csa_tsbcluster + csa->csa_fill * 188, tsb, l);
+    csa->csa_fill += l / 188;
+
+    if(csa->csa_fill != csa->csa_cluster_size)
+      continue;
+
+    aes_decrypt_packets(csa->csa_aes_keys, csa->csa_tsbcluster, csa->csa_fill);
+
+    for(i = 0, t0 = csa->csa_tsbcluster; i < csa->csa_fill; i++, t0 += 188)
+      ts_recv_packet2(s, t0);
+    csa->csa_fill = 0;
+  }
 }
 
+#if ENABLE_DVBCSA
 static void
-tvhcsa_des_descramble
-  ( tvhcsa_t *csa, struct mpegts_service *s, const uint8_t *tsb )
+tvhcsa_dvbcsa_batch
+  ( uint8_t *pkt,
+    struct dvbcsa_bs_batch_s *even, int *fill_even,
+    struct dvbcsa_bs_batch_s *odd,  int *fill_odd )
 {
-#if ENABLE_DVBCSA
-  uint8_t *pkt;
   int xc0;
   int ev_od;
   int len;
   int offset;
   int n;
-  int i;
-  const uint8_t *t0;
-
-  pkt = csa->csa_tsbcluster + csa->csa_fill * 188;
-  memcpy(pkt, tsb, 188);
-  csa->csa_fill++;
 
   do { // handle this packet
     xc0 = pkt[3] & 0xc0;
@@ -76,79 +111,348 @@ tvhcsa_des_descramble
         // FIXME: //residue = 0;
       }
       if(ev_od == 0) {
-        csa->csa_tsbbatch_even[csa->csa_fill_even].data = pkt + offset;
-        csa->csa_tsbbatch_even[csa->csa_fill_even].len = len;
-        csa->csa_fill_even++;
+        even[*fill_even].data = pkt + offset;
+        even[*fill_even].len = len;
+        (*fill_even)++;
       } else {
-        csa->csa_tsbbatch_odd[csa->csa_fill_odd].data = pkt + offset;
-        csa->csa_tsbbatch_odd[csa->csa_fill_odd].len = len;
-        csa->csa_fill_odd++;
+        odd[*fill_odd].data = pkt + offset;
+        odd[*fill_odd].len = len;
+        (*fill_odd)++;
       }
     }
   } while(0);
+}
+#endif
 
-  if(csa->csa_fill != csa->csa_cluster_size)
-    return;
+static void
+tvhcsa_des_descramble
+  ( tvhcsa_t *csa, struct mpegts_service *s, const uint8_t *tsb, int len )
+{
+#if ENABLE_DVBCSA
+  uint8_t *pkt;
+  int i, l;
+  const uint8_t *t0;
 
-  if(csa->csa_fill_even) {
-    csa->csa_tsbbatch_even[csa->csa_fill_even].data = NULL;
-    dvbcsa_bs_decrypt(csa->csa_key_even, csa->csa_tsbbatch_even, 184);
-    csa->csa_fill_even = 0;
-  }
-  if(csa->csa_fill_odd) {
-    csa->csa_tsbbatch_odd[csa->csa_fill_odd].data = NULL;
-    dvbcsa_bs_decrypt(csa->csa_key_odd, csa->csa_tsbbatch_odd, 184);
-    csa->csa_fill_odd = 0;
-  }
+  for ( ; len > 0; tsb += l, len -= l) {
+    l = MIN(len, (csa->csa_cluster_size - csa->csa_fill) * 188);
+    pkt = csa->csa_tsbcluster + csa->csa_fill * 188;
+    memcpy(pkt, tsb, l);
+    csa->csa_fill += l / 188;
 
-  t0 = csa->csa_tsbcluster;
+    for (i = l / 188; i > 0; i--, pkt += 188)
+      tvhcsa_dvbcsa_batch(pkt, csa->csa_tsbbatch_even, &csa->csa_fill_even,
+                               csa->csa_tsbbatch_odd,  &csa->csa_fill_odd);
+
+    if(csa->csa_fill != csa->csa_cluster_size)
+      continue;
+
+    if(csa->csa_fill_even) {
+      csa->csa_tsbbatch_even[csa->csa_fill_even].data = NULL;
+      dvbcsa_bs_decrypt(csa->csa_key_even, csa->csa_tsbbatch_even, 184);
+      csa->csa_fill_even = 0;
+    }
+    if(csa->csa_fill_odd) {
+      csa->csa_tsbbatch_odd[csa->csa_fill_odd].data = NULL;
+      dvbcsa_bs_decrypt(csa->csa_key_odd, csa->csa_tsbbatch_odd, 184);
+      csa->csa_fill_odd = 0;
+    }
 
-  for(i = 0; i < csa->csa_fill; i++) {
-	  ts_recv_packet2(s, t0);
-	  t0 += 188;
+    t0 = csa->csa_tsbcluster;
+
+    for(i = 0; i < csa->csa_fill; i++) {
+      ts_recv_packet2(s, t0);
+      t0 += 188;
+    }
+    csa->csa_fill = 0;
   }
-  csa->csa_fill = 0;
 
 #else
-  int r;
+  int r, l;
   unsigned char *vec[3];
 
-  memcpy(csa->csa_tsbcluster + csa->csa_fill * 188, tsb, 188);
-  csa->csa_fill++;
+  for ( ; len > 0; tsb += l, len -= l) {
+    l = MIN(len, (csa->csa_cluster_size - csa->csa_fill) * 188);
+    memcpy(csa->csa_tsbcluster + csa->csa_fill * 188, tsb, l);
+    csa->csa_fill += l / 188;
 
-  if(csa->csa_fill != csa->csa_cluster_size)
-    return;
-
-  while(1) {
+    if(csa->csa_fill != csa->csa_cluster_size)
+      continue;
 
     vec[0] = csa->csa_tsbcluster;
     vec[1] = csa->csa_tsbcluster + csa->csa_fill * 188;
     vec[2] = NULL;
-    
+
     r = decrypt_packets(csa->csa_keys, vec);
     if(r > 0) {
       int i;
       const uint8_t *t0 = csa->csa_tsbcluster;
 
       for(i = 0; i < r; i++) {
-	      ts_recv_packet2(s, t0);
-	      t0 += 188;
+        ts_recv_packet2(s, t0);
+        t0 += 188;
       }
 
       r = csa->csa_fill - r;
       assert(r >= 0);
 
       if(r > 0)
-	      memmove(csa->csa_tsbcluster, t0, r * 188);
+        memmove(csa->csa_tsbcluster, t0, r * 188);
       csa->csa_fill = r;
     } else {
       csa->csa_fill = 0;
     }
-    break;
   }
 #endif
 }
 
+/*
+ * Descrambling pool
+ *
+ * Full clusters are queued to the worker threads and handed back to
+ * ts_recv_packet2() by the input thread (under s_stream_mutex) strictly
+ * in submission order, so the per-service packet order is preserved.
+ */
+
+static void
+tvhcsa_job_decrypt ( tvhcsa_job_t *job )
+{
+  tvhcsa_t *csa = job->cj_csa;
+#if ENABLE_DVBCSA
+  int i, fill_even = 0, fill_odd = 0;
+
+  for (i = 0; i < job->cj_fill; i++)
+    tvhcsa_dvbcsa_batch(job->cj_tsb + i * 188,
+                        job->cj_batch_even, &fill_even,
+                        job->cj_batch_odd,  &fill_odd);
+  if (fill_even) {
+    job->cj_batch_even[fill_even].data = NULL;
+    dvbcsa_bs_decrypt(csa->csa_key_even, job->cj_batch_even, 184);
+  }
+  if (fill_odd) {
+    job->cj_batch_odd[fill_odd].data = NULL;
+    dvbcsa_bs_decrypt(csa->csa_key_odd, job->cj_batch_odd, 184);
+  }
+#else
+  unsigned char *vec[3];
+
+  vec[0] = job->cj_tsb;
+  vec[1] = job->cj_tsb + job->cj_fill * 188;
+  vec[2] = NULL;
+
+  /* each call handles one parity group, the range is NULLed when done */
+  while (vec[0])
+    decrypt_packets(csa->csa_keys, vec);
+#endif
+}
+
+static void *
+tvhcsa_pool_thread ( void *aux )
+{
+  tvhcsa_job_t *job;
+
+  pthread_mutex_lock(&tvhcsa_pool_lock);
+  while (tvhcsa_pool_running) {
+    if ((job = TAILQ_FIRST(&tvhcsa_pool_queue)) == NULL) {
+      pthread_cond_wait(&tvhcsa_pool_cond, &tvhcsa_pool_lock);
+      continue;
+    }
+    TAILQ_REMOVE(&tvhcsa_pool_queue, job, cj_pool_link);
+    pthread_mutex_unlock(&tvhcsa_pool_lock);
+
+    tvhcsa_job_decrypt(job);
+
+    pthread_mutex_lock(&tvhcsa_pool_lock);
+    job->cj_done = 1;
+    job->cj_csa->csa_jobs_busy--;
+    pthread_cond_broadcast(&tvhcsa_pool_done_cond);
+  }
+  pthread_mutex_unlock(&tvhcsa_pool_lock);
+  return NULL;
+}
+
+static tvhcsa_job_t *
+tvhcsa_job_get ( tvhcsa_t *csa )
+{
+  tvhcsa_job_t *job;
+
+  if ((job = TAILQ_FIRST(&csa->csa_jobs_free)) != NULL) {
+    TAILQ_REMOVE(&csa->csa_jobs_free, job, cj_link);
+  } else {
+    job = malloc(sizeof(*job) + csa->csa_cluster_size * 188);
+    job->cj_csa = csa;
+#if ENABLE_DVBCSA
+    job->cj_batch_even = malloc((csa->csa_cluster_size + 1) *
+                                sizeof(struct dvbcsa_bs_batch_s));
+    job->cj_batch_odd  = malloc((csa->csa_cluster_size + 1) *
+                                sizeof(struct dvbcsa_bs_batch_s));
+#endif
+  }
+  job->cj_fill = 0;
+  job->cj_done = 0;
+  return job;
+}
+
+static void
+tvhcsa_job_free ( tvhcsa_job_t *job )
+{
+#if ENABLE_DVBCSA
+  free(job->cj_batch_odd);
+  free(job->cj_batch_even);
+#endif
+  free(job);
+}
+
+/*
+ * Pass the finished clusters at the queue head to the service,
+ * tvhcsa_pool_lock must be held. With wait set, block until
+ * at least one cluster is delivered.
+ */
+static void
+tvhcsa_pool_deliver ( tvhcsa_t *csa, struct mpegts_service *s, int wait )
+{
+  tvhcsa_job_t *job;
+  const uint8_t *tsb;
+  int i;
+
+  while ((job = TAILQ_FIRST(&csa->csa_jobs)) != NULL) {
+    if (!job->cj_done) {
+      if (!wait)
+        break;
+      pthread_cond_wait(&tvhcsa_pool_done_cond, &tvhcsa_pool_lock);
+      continue;
+    }
+    TAILQ_REMOVE(&csa->csa_jobs, job, cj_link);
+    csa->csa_jobs_count--;
+    pthread_mutex_unlock(&tvhcsa_pool_lock);
+
+    for (i = 0, tsb = job->cj_tsb; i < job->cj_fill; i++, tsb += 188)
+      ts_recv_packet2(s, tsb);
+
+    pthread_mutex_lock(&tvhcsa_pool_lock);
+    TAILQ_INSERT_HEAD(&csa->csa_jobs_free, job, cj_link);
+    wait = 0;
+  }
+}
+
+/*
+ * Wait until the workers are done with all clusters of this csa
+ * (the keys are about to change or the csa is going away).
+ */
+static void
+tvhcsa_pool_sync ( tvhcsa_t *csa )
+{
+  if (!csa->csa_pool)
+    return;
+  pthread_mutex_lock(&tvhcsa_pool_lock);
+  while (csa->csa_jobs_busy > 0)
+    pthread_cond_wait(&tvhcsa_pool_done_cond, &tvhcsa_pool_lock);
+  pthread_mutex_unlock(&tvhcsa_pool_lock);
+}
+
+static void
+tvhcsa_pool_submit
+  ( tvhcsa_t *csa, struct mpegts_service *s, tvhcsa_job_t *job )
+{
+  pthread_mutex_lock(&tvhcsa_pool_lock);
+  csa->csa_job = NULL;
+  TAILQ_INSERT_TAIL(&csa->csa_jobs, job, cj_link);
+  csa->csa_jobs_count++;
+  if (tvhcsa_pool_running) {
+    csa->csa_jobs_busy++;
+    TAILQ_INSERT_TAIL(&tvhcsa_pool_queue, job, cj_pool_link);
+    pthread_cond_signal(&tvhcsa_pool_cond);
+  } else {
+    tvhcsa_job_decrypt(job);
+    job->cj_done = 1;
+  }
+  tvhcsa_pool_deliver(csa, s, 0);
+  while (csa->csa_jobs_count > TVHCSA_POOL_MAX_JOBS)
+    tvhcsa_pool_deliver(csa, s, 1);
+  pthread_mutex_unlock(&tvhcsa_pool_lock);
+}
+
+static void
+tvhcsa_des_pool_descramble
+  ( tvhcsa_t *csa, struct mpegts_service *s, const uint8_t *tsb, int len )
+{
+  tvhcsa_job_t *job;
+  int l, submitted = 0;
+
+  for ( ; len > 0; tsb += l, len -= l) {
+    if ((job = csa->csa_job) == NULL)
+      job = csa->csa_job = tvhcsa_job_get(csa);
+
+    l = MIN(len, (csa->csa_cluster_size - job->cj_fill) * 188);
+    memcpy(job->cj_tsb + job->cj_fill * 188, tsb, l);
+    job->cj_fill += l / 188;
+    if (job->cj_fill == csa->csa_cluster_size) {
+      tvhcsa_pool_submit(csa, s, job);
+      submitted = 1;
+    }
+  }
+
+  /* do not hold the finished clusters until the next one is full */
+  if (!submitted && csa->csa_jobs_count > 0) {
+    pthread_mutex_lock(&tvhcsa_pool_lock);
+    tvhcsa_pool_deliver(csa, s, 0);
+    pthread_mutex_unlock(&tvhcsa_pool_lock);
+  }
+}
+
+void
+tvhcsa_pool_init ( int threads )
+{
+  int i;
+
+  pthread_mutex_init(&tvhcsa_pool_lock, NULL);
+  pthread_cond_init(&tvhcsa_pool_cond, NULL);
+  pthread_cond_init(&tvhcsa_pool_done_cond, NULL);
+  TAILQ_INIT(&tvhcsa_pool_queue);
+
+  if (threads <= 0)
+    return;
+  if (threads > TVHCSA_POOL_MAX_THREADS)
+    threads = TVHCSA_POOL_MAX_THREADS;
+
+  tvhcsa_pool_running = 1;
+  tvhcsa_pool_tids = calloc(threads, sizeof(pthread_t));
+  for (i = 0; i < threads; i++)
+    tvhthread_create(&tvhcsa_pool_tids[i], NULL, tvhcsa_pool_thread, NULL);
+  tvhcsa_pool_threads = threads;
+  tvhlog(LOG_INFO, "csa", "using %d descrambling threads", threads);
+}
+
+void
+tvhcsa_pool_done ( void )
+{
+  tvhcsa_job_t *job;
+  int i;
+
+  if (tvhcsa_pool_threads <= 0)
+    return;
+
+  pthread_mutex_lock(&tvhcsa_pool_lock);
+  tvhcsa_pool_running = 0;
+  pthread_cond_broadcast(&tvhcsa_pool_cond);
+  pthread_mutex_unlock(&tvhcsa_pool_lock);
+  for (i = 0; i < tvhcsa_pool_threads; i++)
+    pthread_join(tvhcsa_pool_tids[i], NULL);
+  free(tvhcsa_pool_tids);
+  tvhcsa_pool_tids = NULL;
+  tvhcsa_pool_threads = 0;
+
+  /* finish the leftovers, so nobody waits for them */
+  pthread_mutex_lock(&tvhcsa_pool_lock);
+  while ((job = TAILQ_FIRST(&tvhcsa_pool_queue)) != NULL) {
+    TAILQ_REMOVE(&tvhcsa_pool_queue, job, cj_pool_link);
+    tvhcsa_job_decrypt(job);
+    job->cj_done = 1;
+    job->cj_csa->csa_jobs_busy--;
+  }
+  pthread_cond_broadcast(&tvhcsa_pool_done_cond);
+  pthread_mutex_unlock(&tvhcsa_pool_lock);
+}
+
 int
 tvhcsa_set_type( tvhcsa_t *csa, int type )
 {
@@ -158,7 +462,8 @@ tvhcsa_set_type( tvhcsa_t *csa, int type )
     return -1;
   switch (type) {
   case DESCRAMBLER_DES:
-    csa->csa_descramble = tvhcsa_des_descramble;
+    csa->csa_descramble = csa->csa_pool ? tvhcsa_des_pool_descramble :
+                                          tvhcsa_des_descramble;
     csa->csa_keylen     = 8;
     break;
   case DESCRAMBLER_AES:
@@ -177,6 +482,7 @@ void tvhcsa_set_key_even( tvhcsa_t *csa, const uint8_t *even )
 {
   switch (csa->csa_type) {
   case DESCRAMBLER_DES:
+    tvhcsa_pool_sync(csa);
 #if ENABLE_DVBCSA
     dvbcsa_bs_key_set(even, csa->csa_key_even);
 #else
@@ -196,6 +502,7 @@ void tvhcsa_set_key_odd( tvhcsa_t *csa, const uint8_t *odd )
   assert(csa->csa_type);
   switch (csa->csa_type) {
   case DESCRAMBLER_DES:
+    tvhcsa_pool_sync(csa);
 #if ENABLE_DVBCSA
     dvbcsa_bs_key_set(odd, csa->csa_key_odd);
 #else
@@ -232,11 +539,30 @@ tvhcsa_init ( tvhcsa_t *csa )
   csa->csa_keys          = get_key_struct();
 #endif
   csa->csa_aes_keys      = aes_get_key_struct();
+  csa->csa_pool          = tvhcsa_pool_threads > 0;
+  csa->csa_job           = NULL;
+  csa->csa_jobs_count    = 0;
+  csa->csa_jobs_busy     = 0;
+  TAILQ_INIT(&csa->csa_jobs);
+  TAILQ_INIT(&csa->csa_jobs_free);
 }
 
 void
 tvhcsa_destroy ( tvhcsa_t *csa )
 {
+  tvhcsa_job_t *job;
+
+  tvhcsa_pool_sync(csa);
+  while ((job = TAILQ_FIRST(&csa->csa_jobs)) != NULL) {
+    TAILQ_REMOVE(&csa->csa_jobs, job, cj_link);
+    tvhcsa_job_free(job);
+  }
+  while ((job = TAILQ_FIRST(&csa->csa_jobs_free)) != NULL) {
+    TAILQ_REMOVE(&csa->csa_jobs_free, job, cj_link);
+    tvhcsa_job_free(job);
+  }
+  if (csa->csa_job)
+    tvhcsa_job_free(csa->csa_job);
 #if ENABLE_DVBCSA
   dvbcsa_bs_key_free(csa->csa_key_odd);
   dvbcsa_bs_key_free(csa->csa_key_even);
@@ -24,6 +24,7 @@ struct elementary_stream;
 
 #include <stdint.h>
 #include "build.h"
+#include "queue.h"
 #if ENABLE_DVBCSA
 #include <dvbcsa/dvbcsa.h>
 #else
@@ -32,6 +33,9 @@ struct elementary_stream;
 
 #include "libaesdec/libaesdec.h"
 
+struct tvhcsa_job;
+TAILQ_HEAD(tvhcsa_job_queue, tvhcsa_job);
+
 typedef struct tvhcsa
 {
 
@@ -41,7 +45,8 @@ typedef struct tvhcsa
   int      csa_type;   /*< see DESCRAMBLER_* defines */
   int      csa_keylen;
   void   (*csa_descramble)
-              ( struct tvhcsa *csa, struct mpegts_service *s, const uint8_t *tsb );
+              ( struct tvhcsa *csa, struct mpegts_service *s,
+                const uint8_t *tsb, int len );
 
   int      csa_cluster_size;
   uint8_t *csa_tsbcluster;
@@ -59,6 +64,16 @@ typedef struct tvhcsa
   void *csa_keys;
 #endif
   void *csa_aes_keys;
+
+  /**
+   * Descrambling pool (DES only)
+   */
+  int                      csa_pool;        /*< clusters go to the pool */
+  struct tvhcsa_job       *csa_job;         /*< cluster being filled */
+  struct tvhcsa_job_queue  csa_jobs;        /*< submitted, in stream order */
+  struct tvhcsa_job_queue  csa_jobs_free;
+  int                      csa_jobs_count;  /*< submitted, not delivered */
+  int                      csa_jobs_busy;   /*< submitted, not decrypted */
   
 } tvhcsa_t;
 
@@ -70,4 +85,7 @@ void tvhcsa_set_key_odd ( tvhcsa_t *csa, const uint8_t *odd );
 void tvhcsa_init    ( tvhcsa_t *csa );
 void tvhcsa_destroy ( tvhcsa_t *csa );
 
+void tvhcsa_pool_init ( int threads );
+void tvhcsa_pool_done ( void );
+
 #endif /* __TVH_CSA_H__ */
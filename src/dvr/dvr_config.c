@@ -156,6 +156,7 @@ dvr_config_create(const char *name, const char *uuid, htsmsg_t *conf)
   /* Muxer config */
   cfg->dvr_muxcnf.m_cache  = MC_CACHE_DONTKEEP;
   cfg->dvr_muxcnf.m_rewrite_pat = 1;
+  cfg->dvr_muxcnf.m_io_backlog = 64;
 
   /* dup detect */
   cfg->dvr_dup_detect_episode = 1; // detect dup episodes
@@ -450,6 +451,21 @@ const idclass_t dvr_config_class = {
       .list     = dvr_config_class_cache_list,
       .group    = 1,
     },
+    {
+      .type     = PT_INT,
+      .id       = "io-backlog",
+      .name     = "Max. Write Backlog (MB)",
+      .off      = offsetof(dvr_config_t, dvr_muxcnf.m_io_backlog),
+      .def.i    = 64,
+      .group    = 1,
+    },
+    {
+      .type     = PT_BOOL,
+      .id       = "io-drop",
+      .name     = "Drop Data When Storage Is Too Slow",
+      .off      = offsetof(dvr_config_t, dvr_muxcnf.m_io_drop),
+      .group    = 1,
+    },
     {
       .type     = PT_U32,
       .id       = "retention-days",
@@ -324,6 +324,7 @@ dvr_rec_start(dvr_entry_t *de, const streaming_start_t *ss)
     dvr_rec_fatal_error(de, "Unable to create muxer");
     return -1;
   }
+  de->de_mux->m_input = &de->de_sq;
 
   if(pvr_generate_filename(de, ss) != 0) {
     dvr_rec_fatal_error(de, "Unable to create directories");
@@ -465,7 +466,7 @@ dvr_thread(void *aux)
         atomic_add(&de->de_s->ths_bytes_out, pktbuf_len(pb));
     }
 
-    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+    streaming_queue_remove(sq, sm);
 
     pthread_mutex_unlock(&sq->sq_mutex);
 
@@ -133,6 +133,7 @@ static void _epg_object_destroy
   if (tree) RB_REMOVE(tree, eo, uri_link);
   if (eo->_updated) LIST_REMOVE(eo, up_link);
   LIST_REMOVE(eo, id_link);
+  epg_save_dirty(eo);
 }
 
 static void _epg_object_getref ( void *o )
@@ -157,6 +158,7 @@ static void _epg_object_putref ( void *o )
 static void _epg_object_set_updated ( void *o )
 {
   epg_object_t *eo = o;
+  epg_save_dirty(eo);
   if (!eo->_updated) {
     tvhtrace("epg", "eo [%p, %u, %d, %s] updated",
              eo, eo->id, eo->type, eo->uri);
@@ -264,6 +266,7 @@ static int _epg_object_set_grabber ( void *o, epggrab_module_t *grab  )
   if ( !eo->grabber ||
        ((eo->grabber != grab) && (grab->priority > eo->grabber->priority)) ) {
     eo->grabber = grab;
+    epg_save_dirty(eo);
   }
   return grab == eo->grabber;
 }
@@ -375,6 +378,211 @@ epg_object_t *epg_object_deserialize ( htsmsg_t *msg, int create, int *save )
   return NULL;
 }
 
+/* **************************************************************************
+ * Binary records (database v3)
+ *
+ * Big endian, fixed field order per object type. Strings are stored with
+ * their terminating NUL, so they are used directly from the mapped file.
+ * The short repeated strings (languages, grabbers, channels) are stored
+ * in the database string table and the other objects are referenced by ID.
+ * *************************************************************************/
+
+typedef struct epg_bin
+{
+  const uint8_t *p;
+  const uint8_t *end;
+  int            err;
+} epg_bin_t;
+
+static inline void _eb_u32 ( sbuf_t *sb, uint32_t u32 )
+{
+  sbuf_put_be32(sb, u32);
+}
+
+static inline void _eb_s64 ( sbuf_t *sb, int64_t s64 )
+{
+  sbuf_put_be32(sb, (uint64_t)s64 >> 32);
+  sbuf_put_be32(sb, s64);
+}
+
+static void _eb_str ( sbuf_t *sb, const char *str )
+{
+  uint32_t len = str ? strlen(str) + 1 : 0;
+  sbuf_put_be32(sb, len);
+  if (len)
+    sbuf_append(sb, str, len);
+}
+
+static inline void _eb_ref ( sbuf_t *sb, const char *str )
+{
+  sbuf_put_be32(sb, str ? epgdb_str_index(str) : 0);
+}
+
+static inline void _eb_id ( sbuf_t *sb, void *o )
+{
+  sbuf_put_be32(sb, o ? ((epg_object_t *)o)->id : 0);
+}
+
+static void _eb_lang_str ( sbuf_t *sb, lang_str_t *ls )
+{
+  lang_str_ele_t *e;
+  uint16_t count = 0;
+
+  if (ls)
+    RB_FOREACH(e, ls, link)
+      count++;
+  sbuf_put_be16(sb, count);
+  if (ls)
+    RB_FOREACH(e, ls, link) {
+      _eb_ref(sb, e->lang);
+      _eb_str(sb, e->str);
+    }
+}
+
+static inline int _ed_avail ( epg_bin_t *b, size_t len )
+{
+  if (b->err || b->end - b->p < len) {
+    b->err = 1;
+    return 0;
+  }
+  return 1;
+}
+
+static inline uint8_t _ed_u8 ( epg_bin_t *b )
+{
+  return _ed_avail(b, 1) ? *b->p++ : 0;
+}
+
+static inline uint16_t _ed_u16 ( epg_bin_t *b )
+{
+  uint16_t r;
+  if (!_ed_avail(b, 2)) return 0;
+  r = (b->p[0] << 8) | b->p[1];
+  b->p += 2;
+  return r;
+}
+
+static inline uint32_t _ed_u32 ( epg_bin_t *b )
+{
+  uint32_t r;
+  if (!_ed_avail(b, 4)) return 0;
+  r = ((uint32_t)b->p[0] << 24) | (b->p[1] << 16) | (b->p[2] << 8) | b->p[3];
+  b->p += 4;
+  return r;
+}
+
+static inline int64_t _ed_s64 ( epg_bin_t *b )
+{
+  uint64_t r = (uint64_t)_ed_u32(b) << 32;
+  return r | _ed_u32(b);
+}
+
+static const char *_ed_str ( epg_bin_t *b )
+{
+  uint32_t len = _ed_u32(b);
+  const char *r;
+  if (!len || !_ed_avail(b, len)) return NULL;
+  if (b->p[len - 1]) {
+    b->err = 1;
+    return NULL;
+  }
+  r = (const char *)b->p;
+  b->p += len;
+  return r;
+}
+
+static inline const char *_ed_ref ( epg_bin_t *b )
+{
+  return epgdb_str_lookup(_ed_u32(b));
+}
+
+/* Call the string setter for each language */
+#define _ED_LANG_STR(b, set, o, save) do { \
+  uint16_t _n = _ed_u16(b); \
+  const char *_l, *_s; \
+  while (_n-- > 0 && !(b)->err) { \
+    _l = _ed_ref(b); \
+    if ((_s = _ed_str(b))) \
+      *(save) |= set(o, _s, _l, NULL); \
+  } \
+} while (0)
+
+static int _epg_object_encode ( void *o, sbuf_t *sb )
+{
+  epg_object_t *eo = o;
+  if (!eo->id || !eo->type) return -1;
+  sbuf_put_byte(sb, eo->type);
+  _eb_u32(sb, eo->id);
+  _eb_ref(sb, eo->grabber ? eo->grabber->id : NULL);
+  _eb_s64(sb, eo->updated);
+  _eb_str(sb, eo->uri);
+  return 0;
+}
+
+static epg_object_t *_epg_object_decode ( epg_bin_t *b, epg_object_t *eo )
+{
+  const char *s;
+  int64_t s64;
+
+  eo->id = _ed_u32(b);
+  s = _ed_ref(b);
+  eo->grabber = s ? epggrab_module_find_by_id(s) : NULL;
+  s64 = _ed_s64(b);
+  eo->uri = (char *)_ed_str(b);
+  if (b->err || !eo->id) return NULL;
+  _epg_object_set_updated(eo);
+  eo->updated = s64;
+  return eo;
+}
+
+static int _epg_brand_encode ( epg_brand_t *b, sbuf_t *sb );
+static int _epg_season_encode ( epg_season_t *s, sbuf_t *sb );
+static int _epg_episode_encode ( epg_episode_t *e, sbuf_t *sb );
+static int _epg_serieslink_encode ( epg_serieslink_t *s, sbuf_t *sb );
+static int _epg_broadcast_encode ( epg_broadcast_t *b, sbuf_t *sb );
+static epg_object_t *_epg_brand_decode ( epg_bin_t *b, int *save );
+static epg_object_t *_epg_season_decode ( epg_bin_t *b, int *save );
+static epg_object_t *_epg_episode_decode ( epg_bin_t *b, int *save );
+static epg_object_t *_epg_serieslink_decode ( epg_bin_t *b, int *save );
+static epg_object_t *_epg_broadcast_decode ( epg_bin_t *b, int *save );
+
+int epg_object_encode ( epg_object_t *eo, sbuf_t *sb )
+{
+  switch (eo->type) {
+    case EPG_BRAND:
+      return _epg_brand_encode((epg_brand_t*)eo, sb);
+    case EPG_SEASON:
+      return _epg_season_encode((epg_season_t*)eo, sb);
+    case EPG_EPISODE:
+      return _epg_episode_encode((epg_episode_t*)eo, sb);
+    case EPG_BROADCAST:
+      return _epg_broadcast_encode((epg_broadcast_t*)eo, sb);
+    case EPG_SERIESLINK:
+      return _epg_serieslink_encode((epg_serieslink_t*)eo, sb);
+    default:
+      return -1;
+  }
+}
+
+epg_object_t *epg_object_decode ( const uint8_t *data, size_t len, int *save )
+{
+  epg_bin_t b = { data + 1, data + len, 0 };
+  if (!len) return NULL;
+  switch (data[0]) {
+    case EPG_BRAND:
+      return _epg_brand_decode(&b, save);
+    case EPG_SEASON:
+      return _epg_season_decode(&b, save);
+    case EPG_EPISODE:
+      return _epg_episode_decode(&b, save);
+    case EPG_BROADCAST:
+      return _epg_broadcast_decode(&b, save);
+    case EPG_SERIESLINK:
+      return _epg_serieslink_decode(&b, save);
+  }
+  return NULL;
+}
+
 /* **************************************************************************
  * Brand
  * *************************************************************************/
@@ -541,6 +749,36 @@ epg_brand_t *epg_brand_deserialize ( htsmsg_t *m, int create, int *save )
   return eb;
 }
 
+static int _epg_brand_encode ( epg_brand_t *brand, sbuf_t *sb )
+{
+  if (!brand->uri || _epg_object_encode(brand, sb)) return -1;
+  _eb_lang_str(sb, brand->title);
+  _eb_lang_str(sb, brand->summary);
+  sbuf_put_be16(sb, brand->season_count);
+  _eb_str(sb, brand->image);
+  return 0;
+}
+
+static epg_object_t *_epg_brand_decode ( epg_bin_t *b, int *save )
+{
+  epg_object_t **skel = _epg_brand_skel();
+  epg_brand_t *eb;
+  const char *str;
+  uint16_t u16;
+
+  if ( !_epg_object_decode(b, *skel) || !(*skel)->uri ) return NULL;
+  if ( !(eb = epg_brand_find_by_uri((*skel)->uri, 1, save)) ) return NULL;
+
+  _ED_LANG_STR(b, epg_brand_set_title, eb, save);
+  _ED_LANG_STR(b, epg_brand_set_summary, eb, save);
+  if ((u16 = _ed_u16(b)))
+    *save |= epg_brand_set_season_count(eb, u16, NULL);
+  if ((str = _ed_str(b)))
+    *save |= epg_brand_set_image(eb, str, NULL);
+
+  return (epg_object_t *)eb;
+}
+
 htsmsg_t *epg_brand_list ( void )
 {
   epg_object_t *eo;
@@ -732,6 +970,41 @@ epg_season_t *epg_season_deserialize ( htsmsg_t *m, int create, int *save )
   return es;
 }
 
+static int _epg_season_encode ( epg_season_t *season, sbuf_t *sb )
+{
+  if (!season->uri || _epg_object_encode(season, sb)) return -1;
+  _eb_lang_str(sb, season->summary);
+  sbuf_put_be16(sb, season->number);
+  sbuf_put_be16(sb, season->episode_count);
+  _eb_id(sb, season->brand);
+  _eb_str(sb, season->image);
+  return 0;
+}
+
+static epg_object_t *_epg_season_decode ( epg_bin_t *b, int *save )
+{
+  epg_object_t **skel = _epg_season_skel();
+  epg_season_t *es;
+  epg_brand_t *eb;
+  const char *str;
+  uint32_t u32;
+
+  if ( !_epg_object_decode(b, *skel) || !(*skel)->uri ) return NULL;
+  if ( !(es = epg_season_find_by_uri((*skel)->uri, 1, save)) ) return NULL;
+
+  _ED_LANG_STR(b, epg_season_set_summary, es, save);
+  if ((u32 = _ed_u16(b)))
+    *save |= epg_season_set_number(es, u32, NULL);
+  if ((u32 = _ed_u16(b)))
+    *save |= epg_season_set_episode_count(es, u32, NULL);
+  if ((u32 = _ed_u32(b)) && (eb = epg_brand_find_by_id(u32)))
+    *save |= epg_season_set_brand(es, eb, NULL);
+  if ((str = _ed_str(b)))
+    *save |= epg_season_set_image(es, str, NULL);
+
+  return (epg_object_t *)es;
+}
+
 const char *epg_season_get_summary
   ( const epg_season_t *s, const char *lang )
 {
@@ -800,6 +1073,7 @@ static void _epg_episode_destroy ( void *eo )
   }
   if (ee->brand)       _epg_brand_rem_episode(ee->brand, ee);
   if (ee->season)      _epg_season_rem_episode(ee->season, ee);
+  epg_index_remove(ee);
   if (ee->title)       lang_str_destroy(ee->title);
   if (ee->subtitle)    lang_str_destroy(ee->subtitle);
   if (ee->summary)     lang_str_destroy(ee->summary);
@@ -844,19 +1118,27 @@ epg_episode_t *epg_episode_find_by_id ( uint32_t id )
   return (epg_episode_t*)epg_object_find_by_id(id, EPG_EPISODE);
 }
 
+static int _epg_episode_index ( epg_episode_t *episode, int save )
+{
+  if (save) epg_index_update(episode);
+  return save;
+}
+
 int epg_episode_set_title
   ( epg_episode_t *episode, const char *title, const char *lang,
     epggrab_module_t *src )
 {
   if (!episode) return 0;
-  return _epg_object_set_lang_str(episode, &episode->title, title, lang, src);
+  return _epg_episode_index(episode,
+           _epg_object_set_lang_str(episode, &episode->title, title, lang, src));
 }
 
 int epg_episode_set_title2
   ( epg_episode_t *episode, const lang_str_t *str, epggrab_module_t *src )
 {
   if (!episode || !str) return 0;
-  return _epg_object_set_lang_str2(episode, &episode->title, str, src);
+  return _epg_episode_index(episode,
+           _epg_object_set_lang_str2(episode, &episode->title, str, src));
 }
 
 int epg_episode_set_subtitle
@@ -864,15 +1146,17 @@ int epg_episode_set_subtitle
     epggrab_module_t *src )
 {
   if (!episode || !subtitle || !*subtitle) return 0;
-  return _epg_object_set_lang_str(episode, &episode->subtitle,
-                                  subtitle, lang, src);
+  return _epg_episode_index(episode,
+           _epg_object_set_lang_str(episode, &episode->subtitle,
+                                    subtitle, lang, src));
 }
 
 int epg_episode_set_subtitle2
   ( epg_episode_t *episode, const lang_str_t *str, epggrab_module_t *src )
 {
   if (!episode || !str) return 0;
-  return _epg_object_set_lang_str2(episode, &episode->subtitle, str, src);
+  return _epg_episode_index(episode,
+           _epg_object_set_lang_str2(episode, &episode->subtitle, str, src));
 }
 
 int epg_episode_set_summary
@@ -1010,6 +1294,7 @@ int epg_episode_set_genre
     save |= epg_genre_list_add(&ee->genre, g1);
   }
 
+  if (save) epg_save_dirty((epg_object_t *)ee);
   return save;
 }
 
@@ -1250,6 +1535,99 @@ epg_episode_t *epg_episode_deserialize ( htsmsg_t *m, int create, int *save )
   return ee;
 }
 
+static int _epg_episode_encode ( epg_episode_t *episode, sbuf_t *sb )
+{
+  epg_episode_num_t *num = &episode->epnum;
+  epg_genre_t *eg;
+  uint8_t count = 0;
+
+  if (!episode->uri || _epg_object_encode(episode, sb)) return -1;
+  _eb_lang_str(sb, episode->title);
+  _eb_lang_str(sb, episode->subtitle);
+  _eb_lang_str(sb, episode->summary);
+  _eb_lang_str(sb, episode->description);
+  sbuf_put_be16(sb, num->s_num);
+  sbuf_put_be16(sb, num->s_cnt);
+  sbuf_put_be16(sb, num->e_num);
+  sbuf_put_be16(sb, num->e_cnt);
+  sbuf_put_be16(sb, num->p_num);
+  sbuf_put_be16(sb, num->p_cnt);
+  _eb_str(sb, num->text);
+  LIST_FOREACH(eg, &episode->genre, link)
+    if (count < 255) count++;
+  sbuf_put_byte(sb, count);
+  LIST_FOREACH(eg, &episode->genre, link) {
+    if (count-- == 0) break;
+    sbuf_put_byte(sb, eg->code);
+  }
+  _eb_id(sb, episode->brand);
+  _eb_id(sb, episode->season);
+  sbuf_put_byte(sb, episode->is_bw);
+  sbuf_put_byte(sb, episode->star_rating);
+  sbuf_put_byte(sb, episode->age_rating);
+  _eb_s64(sb, episode->first_aired);
+  _eb_str(sb, episode->image);
+  return 0;
+}
+
+static epg_object_t *_epg_episode_decode ( epg_bin_t *b, int *save )
+{
+  epg_object_t **skel = _epg_episode_skel();
+  epg_episode_t *ee;
+  epg_season_t *es;
+  epg_brand_t *eb;
+  epg_episode_num_t num;
+  epg_genre_list_t *egl;
+  epg_genre_t genre;
+  const char *str;
+  uint32_t u32, brand;
+  int64_t s64;
+  int i;
+
+  if ( !_epg_object_decode(b, *skel) || !(*skel)->uri ) return NULL;
+  if ( !(ee = epg_episode_find_by_uri((*skel)->uri, 1, save)) ) return NULL;
+
+  _ED_LANG_STR(b, epg_episode_set_title, ee, save);
+  _ED_LANG_STR(b, epg_episode_set_subtitle, ee, save);
+  _ED_LANG_STR(b, epg_episode_set_summary, ee, save);
+  _ED_LANG_STR(b, epg_episode_set_description, ee, save);
+  num.s_num = _ed_u16(b);
+  num.s_cnt = _ed_u16(b);
+  num.e_num = _ed_u16(b);
+  num.e_cnt = _ed_u16(b);
+  num.p_num = _ed_u16(b);
+  num.p_cnt = _ed_u16(b);
+  num.text  = (char *)_ed_str(b);
+  if (b->err) return (epg_object_t *)ee;
+  *save |= epg_episode_set_epnum(ee, &num, NULL);
+  if ((i = _ed_u8(b)) > 0) {
+    egl = calloc(1, sizeof(epg_genre_list_t));
+    for ( ; i > 0; i--) {
+      genre.code = _ed_u8(b);
+      epg_genre_list_add(egl, &genre);
+    }
+    *save |= epg_episode_set_genre(ee, egl, NULL);
+    epg_genre_list_destroy(egl);
+  }
+  brand = _ed_u32(b);
+  if ((u32 = _ed_u32(b)) && (es = epg_season_find_by_id(u32)))
+    *save |= epg_episode_set_season(ee, es, NULL);
+  if (brand && (eb = epg_brand_find_by_id(brand)))
+    *save |= epg_episode_set_brand(ee, eb, NULL);
+  if ((u32 = _ed_u8(b)))
+    *save |= epg_episode_set_is_bw(ee, u32, NULL);
+  if ((u32 = _ed_u8(b)))
+    *save |= epg_episode_set_star_rating(ee, u32, NULL);
+  if ((u32 = _ed_u8(b)))
+    *save |= epg_episode_set_age_rating(ee, u32, NULL);
+  if ((s64 = _ed_s64(b)))
+    *save |= epg_episode_set_first_aired(ee, (time_t)s64, NULL);
+  if ((str = _ed_str(b)))
+    *save |= epg_episode_set_image(ee, str, NULL);
+
+  return (epg_object_t *)ee;
+}
+
 const char *epg_episode_get_title 
   ( const epg_episode_t *e, const char *lang )
 {
@@ -1361,6 +1739,20 @@ epg_serieslink_t *epg_serieslink_deserialize
   return esl;
 }
 
+static int _epg_serieslink_encode ( epg_serieslink_t *esl, sbuf_t *sb )
+{
+  if (!esl->uri) return -1;
+  return _epg_object_encode(esl, sb);
+}
+
+static epg_object_t *_epg_serieslink_decode ( epg_bin_t *b, int *save )
+{
+  epg_object_t **skel = _epg_serieslink_skel();
+
+  if ( !_epg_object_decode(b, *skel) || !(*skel)->uri ) return NULL;
+  return (epg_object_t *)epg_serieslink_find_by_uri((*skel)->uri, 1, save);
+}
+
 /* **************************************************************************
  * Channel
  * *************************************************************************/
@@ -1627,6 +2019,7 @@ int epg_broadcast_set_serieslink
     if ( ebc->serieslink ) _epg_serieslink_rem_broadcast(ebc->serieslink, ebc);
     ebc->serieslink = esl;
     _epg_serieslink_add_broadcast(esl, ebc);
+    epg_save_dirty((epg_object_t *)ebc);
     save = 1;
   }
   return save;
@@ -1891,6 +2284,103 @@ epg_broadcast_t *epg_broadcast_deserialize
   return ebc;
 }
 
+#define EPG_BIN_WIDESCREEN  0x01
+#define EPG_BIN_HD          0x02
+#define EPG_BIN_DEAFSIGNED  0x04
+#define EPG_BIN_SUBTITLED   0x08
+#define EPG_BIN_AUDIO_DESC  0x10
+#define EPG_BIN_NEW         0x20
+#define EPG_BIN_REPEAT      0x40
+
+static int _epg_broadcast_encode ( epg_broadcast_t *broadcast, sbuf_t *sb )
+{
+  uint8_t flags = 0;
+
+  if (!broadcast->episode || !broadcast->episode->uri) return -1;
+  if (_epg_object_encode(broadcast, sb)) return -1;
+  if (broadcast->is_widescreen) flags |= EPG_BIN_WIDESCREEN;
+  if (broadcast->is_hd)         flags |= EPG_BIN_HD;
+  if (broadcast->is_deafsigned) flags |= EPG_BIN_DEAFSIGNED;
+  if (broadcast->is_subtitled)  flags |= EPG_BIN_SUBTITLED;
+  if (broadcast->is_audio_desc) flags |= EPG_BIN_AUDIO_DESC;
+  if (broadcast->is_new)        flags |= EPG_BIN_NEW;
+  if (broadcast->is_repeat)     flags |= EPG_BIN_REPEAT;
+  _eb_s64(sb, broadcast->start);
+  _eb_s64(sb, broadcast->stop);
+  _eb_id(sb, broadcast->episode);
+  _eb_ref(sb, broadcast->channel ? channel_get_uuid(broadcast->channel) : NULL);
+  sbuf_put_be16(sb, broadcast->dvb_eid);
+  sbuf_put_byte(sb, flags);
+  sbuf_put_be16(sb, broadcast->lines);
+  sbuf_put_be16(sb, broadcast->aspect);
+  _eb_lang_str(sb, broadcast->summary);
+  _eb_lang_str(sb, broadcast->description);
+  _eb_id(sb, broadcast->serieslink);
+  return 0;
+}
+
+static epg_object_t *_epg_broadcast_decode ( epg_bin_t *b, int *save )
+{
+  channel_t *ch = NULL;
+  epg_broadcast_t *ebc, **skel = _epg_broadcast_skel();
+  epg_episode_t *ee;
+  epg_serieslink_t *esl;
+  const char *str;
+  uint32_t u32;
+  uint8_t flags;
+  int64_t start, stop;
+
+  if ( !_epg_object_decode(b, (epg_object_t*)*skel) ) return NULL;
+  start = _ed_s64(b);
+  stop  = _ed_s64(b);
+  u32   = _ed_u32(b);
+  str   = _ed_ref(b);
+  if ( b->err || !start || !stop ) return NULL;
+  if ( stop <= start ) return NULL;
+  if ( stop <= dispatch_clock ) return NULL;
+  if ( !(ee = epg_episode_find_by_id(u32)) ) return NULL;
+  if ( !str || !(ch = channel_find(str)) ) return NULL;
+
+  /* Create */
+  (*skel)->start   = start;
+  (*skel)->stop    = stop;
+  (*skel)->dvb_eid = _ed_u16(b);
+  ebc = _epg_channel_add_broadcast(ch, skel, 1, save);
+  if (!ebc) return NULL;
+
+  /* Get metadata */
+  flags = _ed_u8(b);
+  if (flags & EPG_BIN_WIDESCREEN)
+    *save |= epg_broadcast_set_is_widescreen(ebc, 1, NULL);
+  if (flags & EPG_BIN_HD)
+    *save |= epg_broadcast_set_is_hd(ebc, 1, NULL);
+  if ((u32 = _ed_u16(b)))
+    *save |= epg_broadcast_set_lines(ebc, u32, NULL);
+  if ((u32 = _ed_u16(b)))
+    *save |= epg_broadcast_set_aspect(ebc, u32, NULL);
+  if (flags & EPG_BIN_DEAFSIGNED)
+    *save |= epg_broadcast_set_is_deafsigned(ebc, 1, NULL);
+  if (flags & EPG_BIN_SUBTITLED)
+    *save |= epg_broadcast_set_is_subtitled(ebc, 1, NULL);
+  if (flags & EPG_BIN_AUDIO_DESC)
+    *save |= epg_broadcast_set_is_audio_desc(ebc, 1, NULL);
+  if (flags & EPG_BIN_NEW)
+    *save |= epg_broadcast_set_is_new(ebc, 1, NULL);
+  if (flags & EPG_BIN_REPEAT)
+    *save |= epg_broadcast_set_is_repeat(ebc, 1, NULL);
+  _ED_LANG_STR(b, epg_broadcast_set_summary, ebc, save);
+  _ED_LANG_STR(b, epg_broadcast_set_description, ebc, save);
+
+  /* Series link */
+  if ((u32 = _ed_u32(b)) && (esl = epg_serieslink_find_by_id(u32)))
+    *save |= epg_broadcast_set_serieslink(ebc, esl, NULL);
+
+  /* Set the episode */
+  *save |= epg_broadcast_set_episode(ebc, ee, NULL);
+
+  return (epg_object_t *)ebc;
+}
+
 /* **************************************************************************
  * Genre
  * *************************************************************************/
@@ -2308,6 +2798,49 @@ _eq_add_channel ( epg_query_t *eq, channel_t *ch )
   }
 }
 
+static int
+_eq_channel_match ( channel_t *ch, channel_t *channel, channel_tag_t *tag )
+{
+  channel_tag_mapping_t *ctm;
+
+  if (ch == NULL) return 0;
+  if (tag == NULL) return channel == NULL || ch == channel;
+  if (channel && ch != channel) return 0;
+  LIST_FOREACH(ctm, &ch->ch_ctms, ctm_channel_link)
+    if (ctm->ctm_tag == tag)
+      return 1;
+  return 0;
+}
+
+/*
+ * Use the text index to get the candidate episodes for a plain
+ * (no special characters) title or subtitle regex, the filters
+ * are still evaluated for each candidate in _eq_add().
+ */
+static int
+_eq_add_indexed ( epg_query_t *eq, channel_t *channel, channel_tag_t *tag )
+{
+  epg_episode_t **res;
+  epg_broadcast_t *ebc;
+  int i, count = -1;
+
+  if (eq->stitle)
+    count = epg_index_query(eq->stitle, EPG_INDEX_TITLE, &res);
+  if (count < 0 && eq->title.comp == EC_RE)
+    count = epg_index_query(eq->title.str, EPG_INDEX_TITLE, &res);
+  if (count < 0 && eq->subtitle.comp == EC_RE)
+    count = epg_index_query(eq->subtitle.str, EPG_INDEX_SUBTITLE, &res);
+  if (count < 0)
+    return 0;
+
+  for (i = 0; i < count; i++)
+    LIST_FOREACH(ebc, &res[i]->broadcasts, ep_link)
+      if (_eq_channel_match(ebc->channel, channel, tag))
+        _eq_add(eq, ebc);
+  free(res);
+  return 1;
+}
+
 static int
 _eq_init_str( epg_filter_str_t *f )
 {
@@ -2517,8 +3050,11 @@ epg_query ( epg_query_t *eq )
   tag = channel_tag_find_by_uuid(eq->channel_tag) ?:
         channel_tag_find_by_name(eq->channel_tag, 0);
 
+  /* Text index */
+  if (_eq_add_indexed(eq, channel, tag)) {
+
   /* Single channel */
-  if (channel && tag == NULL) {
+  } else if (channel && tag == NULL) {
     _eq_add_channel(eq, channel);
   
   /* Tag based */
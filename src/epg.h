@@ -116,6 +116,9 @@ struct epg_object
 
   int                     _updated;   ///< Flag to indicate updated
   int                     refcount;   ///< Reference counting
+  uint64_t                _save_off;  ///< Record position in the database
+  uint32_t                _save_len;  ///< Record length (0 = changed)
+  uint32_t                _save_idx;  ///< Pending save entry (+1)
   // Note: could use LIST_ENTRY field to determine this!
 
   struct epggrab_module  *grabber;    ///< Originating grabber
@@ -131,6 +134,11 @@ epg_object_t *epg_object_find_by_id  ( uint32_t id, epg_object_type_t type );
 htsmsg_t     *epg_object_serialize   ( epg_object_t *eo );
 epg_object_t *epg_object_deserialize ( htsmsg_t *msg, int create, int *save );
 
+/* Binary records (database v3) */
+int           epg_object_encode ( epg_object_t *eo, sbuf_t *sb );
+epg_object_t *epg_object_decode
+  ( const uint8_t *data, size_t len, int *save );
+
 /* ************************************************************************
  * Brand - Represents a specific show
  * e.g. The Simpsons, 24, Eastenders, etc...
@@ -277,6 +285,9 @@ struct epg_episode
   epg_brand_t               *brand;         ///< (Grand-)Parent brand
   epg_season_t              *season;        ///< Parent season
   epg_broadcast_list_t       broadcasts;    ///< Broadcast list
+
+  struct epg_index_post    **idx;           ///< Text index entries
+  int                        idx_count;     ///< Text index entry count
 };
 
 /* Lookup */
@@ -606,6 +617,20 @@ typedef struct epg_query {
 epg_broadcast_t  **epg_query(epg_query_t *eq);
 void epg_query_free(epg_query_t *eq);
 
+/* ************************************************************************
+ * Text index
+ * ***********************************************************************/
+
+#define EPG_INDEX_TITLE    0x01
+#define EPG_INDEX_SUBTITLE 0x02
+
+typedef struct epg_index_post epg_index_post_t;
+
+void epg_index_update ( epg_episode_t *ee );
+void epg_index_remove ( epg_episode_t *ee );
+int  epg_index_query
+  ( const char *pattern, uint8_t fields, epg_episode_t ***res );
+
 /* ************************************************************************
  * Setup/Shutdown
  * ***********************************************************************/
@@ -615,6 +640,11 @@ void epg_done    (void);
 void epg_skel_done (void);
 void epg_save    (void);
 void epg_save_callback (void *p);
+void epg_save_dirty (epg_object_t *eo);
+
+/* Database string table */
+uint32_t    epgdb_str_index  (const char *str);
+const char *epgdb_str_lookup (uint32_t idx);
 void epg_updated (void);
 
 #endif /* EPG_H */
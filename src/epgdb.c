@@ -17,6 +17,7 @@
  */
 
 #include <string.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -29,8 +30,9 @@
 #include "channels.h"
 #include "epg.h"
 #include "epggrab.h"
+#include "atomic.h"
 
-#define EPG_DB_VERSION 2
+#define EPG_DB_VERSION 3
 
 extern epg_object_tree_t epg_brands;
 extern epg_object_tree_t epg_seasons;
@@ -138,6 +140,57 @@ _epgdb_v2_process( char **sect, htsmsg_t *m, epggrab_stats_t *stats )
   }
 }
 
+/*
+ * Process v3 data
+ */
+static const char **epgdb_load_strs;
+static uint32_t     epgdb_load_str_count;
+
+static void
+_epgdb_v3_strtab( const uint8_t *rp, size_t len )
+{
+  const uint8_t *end = rp + len;
+  uint32_t i, count, l;
+
+  if (len < 4) return;
+  count = (rp[0] << 24) | (rp[1] << 16) | (rp[2] << 8) | rp[3];
+  rp += 4;
+  if (count > len / 5) return;
+  free(epgdb_load_strs);
+  epgdb_load_strs = calloc(count, sizeof(char *));
+  for (i = 0; i < count && end - rp >= 4; i++) {
+    l = (rp[0] << 24) | (rp[1] << 16) | (rp[2] << 8) | rp[3];
+    rp += 4;
+    if (l == 0 || l > end - rp || rp[l - 1]) break;
+    epgdb_load_strs[i] = (const char *)rp;
+    rp += l;
+  }
+  epgdb_load_str_count = i;
+}
+
+static void
+_epgdb_v3_process( const uint8_t *rp, size_t len, epggrab_stats_t *stats )
+{
+  epg_object_t *eo;
+  int save = 0;
+
+  if (len == 0) return;
+  if (rp[0] == EPG_UNDEF) {
+    _epgdb_v3_strtab(rp + 1, len - 1);
+    return;
+  }
+  if ((eo = epg_object_decode(rp, len, &save)) == NULL)
+    return;
+  switch (eo->type) {
+    case EPG_BRAND:      stats->brands.total++;     break;
+    case EPG_SEASON:     stats->seasons.total++;    break;
+    case EPG_EPISODE:    stats->episodes.total++;   break;
+    case EPG_SERIESLINK: stats->seasons.total++;    break;
+    case EPG_BROADCAST:  stats->broadcasts.total++; break;
+    default:                                        break;
+  }
+}
+
 /*
  * Load data
  */
@@ -150,6 +203,7 @@ void epg_init ( void )
   epggrab_stats_t stats;
   int ver = EPG_DB_VERSION;
   char *sect = NULL;
+  htsmsg_t *m;
 
   /* Find the right file (and version) */
   while (fd < 0 && ver > 0) {
@@ -179,6 +233,7 @@ void epg_init ( void )
     tvhlog(LOG_ERR, "epgdb", "failed to mmap database");
     return;
   }
+  madvise(mem, st.st_size, MADV_SEQUENTIAL);
 
   /* Process */
   memset(&stats, 0, sizeof(stats));
@@ -195,30 +250,30 @@ void epg_init ( void )
       break;
     }
     
-    /* Extract message */
-    htsmsg_t *m = htsmsg_binary_deserialize(rp, msglen, NULL);
-
-    /* Next */
-    rp     += msglen;
-    remain -= msglen;
-
-    /* Skip */
-    if (!m) continue;
-
     /* Process */
     switch (ver) {
+      case 3:
+        _epgdb_v3_process(rp, msglen, &stats);
+        break;
       case 2:
-        _epgdb_v2_process(&sect, m, &stats);
+        if ((m = htsmsg_binary_deserialize(rp, msglen, NULL))) {
+          _epgdb_v2_process(&sect, m, &stats);
+          htsmsg_destroy(m);
+        }
         break;
       default:
         break;
     }
 
-    /* Cleanup */
-    htsmsg_destroy(m);
+    /* Next */
+    rp     += msglen;
+    remain -= msglen;
   }
 
   free(sect);
+  free(epgdb_load_strs);
+  epgdb_load_strs = NULL;
+  epgdb_load_str_count = 0;
 
   /* Stats */
   tvhlog(LOG_INFO, "epgdb", "loaded v%d", ver);
@@ -233,11 +288,14 @@ void epg_init ( void )
   close(fd);
 }
 
+static void _epgdb_save_done ( void );
+
 void epg_done ( void )
 {
   channel_t *ch;
 
   pthread_mutex_lock(&global_lock);
+  _epgdb_save_done();
   CHANNEL_FOREACH(ch)
     epg_channel_unlink(ch);
   epg_skel_done();
@@ -246,36 +304,297 @@ void epg_done ( void )
 
 /* **************************************************************************
  * Save
+ *
+ * The snapshot is taken in two steps. Under global_lock only the objects
+ * changed since the last snapshot are serialized, the unchanged ones are
+ * referenced by their position in the previous database file. A background
+ * thread then builds the new file (copying the unchanged records) through
+ * a large buffer and renames it over the old one.
  * *************************************************************************/
 
-static int _epg_write ( int fd, htsmsg_t *m )
+#define EPGDB_SAVE_BUFSIZE (1024*1024)
+
+typedef struct epgdb_save_ent {
+  epg_object_t *eo;    ///< NULL when changed/destroyed during the save
+  uint64_t      off;   ///< Offset in the previous file or in the new data
+  uint32_t      len;   ///< Record length (including the length prefix)
+  uint8_t       fresh; ///< The record is in epgdb_save_data
+} epgdb_save_ent_t;
+
+static pthread_t          epgdb_save_tid;
+static int                epgdb_save_active;
+static int                epgdb_save_done;
+static int                epgdb_save_ok;
+static epgdb_save_ent_t  *epgdb_save_ents;
+static uint32_t           epgdb_save_count;
+static uint32_t           epgdb_save_alloc;
+static uint8_t           *epgdb_save_data;     ///< New (changed) records
+static size_t             epgdb_save_used;
+static size_t             epgdb_save_size;
+static sbuf_t             epgdb_save_rec;
+static int                epgdb_save_fd = -1;  ///< The last written database
+static epggrab_stats_t    epgdb_save_stats;
+static int                epgdb_save_changed;
+static int64_t            epgdb_save_start;
+static int64_t            epgdb_save_locked;   ///< Time spent under global_lock
+
+/*
+ * String table
+ *
+ * The indexes are written into the records, so the table only grows
+ * while tvheadend runs (it holds just languages, grabbers and channels).
+ */
+typedef struct epgdb_str {
+  RB_ENTRY(epgdb_str) link;
+  uint32_t            idx;
+  char                str[0];
+} epgdb_str_t;
+
+static RB_HEAD(,epgdb_str) epgdb_strs;
+static epgdb_str_t       **epgdb_str_array;
+static uint32_t            epgdb_str_count;
+
+static int _epgdb_str_cmp ( const void *a, const void *b )
 {
-  int ret = 1;
-  size_t msglen;
-  void *msgdata;
-  if (m) {
-    int r = htsmsg_binary_serialize(m, &msgdata, &msglen, 0x10000);
-    htsmsg_destroy(m);
-    if (!r) {
-      ret = tvh_write(fd, msgdata, msglen);
-      free(msgdata);
+  return strcmp(((epgdb_str_t *)a)->str, ((epgdb_str_t *)b)->str);
+}
+
+uint32_t epgdb_str_index ( const char *str )
+{
+  epgdb_str_t *s, *skel;
+  size_t l = strlen(str) + 1;
+
+  skel = alloca(sizeof(*skel) + l);
+  memcpy(skel->str, str, l);
+  if ((s = RB_FIND(&epgdb_strs, skel, link, _epgdb_str_cmp)) != NULL)
+    return s->idx;
+  s = malloc(sizeof(*s) + l);
+  memcpy(s->str, str, l);
+  if ((epgdb_str_count & 63) == 0)
+    epgdb_str_array = realloc(epgdb_str_array,
+                              (epgdb_str_count + 64) * sizeof(s));
+  epgdb_str_array[epgdb_str_count++] = s;
+  s->idx = epgdb_str_count;
+  RB_INSERT_SORTED(&epgdb_strs, s, link, _epgdb_str_cmp);
+  return s->idx;
+}
+
+const char *epgdb_str_lookup ( uint32_t idx )
+{
+  if (idx == 0 || idx > epgdb_load_str_count)
+    return NULL;
+  return epgdb_load_strs[idx - 1];
+}
+
+/*
+ * Forget the saved copy of the object (it was changed or destroyed)
+ */
+void epg_save_dirty ( epg_object_t *eo )
+{
+  eo->_save_len = 0;
+  if (eo->_save_idx) {
+    epgdb_save_ents[eo->_save_idx - 1].eo = NULL;
+    eo->_save_idx = 0;
+  }
+}
+
+static epgdb_save_ent_t *_epgdb_save_ent_add ( void )
+{
+  if (epgdb_save_count == epgdb_save_alloc) {
+    epgdb_save_alloc = MAX(1024, epgdb_save_alloc * 2);
+    epgdb_save_ents  = realloc(epgdb_save_ents,
+                               epgdb_save_alloc * sizeof(epgdb_save_ent_t));
+  }
+  return &epgdb_save_ents[epgdb_save_count++];
+}
+
+/* Frame the record in epgdb_save_rec and store it to the new data */
+static void _epgdb_save_rec ( epgdb_save_ent_t *ent )
+{
+  sbuf_t *sb = &epgdb_save_rec;
+  uint32_t len = sb->sb_ptr - 4;
+
+  sb->sb_data[0] = len >> 24;
+  sb->sb_data[1] = len >> 16;
+  sb->sb_data[2] = len >> 8;
+  sb->sb_data[3] = len;
+  if (epgdb_save_used + sb->sb_ptr > epgdb_save_size) {
+    epgdb_save_size = MAX(EPGDB_SAVE_BUFSIZE,
+                          MAX(epgdb_save_size * 2, epgdb_save_used + sb->sb_ptr));
+    epgdb_save_data = realloc(epgdb_save_data, epgdb_save_size);
+  }
+  memcpy(epgdb_save_data + epgdb_save_used, sb->sb_data, sb->sb_ptr);
+  ent->off   = epgdb_save_used;
+  ent->len   = sb->sb_ptr;
+  ent->fresh = 1;
+  epgdb_save_used += sb->sb_ptr;
+}
+
+static int _epgdb_save_obj ( epg_object_t *eo )
+{
+  epgdb_save_ent_t *ent;
+
+  if (eo->_save_len && epgdb_save_fd >= 0) {
+    ent = _epgdb_save_ent_add();
+    ent->eo    = eo;
+    ent->off   = eo->_save_off;
+    ent->len   = eo->_save_len;
+    ent->fresh = 0;
+    eo->_save_idx = epgdb_save_count;
+    return 1;
+  }
+  sbuf_reset(&epgdb_save_rec, 0x10000);
+  sbuf_put_be32(&epgdb_save_rec, 0);
+  if (epg_object_encode(eo, &epgdb_save_rec))
+    return 0;
+  ent = _epgdb_save_ent_add();
+  ent->eo = eo;
+  _epgdb_save_rec(ent);
+  eo->_save_idx = epgdb_save_count;
+  return 2;
+}
+
+/* The string table is always the first record */
+static void _epgdb_save_strtab ( void )
+{
+  sbuf_t *sb = &epgdb_save_rec;
+  uint32_t i, l;
+
+  sbuf_reset(sb, 0x10000);
+  sbuf_put_be32(sb, 0);
+  sbuf_put_byte(sb, EPG_UNDEF);
+  sbuf_put_be32(sb, epgdb_str_count);
+  for (i = 0; i < epgdb_str_count; i++) {
+    l = strlen(epgdb_str_array[i]->str) + 1;
+    sbuf_put_be32(sb, l);
+    sbuf_append(sb, epgdb_str_array[i]->str, l);
+  }
+  epgdb_save_ents[0].eo = NULL;
+  _epgdb_save_rec(&epgdb_save_ents[0]);
+}
+
+static void *_epgdb_save_thread ( void *aux )
+{
+  epgdb_save_ent_t *ent;
+  uint8_t *buf;
+  size_t used = 0;
+  uint64_t pos = 0;
+  int fd, r, ok = 0;
+  uint32_t i = 0;
+  char path[PATH_MAX], tmppath[PATH_MAX];
+
+  buf = malloc(EPGDB_SAVE_BUFSIZE);
+  hts_settings_buildpath(path, sizeof(path), "epgdb.v%d", EPG_DB_VERSION);
+  hts_settings_buildpath(tmppath, sizeof(tmppath), "epgdb.v%d.tmp", EPG_DB_VERSION);
+  fd = tvh_open(tmppath, O_CREAT | O_TRUNC | O_RDWR, 0700);
+  if (fd < 0)
+    goto fin;
+
+  for (i = 0; i < epgdb_save_count; i++) {
+    ent = &epgdb_save_ents[i];
+    if (used + ent->len > EPGDB_SAVE_BUFSIZE) {
+      if (tvh_write(fd, buf, used)) goto fin;
+      used = 0;
     }
-  } else {
-    ret = 0;
+    if (ent->len > EPGDB_SAVE_BUFSIZE) {
+      /* Huge record, bypass the buffer */
+      uint8_t *p = ent->fresh ? epgdb_save_data + ent->off : malloc(ent->len);
+      r = ent->fresh || pread(epgdb_save_fd, p, ent->len, ent->off) == ent->len;
+      if (r) r = !tvh_write(fd, p, ent->len);
+      if (!ent->fresh) free(p);
+      if (!r) goto fin;
+    } else if (ent->fresh) {
+      memcpy(buf + used, epgdb_save_data + ent->off, ent->len);
+      used += ent->len;
+    } else if (pread(epgdb_save_fd, buf + used, ent->len, ent->off) != ent->len) {
+      goto fin;
+    } else {
+      used += ent->len;
+    }
+    ent->off = pos;
+    pos     += ent->len;
   }
-  if(ret) {
+  if (used && tvh_write(fd, buf, used)) goto fin;
+  /* The data must be on the disk before the rename replaces the old file */
+  if (fsync(fd)) goto fin;
+  if (rename(tmppath, path)) goto fin;
+  ok = 1;
+
+fin:
+  free(buf);
+  free(epgdb_save_data);
+  epgdb_save_data = NULL;
+  epgdb_save_used = epgdb_save_size = 0;
+  if (epgdb_save_fd >= 0)
+    close(epgdb_save_fd);
+  epgdb_save_fd = -1;
+  if (ok) {
+    epgdb_save_fd = fd;
+    tvhlog(LOG_INFO, "epgdb", "saved %u records (%d changed) in %"PRId64"ms"
+                              " (locked %"PRId64"ms)",
+           epgdb_save_count, epgdb_save_changed,
+           (getmonoclock() - epgdb_save_start) / 1000,
+           epgdb_save_locked / 1000);
+    tvhlog(LOG_INFO, "epgdb", "  brands     %d", epgdb_save_stats.brands.total);
+    tvhlog(LOG_INFO, "epgdb", "  seasons    %d", epgdb_save_stats.seasons.total);
+    tvhlog(LOG_INFO, "epgdb", "  episodes   %d", epgdb_save_stats.episodes.total);
+    tvhlog(LOG_INFO, "epgdb", "  broadcasts %d", epgdb_save_stats.broadcasts.total);
+  } else {
     tvhlog(LOG_ERR, "epgdb", "failed to store epg to disk");
-    close(fd);
-    hts_settings_remove("epgdb.v%d", EPG_DB_VERSION);
+    if (fd >= 0) {
+      close(fd);
+      unlink(tmppath);
+    }
+  }
+  epgdb_save_ok = ok;
+  atomic_exchange(&epgdb_save_done, 1);
+  return NULL;
+}
+
+/*
+ * Wait for the background save and remember where the objects were
+ * stored, so the next snapshot can copy them from the file
+ */
+static void _epgdb_save_finish ( void )
+{
+  epgdb_save_ent_t *ent;
+  uint32_t i;
+
+  if (!epgdb_save_active)
+    return;
+  pthread_join(epgdb_save_tid, NULL);
+  epgdb_save_active = 0;
+  for (i = 0; i < epgdb_save_count; i++) {
+    ent = &epgdb_save_ents[i];
+    if (ent->eo == NULL) continue;
+    ent->eo->_save_idx = 0;
+    if (epgdb_save_ok) {
+      ent->eo->_save_off = ent->off;
+      ent->eo->_save_len = ent->len;
+    }
   }
-  return ret;
+  epgdb_save_count = 0;
 }
 
-static int _epg_write_sect ( int fd, const char *sect )
+static void _epgdb_save_done ( void )
 {
-  htsmsg_t *m = htsmsg_create_map();
-  htsmsg_add_str(m, "__section__", sect);
-  return _epg_write(fd, m);
+  epgdb_str_t *s;
+
+  _epgdb_save_finish();
+  if (epgdb_save_fd >= 0)
+    close(epgdb_save_fd);
+  epgdb_save_fd = -1;
+  free(epgdb_save_ents);
+  epgdb_save_ents = NULL;
+  epgdb_save_alloc = 0;
+  sbuf_free(&epgdb_save_rec);
+  while ((s = RB_FIRST(&epgdb_strs)) != NULL) {
+    RB_REMOVE(&epgdb_strs, s, link);
+    free(s);
+  }
+  free(epgdb_str_array);
+  epgdb_str_array = NULL;
+  epgdb_str_count = 0;
 }
 
 void epg_save_callback ( void *p )
@@ -285,54 +604,64 @@ void epg_save_callback ( void *p )
 
 void epg_save ( void )
 {
-  int fd;
   epg_object_t *eo;
   epg_broadcast_t *ebc;
   channel_t *ch;
-  epggrab_stats_t stats;
+  epggrab_stats_t *stats = &epgdb_save_stats;
+  int r, changed = 0;
   extern gtimer_t epggrab_save_timer;
 
+  lock_assert(&global_lock);
+
   if (epggrab_epgdb_periodicsave)
     gtimer_arm(&epggrab_save_timer, epg_save_callback, NULL, epggrab_epgdb_periodicsave);
-  
-  fd = hts_settings_open_file(1, "epgdb.v%d", EPG_DB_VERSION);
-  if (fd < 0)
-    return;
 
-  memset(&stats, 0, sizeof(stats));
-  if ( _epg_write_sect(fd, "brands") ) return;
+  if (epgdb_save_active) {
+    if (!atomic_get(&epgdb_save_done) && tvheadend_running) {
+      tvhlog(LOG_WARNING, "epgdb", "previous save is still running, skipping");
+      return;
+    }
+    _epgdb_save_finish();
+  }
+
+  epgdb_save_start = getmonoclock();
+  memset(stats, 0, sizeof(*stats));
+  _epgdb_save_ent_add(); /* string table */
   RB_FOREACH(eo,  &epg_brands, uri_link) {
-    if (_epg_write(fd, epg_brand_serialize((epg_brand_t*)eo))) return;
-    stats.brands.total++;
+    if ((r = _epgdb_save_obj(eo)) == 0) continue;
+    changed += r > 1;
+    stats->brands.total++;
   }
-  if ( _epg_write_sect(fd, "seasons") ) return;
   RB_FOREACH(eo,  &epg_seasons, uri_link) {
-    if (_epg_write(fd, epg_season_serialize((epg_season_t*)eo))) return;
-    stats.seasons.total++;
+    if ((r = _epgdb_save_obj(eo)) == 0) continue;
+    changed += r > 1;
+    stats->seasons.total++;
   }
-  if ( _epg_write_sect(fd, "episodes") ) return;
   RB_FOREACH(eo,  &epg_episodes, uri_link) {
-    if (_epg_write(fd, epg_episode_serialize((epg_episode_t*)eo))) return;
-    stats.episodes.total++;
+    if ((r = _epgdb_save_obj(eo)) == 0) continue;
+    changed += r > 1;
+    stats->episodes.total++;
   }
-  if ( _epg_write_sect(fd, "serieslinks") ) return;
   RB_FOREACH(eo, &epg_serieslinks, uri_link) {
-    if (_epg_write(fd, epg_serieslink_serialize((epg_serieslink_t*)eo)))
-      return;
-    stats.seasons.total++;
+    if ((r = _epgdb_save_obj(eo)) == 0) continue;
+    changed += r > 1;
+    stats->seasons.total++;
   }
-  if ( _epg_write_sect(fd, "broadcasts") ) return;
   CHANNEL_FOREACH(ch) {
     RB_FOREACH(ebc, &ch->ch_epg_schedule, sched_link) {
-      if (_epg_write(fd, epg_broadcast_serialize(ebc))) return;
-      stats.broadcasts.total++;
+      if ((r = _epgdb_save_obj((epg_object_t *)ebc)) == 0) continue;
+      changed += r > 1;
+      stats->broadcasts.total++;
     }
   }
+  _epgdb_save_strtab();
 
-  /* Stats */
-  tvhlog(LOG_INFO, "epgdb", "saved");
-  tvhlog(LOG_INFO, "epgdb", "  brands     %d", stats.brands.total);
-  tvhlog(LOG_INFO, "epgdb", "  seasons    %d", stats.seasons.total);
-  tvhlog(LOG_INFO, "epgdb", "  episodes   %d", stats.episodes.total);
-  tvhlog(LOG_INFO, "epgdb", "  broadcasts %d", stats.broadcasts.total);
+  epgdb_save_changed = changed;
+  epgdb_save_locked  = getmonoclock() - epgdb_save_start;
+  tvhtrace("epgdb", "snapshot of %u records (%d changed) in %"PRId64"us",
+           epgdb_save_count, changed, epgdb_save_locked);
+
+  atomic_exchange(&epgdb_save_done, 0);
+  epgdb_save_active = 1;
+  tvhthread_create(&epgdb_save_tid, NULL, _epgdb_save_thread, NULL);
 }
@@ -0,0 +1,270 @@
+/*
+ *  Electronic Program Guide - Text index
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Inverted index of the words in the episode titles and subtitles.
+ *
+ * The index is only used to find the candidate episodes for a query,
+ * the real filters (regexec) are still applied to each of them, so it
+ * must never miss an episode, but it may return too many. Words are
+ * sequences of ASCII letters/digits and non-ASCII (UTF-8) bytes, the
+ * ASCII letters are folded to lower case. All languages of the lang_str
+ * are indexed together.
+ */
+
+#include <string.h>
+#include <ctype.h>
+
+#include "tvheadend.h"
+#include "queue.h"
+#include "epg.h"
+
+typedef struct epg_index_token
+{
+  RB_ENTRY(epg_index_token)   link;
+  LIST_HEAD(,epg_index_post)  posts;
+  char                        str[0];
+} epg_index_token_t;
+
+struct epg_index_post
+{
+  LIST_ENTRY(epg_index_post)  link;
+  epg_index_token_t          *token;
+  epg_episode_t              *episode;
+  uint8_t                     fields;
+};
+
+static RB_HEAD(,epg_index_token) epg_index_tokens;
+
+static int
+_epg_index_token_cmp ( const void *a, const void *b )
+{
+  return strcmp(((epg_index_token_t *)a)->str, ((epg_index_token_t *)b)->str);
+}
+
+static inline int
+_epg_index_char ( uint8_t c )
+{
+  return c >= 0x80 || (c >= '0' && c <= '9') ||
+         (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/* Regular expression characters - such patterns are not indexed */
+static inline int
+_epg_index_plain ( const char *s )
+{
+  for ( ; *s; s++)
+    if ((uint8_t)*s >= 0x80 || strchr(".[]()*+?{}|^$\\", *s))
+      return 0;
+  return 1;
+}
+
+/* **************************************************************************
+ * Maintenance
+ * *************************************************************************/
+
+static epg_index_token_t *
+_epg_index_token_find ( const char *s, size_t len, int create )
+{
+  epg_index_token_t *t, *skel = alloca(sizeof(*skel) + len + 1);
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    skel->str[i] = tolower((uint8_t)s[i]);
+  skel->str[len] = '\0';
+  t = RB_FIND(&epg_index_tokens, skel, link, _epg_index_token_cmp);
+  if (t == NULL && create) {
+    t = malloc(sizeof(*t) + len + 1);
+    memcpy(t->str, skel->str, len + 1);
+    LIST_INIT(&t->posts);
+    RB_INSERT_SORTED(&epg_index_tokens, t, link, _epg_index_token_cmp);
+  }
+  return t;
+}
+
+static void
+_epg_index_add ( epg_episode_t *ee, const char *s, uint8_t field )
+{
+  epg_index_post_t *p;
+  epg_index_token_t *t;
+  const char *e;
+  int i;
+
+  while (*s) {
+    for ( ; *s && !_epg_index_char(*s); s++);
+    for (e = s; *e && _epg_index_char(*e); e++);
+    if (e == s)
+      break;
+    t = _epg_index_token_find(s, e - s, 1);
+    s = e;
+    for (i = 0; i < ee->idx_count; i++)
+      if (ee->idx[i]->token == t)
+        break;
+    if (i < ee->idx_count) {
+      ee->idx[i]->fields |= field;
+      continue;
+    }
+    p = malloc(sizeof(*p));
+    p->token   = t;
+    p->episode = ee;
+    p->fields  = field;
+    LIST_INSERT_HEAD(&t->posts, p, link);
+    if ((ee->idx_count & 7) == 0)
+      ee->idx = realloc(ee->idx, (ee->idx_count + 8) * sizeof(p));
+    ee->idx[ee->idx_count++] = p;
+  }
+}
+
+/*
+ * Remove the episode from the index
+ */
+void
+epg_index_remove ( epg_episode_t *ee )
+{
+  epg_index_post_t *p;
+  epg_index_token_t *t;
+  int i;
+
+  for (i = 0; i < ee->idx_count; i++) {
+    p = ee->idx[i];
+    t = p->token;
+    LIST_REMOVE(p, link);
+    free(p);
+    if (LIST_FIRST(&t->posts) == NULL) {
+      RB_REMOVE(&epg_index_tokens, t, link);
+      free(t);
+    }
+  }
+  free(ee->idx);
+  ee->idx = NULL;
+  ee->idx_count = 0;
+}
+
+/*
+ * (Re)build the index entries for the episode
+ */
+void
+epg_index_update ( epg_episode_t *ee )
+{
+  lang_str_ele_t *ls;
+
+  epg_index_remove(ee);
+  if (ee->title)
+    RB_FOREACH(ls, ee->title, link)
+      _epg_index_add(ee, ls->str, EPG_INDEX_TITLE);
+  if (ee->subtitle)
+    RB_FOREACH(ls, ee->subtitle, link)
+      _epg_index_add(ee, ls->str, EPG_INDEX_SUBTITLE);
+}
+
+/* **************************************************************************
+ * Query
+ * *************************************************************************/
+
+static int
+_epg_index_ptr_cmp ( const void *a, const void *b )
+{
+  const void *x = *(void **)a, *y = *(void **)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void
+_epg_index_collect
+  ( epg_index_token_t *t, uint8_t fields,
+    epg_episode_t ***res, int *count, int *alloc )
+{
+  epg_index_post_t *p;
+
+  LIST_FOREACH(p, &t->posts, link) {
+    if (!(p->fields & fields))
+      continue;
+    if (*count == *alloc) {
+      *alloc = MAX(64, *alloc * 2);
+      *res = realloc(*res, *alloc * sizeof(epg_episode_t *));
+    }
+    (*res)[(*count)++] = p->episode;
+  }
+}
+
+/*
+ * Find the candidate episodes for a case insensitive (regex) match
+ * of the pattern in the given fields.
+ *
+ * Returns -1 when the pattern cannot be resolved using the index,
+ * otherwise the number of the unique episodes stored to *res (which
+ * must be freed by the caller).
+ */
+int
+epg_index_query
+  ( const char *pattern, uint8_t fields, epg_episode_t ***res )
+{
+  epg_index_token_t *t;
+  const char *s, *e, *word = NULL;
+  size_t wlen = 0, len;
+  int full = 0, isfull, count = 0, alloc = 0, i, j;
+  char buf[128];
+
+  *res = NULL;
+  if (!_epg_index_plain(pattern))
+    return -1;
+
+  /*
+   * A word with the separators on both sides in the pattern must be
+   * a whole word in the text, the first and last words might be only
+   * a part of a longer word. Pick the longest whole word, otherwise
+   * the longest partial word.
+   */
+  for (s = pattern; *s; s = e) {
+    for ( ; *s && !_epg_index_char(*s); s++);
+    for (e = s; *e && _epg_index_char(*e); e++);
+    if (e == s)
+      break;
+    len = e - s;
+    isfull = s != pattern && *e != '\0';
+    if (len >= sizeof(buf))
+      continue;
+    if ((isfull && (!full || len > wlen)) || (!full && len > wlen)) {
+      word = s;
+      wlen = len;
+      full = isfull;
+    }
+  }
+  if (word == NULL)
+    return -1;
+
+  if (full) {
+    if ((t = _epg_index_token_find(word, wlen, 0)) != NULL)
+      _epg_index_collect(t, fields, res, &count, &alloc);
+  } else {
+    for (i = 0; i < wlen; i++)
+      buf[i] = tolower((uint8_t)word[i]);
+    buf[wlen] = '\0';
+    RB_FOREACH(t, &epg_index_tokens, link)
+      if (strstr(t->str, buf))
+        _epg_index_collect(t, fields, res, &count, &alloc);
+  }
+
+  /* An episode might be found through more tokens */
+  if (count > 1) {
+    qsort(*res, count, sizeof(epg_episode_t *), _epg_index_ptr_cmp);
+    for (i = j = 1; i < count; i++)
+      if ((*res)[i] != (*res)[j - 1])
+        (*res)[j++] = (*res)[i];
+    count = j;
+  }
+  return count;
+}
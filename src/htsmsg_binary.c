@@ -267,19 +267,107 @@ htsmsg_binary_serialize(htsmsg_t *msg, void **datap, size_t *lenp, int maxlen)
   size_t len;
   uint8_t *data;
 
-  len = htsmsg_binary_count(msg);
-  if(len + 4 > maxlen)
+  len = htsmsg_binary_length(msg);
+  if(len > maxlen)
     return -1;
 
-  data = malloc(len + 4);
+  data = malloc(len);
+  htsmsg_binary_serialize_buf(msg, data, len);
+  *datap = data;
+  *lenp  = len;
+  return 0;
+}
+
 
+/*
+ *
+ */
+size_t
+htsmsg_binary_length(htsmsg_t *msg)
+{
+  return htsmsg_binary_count(msg) + 4;
+}
+
+
+/*
+ *
+ */
+void
+htsmsg_binary_serialize_buf(htsmsg_t *msg, void *datap, size_t len)
+{
+  uint8_t *data = datap;
+
+  len -= 4;
   data[0] = len >> 24;
   data[1] = len >> 16;
   data[2] = len >> 8;
   data[3] = len;
 
   htsmsg_binary_write(msg, data + 4);
-  *datap = data;
-  *lenp  = len + 4;
-  return 0;
+}
+
+
+/*
+ *
+ */
+static uint8_t *
+htsmsg_binary_write_field(uint8_t *ptr, int type, const char *name, size_t l)
+{
+  int namelen = strlen(name);
+
+  *ptr++ = type;
+  *ptr++ = namelen;
+  *ptr++ = l >> 24;
+  *ptr++ = l >> 16;
+  *ptr++ = l >> 8;
+  *ptr++ = l;
+  memcpy(ptr, name, namelen);
+  return ptr + namelen;
+}
+
+
+/*
+ *
+ */
+size_t
+htsmsg_binary_write_s64(uint8_t *ptr, const char *name, int64_t s64)
+{
+  uint64_t u64 = s64;
+  uint8_t *p;
+  int l = 0, i;
+
+  while(u64 != 0) {
+    l++;
+    u64 = u64 >> 8;
+  }
+  p = htsmsg_binary_write_field(ptr, HMF_S64, name, l);
+  u64 = s64;
+  for(i = 0; i < l; i++) {
+    p[i] = u64;
+    u64 = u64 >> 8;
+  }
+  return p + l - ptr;
+}
+
+
+/*
+ *
+ */
+size_t
+htsmsg_binary_write_str(uint8_t *ptr, const char *name, const char *str)
+{
+  size_t l = strlen(str);
+  uint8_t *p = htsmsg_binary_write_field(ptr, HMF_STR, name, l);
+  memcpy(p, str, l);
+  return p + l - ptr;
+}
+
+
+/*
+ *
+ */
+size_t
+htsmsg_binary_write_bin(uint8_t *ptr, const char *name, size_t len)
+{
+  return htsmsg_binary_write_field(ptr, HMF_BIN, name, len) - ptr;
 }
@@ -30,4 +30,26 @@ htsmsg_t *htsmsg_binary_deserialize(const void *data, size_t len,
 int htsmsg_binary_serialize(htsmsg_t *msg, void **datap, size_t *lenp,
 			    int maxlen);
 
+/**
+ * Serialized length of msg (including the length prefix), and
+ * serialization into a caller supplied buffer of that length.
+ */
+size_t htsmsg_binary_length(htsmsg_t *msg);
+
+void htsmsg_binary_serialize_buf(htsmsg_t *msg, void *data, size_t len);
+
+/**
+ * Encode a single field at ptr (for messages built directly in the
+ * wire format), returns the number of bytes written.
+ *
+ * htsmsg_binary_write_bin() only writes the field header, the len bytes
+ * of data must follow it.
+ */
+size_t htsmsg_binary_write_s64(uint8_t *ptr, const char *name, int64_t s64);
+
+size_t htsmsg_binary_write_str(uint8_t *ptr, const char *name,
+                               const char *str);
+
+size_t htsmsg_binary_write_bin(uint8_t *ptr, const char *name, size_t len);
+
 #endif /* HTSMSG_BINARY_H_ */
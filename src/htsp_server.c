@@ -54,6 +54,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #if ENABLE_ANDROID
 #include <sys/vfs.h>
 #define statvfs statfs
@@ -107,8 +108,42 @@ typedef struct htsp_msg {
 			   hm_msg can contain messages that points
 			   to packet payload so to avoid copy we
 			   keep a reference here */
+
+  int64_t hm_dts;       /* DTS of packet (as sent), PTS_UNSET if none */
+  uint64_t hm_seq;      /* Position in queue (for the DTS windows) */
+
+  pktbuf_t *hm_hdr_pb;  /* Codec header sent ahead of the hm_pb payload */
+
+  size_t hm_datalen;    /* Message already in wire format (hm_msg is NULL),
+			   hm_hdr_pb and hm_pb follow it */
+  uint8_t hm_data[0];
 } htsp_msg_t;
 
+/* Largest muxpkt message (without payload) */
+#define HTSP_MUXPKT_HDR_MAX 192
+
+/* Messages sent per writev(), and serialization arena size kept between
+   writes */
+#define HTSP_WRITE_BATCH      32
+#define HTSP_WRITE_ARENA_KEEP (256 * 1024)
+
+
+/**
+ * Running minimum (or maximum) of the DTS of queued packets
+ *
+ * Monotonic deque: only packets that can still become the minimum
+ * (maximum) once older ones have been sent are kept.
+ */
+typedef struct htsp_dts_window {
+  struct {
+    int64_t dts;
+    uint64_t seq;
+  } *hdw_e;
+  int hdw_head;
+  int hdw_count;
+  int hdw_size;             /* Always a power of two */
+  int hdw_max;              /* Track maximum (else minimum) */
+} htsp_dts_window_t;
 
 /**
  *
@@ -120,6 +155,10 @@ typedef struct htsp_msg_q {
   int hmq_strict_prio;      /* Serve this queue 'til it's empty */
   int hmq_length;
   int hmq_payload;          /* Bytes of streaming payload that's enqueued */
+
+  uint64_t hmq_seq;         /* Messages enqueued so far */
+  htsp_dts_window_t hmq_dts_min;
+  htsp_dts_window_t hmq_dts_max;
 } htsp_msg_q_t;
 
 /**
@@ -213,6 +252,9 @@ streaming_target_t *hs_transcoder;
 
   int hs_first;
 
+  uint8_t hs_muxpkt_hdr[48]; // muxpkt fields common to all packets
+  size_t hs_muxpkt_hdrlen;
+
 } htsp_subscription_t;
 
 
@@ -285,9 +327,68 @@ htsp_msg_destroy(htsp_msg_t *hm)
   htsmsg_destroy(hm->hm_msg);
   if(hm->hm_pb != NULL)
     pktbuf_ref_dec(hm->hm_pb);
+  if(hm->hm_hdr_pb != NULL)
+    pktbuf_ref_dec(hm->hm_hdr_pb);
   free(hm);
 }
 
+/**
+ *
+ */
+static void
+htsp_dts_window_push(htsp_dts_window_t *w, uint64_t seq, int64_t dts)
+{
+  int i, mask = w->hdw_size - 1;
+
+  /* Drop entries superseded by the new one */
+  while(w->hdw_count) {
+    i = (w->hdw_head + w->hdw_count - 1) & mask;
+    if(w->hdw_max ? w->hdw_e[i].dts > dts : w->hdw_e[i].dts < dts)
+      break;
+    w->hdw_count--;
+  }
+
+  if(w->hdw_count == w->hdw_size) {
+    int size = w->hdw_size ? w->hdw_size * 2 : 64;
+    typeof(w->hdw_e) e = malloc(size * sizeof(*e));
+    for(i = 0; i < w->hdw_count; i++)
+      e[i] = w->hdw_e[(w->hdw_head + i) & mask];
+    free(w->hdw_e);
+    w->hdw_e = e;
+    w->hdw_head = 0;
+    w->hdw_size = size;
+    mask = size - 1;
+  }
+
+  i = (w->hdw_head + w->hdw_count) & mask;
+  w->hdw_e[i].dts = dts;
+  w->hdw_e[i].seq = seq;
+  w->hdw_count++;
+}
+
+static void
+htsp_dts_window_pop(htsp_dts_window_t *w, uint64_t seq)
+{
+  if(w->hdw_count && w->hdw_e[w->hdw_head].seq == seq) {
+    w->hdw_head = (w->hdw_head + 1) & (w->hdw_size - 1);
+    w->hdw_count--;
+  }
+}
+
+static int64_t
+htsp_dts_window_get(htsp_dts_window_t *w)
+{
+  return w->hdw_count ? w->hdw_e[w->hdw_head].dts : PTS_UNSET;
+}
+
+static void
+htsp_dts_window_clear(htsp_dts_window_t *w)
+{
+  free(w->hdw_e);
+  w->hdw_e = NULL;
+  w->hdw_head = w->hdw_count = w->hdw_size = 0;
+}
+
 /**
  *
  */
@@ -297,6 +398,24 @@ htsp_init_queue(htsp_msg_q_t *hmq, int strict_prio)
   TAILQ_INIT(&hmq->hmq_q);
   hmq->hmq_length = 0;
   hmq->hmq_strict_prio = strict_prio;
+  hmq->hmq_seq = 0;
+  memset(&hmq->hmq_dts_min, 0, sizeof(hmq->hmq_dts_min));
+  memset(&hmq->hmq_dts_max, 0, sizeof(hmq->hmq_dts_max));
+  hmq->hmq_dts_max.hdw_max = 1;
+}
+
+/**
+ * Message removed from the head of its queue (htsp_out_mutex held)
+ */
+static void
+htsp_dequeued(htsp_msg_q_t *hmq, htsp_msg_t *hm)
+{
+  hmq->hmq_length--;
+  hmq->hmq_payload -= hm->hm_payloadsize;
+  if(hm->hm_dts != PTS_UNSET) {
+    htsp_dts_window_pop(&hmq->hmq_dts_min, hm->hm_seq);
+    htsp_dts_window_pop(&hmq->hmq_dts_max, hm->hm_seq);
+  }
 }
 
 /**
@@ -320,6 +439,8 @@ htsp_flush_queue(htsp_connection_t *htsp, htsp_msg_q_t *hmq)
   // reset
   hmq->hmq_length = 0;
   hmq->hmq_payload = 0;
+  htsp_dts_window_clear(&hmq->hmq_dts_min);
+  htsp_dts_window_clear(&hmq->hmq_dts_max);
   pthread_mutex_unlock(&htsp->htsp_out_mutex);
 }
 
@@ -355,17 +476,8 @@ htsp_subscription_destroy(htsp_connection_t *htsp, htsp_subscription_t *hs)
  *
  */
 static void
-htsp_send(htsp_connection_t *htsp, htsmsg_t *m, pktbuf_t *pb,
-	  htsp_msg_q_t *hmq, int payloadsize)
+htsp_enqueue(htsp_connection_t *htsp, htsp_msg_t *hm, htsp_msg_q_t *hmq)
 {
-  htsp_msg_t *hm = malloc(sizeof(htsp_msg_t));
-
-  hm->hm_msg = m;
-  hm->hm_pb = pb;
-  if(pb != NULL)
-    pktbuf_ref_inc(pb);
-  hm->hm_payloadsize = payloadsize;
-  
   pthread_mutex_lock(&htsp->htsp_out_mutex);
 
   TAILQ_INSERT_TAIL(&hmq->hmq_q, hm, hm_link);
@@ -381,11 +493,37 @@ htsp_send(htsp_connection_t *htsp, htsmsg_t *m, pktbuf_t *pb,
   }
 
   hmq->hmq_length++;
-  hmq->hmq_payload += payloadsize;
+  hmq->hmq_payload += hm->hm_payloadsize;
+  hm->hm_seq = hmq->hmq_seq++;
+  if(hm->hm_dts != PTS_UNSET) {
+    htsp_dts_window_push(&hmq->hmq_dts_min, hm->hm_seq, hm->hm_dts);
+    htsp_dts_window_push(&hmq->hmq_dts_max, hm->hm_seq, hm->hm_dts);
+  }
   pthread_cond_signal(&htsp->htsp_out_cond);
   pthread_mutex_unlock(&htsp->htsp_out_mutex);
 }
 
+/**
+ *
+ */
+static void
+htsp_send(htsp_connection_t *htsp, htsmsg_t *m, pktbuf_t *pb,
+	  htsp_msg_q_t *hmq, int payloadsize)
+{
+  htsp_msg_t *hm = malloc(sizeof(htsp_msg_t));
+
+  hm->hm_msg = m;
+  hm->hm_pb = pb;
+  if(pb != NULL)
+    pktbuf_ref_inc(pb);
+  hm->hm_payloadsize = payloadsize;
+  hm->hm_hdr_pb = NULL;
+  hm->hm_dts = PTS_UNSET;
+  hm->hm_datalen = 0;
+
+  htsp_enqueue(htsp, hm, hmq);
+}
+
 /**
  *
  */
@@ -1731,6 +1869,11 @@ htsp_method_subscribe(htsp_connection_t *htsp, htsmsg_t *in)
   htsp_init_queue(&hs->hs_q, 0);
 
   hs->hs_sid = sid;
+  hs->hs_muxpkt_hdrlen =
+    htsmsg_binary_write_str(hs->hs_muxpkt_hdr, "method", "muxpkt");
+  hs->hs_muxpkt_hdrlen +=
+    htsmsg_binary_write_s64(hs->hs_muxpkt_hdr + hs->hs_muxpkt_hdrlen,
+                            "subscriptionId", (uint32_t)sid);
   LIST_INSERT_HEAD(&htsp->htsp_subscriptions, hs, hs_link);
   streaming_target_init(&hs->hs_input, htsp_streaming_input, hs, 0);
 
@@ -1738,11 +1881,20 @@ htsp_method_subscribe(htsp_connection_t *htsp, htsmsg_t *in)
 
 #if ENABLE_TIMESHIFT
   if (timeshiftPeriod != 0) {
+    channel_t *tsch = ch;
+#if ENABLE_LIBAV
+    /* Transcoded streams differ per subscriber, keep the buffer private */
+    if (transcoding_enabled &&
+        (htsmsg_get_str(in, "videoCodec") ||
+         htsmsg_get_str(in, "audioCodec") ||
+         htsmsg_get_str(in, "subtitleCodec")))
+      tsch = NULL;
+#endif
     if (timeshiftPeriod == ~0)
       tvhlog(LOG_DEBUG, "htsp", "using timeshift buffer (unlimited)");
     else
       tvhlog(LOG_DEBUG, "htsp", "using timeshift buffer (%u mins)", timeshiftPeriod / 60);
-    st = hs->hs_tshift = timeshift_create(st, timeshiftPeriod);
+    st = hs->hs_tshift = timeshift_create(st, timeshiftPeriod, tsch);
     normts = 1;
   }
 #endif
@@ -2367,52 +2519,107 @@ htsp_write_scheduler(void *aux)
 {
   htsp_connection_t *htsp = aux;
   htsp_msg_q_t *hmq;
-  htsp_msg_t *hm;
-  void *dptr;
-  size_t dlen;
-  int r;
+  htsp_msg_t *hm, *batch[HTSP_WRITE_BATCH];
+  struct iovec iov[HTSP_WRITE_BATCH * 3];
+  size_t len[HTSP_WRITE_BATCH], need, arena_size = 0;
+  uint8_t *arena = NULL, *p;
+  int i, n, niov, r;
 
   pthread_mutex_lock(&htsp->htsp_out_mutex);
 
   while(htsp->htsp_writer_run) {
 
-    if((hmq = TAILQ_FIRST(&htsp->htsp_active_output_queues)) == NULL) {
+    /* Take whatever is ready (up to a batch), in queue priority order */
+    for(n = 0; n < HTSP_WRITE_BATCH; n++) {
+
+      if((hmq = TAILQ_FIRST(&htsp->htsp_active_output_queues)) == NULL)
+        break;
+
+      hm = TAILQ_FIRST(&hmq->hmq_q);
+      TAILQ_REMOVE(&hmq->hmq_q, hm, hm_link);
+      htsp_dequeued(hmq, hm);
+
+      TAILQ_REMOVE(&htsp->htsp_active_output_queues, hmq, hmq_link);
+      if(hmq->hmq_length) {
+        /* Still messages to be sent, put back in active queues */
+        if(hmq->hmq_strict_prio) {
+          TAILQ_INSERT_HEAD(&htsp->htsp_active_output_queues, hmq, hmq_link);
+        } else {
+          TAILQ_INSERT_TAIL(&htsp->htsp_active_output_queues, hmq, hmq_link);
+        }
+      }
+
+      batch[n] = hm;
+    }
+
+    if(n == 0) {
       /* Nothing to be done, go to sleep */
       pthread_cond_wait(&htsp->htsp_out_cond, &htsp->htsp_out_mutex);
       continue;
     }
 
-    hm = TAILQ_FIRST(&hmq->hmq_q);
-    TAILQ_REMOVE(&hmq->hmq_q, hm, hm_link);
-    hmq->hmq_length--;
-    hmq->hmq_payload -= hm->hm_payloadsize;
+    pthread_mutex_unlock(&htsp->htsp_out_mutex);
 
-    TAILQ_REMOVE(&htsp->htsp_active_output_queues, hmq, hmq_link);
-    if(hmq->hmq_length) {
-      /* Still messages to be sent, put back in active queues */
-      if(hmq->hmq_strict_prio) {
-        TAILQ_INSERT_HEAD(&htsp->htsp_active_output_queues, hmq, hmq_link);
+    /* Serialize htsmsg based messages into the (reused) arena */
+    need = 0;
+    for(i = 0; i < n; i++) {
+      len[i] = batch[i]->hm_msg ? htsmsg_binary_length(batch[i]->hm_msg) : 0;
+      if(len[i] > INT32_MAX) {
+        tvhlog(LOG_WARNING, "htsp", "%s: failed to serialize data",
+               htsp->htsp_logname);
+        len[i] = 0; // dropped
+      }
+      need += len[i];
+    }
+    if(need > arena_size) {
+      arena_size = need;
+      arena = realloc(arena, arena_size);
+    }
+
+    p = arena;
+    niov = 0;
+    for(i = 0; i < n; i++) {
+      hm = batch[i];
+      if(hm->hm_msg) {
+        if(!len[i])
+          continue;
+        htsmsg_binary_serialize_buf(hm->hm_msg, p, len[i]);
+        iov[niov].iov_base = p;
+        iov[niov].iov_len  = len[i];
+        niov++;
+        p += len[i];
       } else {
-        TAILQ_INSERT_TAIL(&htsp->htsp_active_output_queues, hmq, hmq_link);
+        /* Already encoded (muxpkt), payload goes straight from the packet */
+        iov[niov].iov_base = hm->hm_data;
+        iov[niov].iov_len  = hm->hm_datalen;
+        niov++;
+        if(hm->hm_hdr_pb) {
+          iov[niov].iov_base = pktbuf_ptr(hm->hm_hdr_pb);
+          iov[niov].iov_len  = pktbuf_len(hm->hm_hdr_pb);
+          niov++;
+        }
+        if(hm->hm_pb) {
+          iov[niov].iov_base = pktbuf_ptr(hm->hm_pb);
+          iov[niov].iov_len  = pktbuf_len(hm->hm_pb);
+          niov++;
+        }
       }
     }
 
-    pthread_mutex_unlock(&htsp->htsp_out_mutex);
+    r = niov ? tvh_writev(htsp->htsp_fd, iov, niov) : 0;
 
-    if (htsmsg_binary_serialize(hm->hm_msg, &dptr, &dlen, INT32_MAX) != 0) {
-      tvhlog(LOG_WARNING, "htsp", "%s: failed to serialize data",
-             htsp->htsp_logname);
-      htsp_msg_destroy(hm);
-      pthread_mutex_lock(&htsp->htsp_out_mutex);
-      continue;
-    }
+    for(i = 0; i < n; i++)
+      htsp_msg_destroy(batch[i]);
 
-    htsp_msg_destroy(hm);
+    /* Don't hold on to the memory of a one-off large message */
+    if(arena_size > HTSP_WRITE_ARENA_KEEP) {
+      free(arena);
+      arena = NULL;
+      arena_size = 0;
+    }
 
-    r = tvh_write(htsp->htsp_fd, dptr, dlen);
-    free(dptr);
     pthread_mutex_lock(&htsp->htsp_out_mutex);
-    
+
     if (r) {
       tvhlog(LOG_INFO, "htsp", "%s: Write error -- %s",
              htsp->htsp_logname, strerror(errno));
@@ -2423,6 +2630,7 @@ htsp_write_scheduler(void *aux)
 
   shutdown(htsp->htsp_fd, SHUT_RDWR);
   pthread_mutex_unlock(&htsp->htsp_out_mutex);
+  free(arena);
   return NULL;
 }
 
@@ -2875,6 +3083,8 @@ htsp_stream_deliver(htsp_subscription_t *hs, th_pkt_t *pkt)
   htsp_connection_t *htsp = hs->hs_htsp;
   int64_t ts;
   int qlen = hs->hs_q.hmq_payload;
+  uint8_t *d;
+  size_t plen, len;
 
   if(!htsp_is_stream_enabled(hs, pkt->pkt_componentindex)) {
     pkt_ref_dec(pkt);
@@ -2892,38 +3102,60 @@ htsp_stream_deliver(htsp_subscription_t *hs, th_pkt_t *pkt)
     return;
   }
 
-  m = htsmsg_create_map();
- 
-  htsmsg_add_str(m, "method", "muxpkt");
-  htsmsg_add_u32(m, "subscriptionId", hs->hs_sid);
-  htsmsg_add_u32(m, "frametype", frametypearray[pkt->pkt_frametype]);
+  /**
+   * muxpkt is encoded straight into the binary wire format (the same
+   * fields, in the same order as a htsmsg would give). The payload (and
+   * codec header ahead of it) is not copied, the writer sends it from the
+   * packet buffers, which are shared by all subscribers of the service.
+   */
+  hm = malloc(sizeof(htsp_msg_t) + HTSP_MUXPKT_HDR_MAX);
+  d = hm->hm_data + 4;
 
-  htsmsg_add_u32(m, "stream", pkt->pkt_componentindex);
-  htsmsg_add_u32(m, "com", pkt->pkt_commercial);
+  memcpy(d, hs->hs_muxpkt_hdr, hs->hs_muxpkt_hdrlen);
+  d += hs->hs_muxpkt_hdrlen;
+  d += htsmsg_binary_write_s64(d, "frametype",
+                               frametypearray[pkt->pkt_frametype]);
+  d += htsmsg_binary_write_s64(d, "stream", pkt->pkt_componentindex);
+  d += htsmsg_binary_write_s64(d, "com", pkt->pkt_commercial);
 
   if(pkt->pkt_pts != PTS_UNSET) {
     int64_t pts = hs->hs_90khz ? pkt->pkt_pts : ts_rescale(pkt->pkt_pts, 1000000);
-    htsmsg_add_s64(m, "pts", pts);
+    d += htsmsg_binary_write_s64(d, "pts", pts);
   }
 
+  hm->hm_dts = PTS_UNSET;
   if(pkt->pkt_dts != PTS_UNSET) {
     int64_t dts = hs->hs_90khz ? pkt->pkt_dts : ts_rescale(pkt->pkt_dts, 1000000);
-    htsmsg_add_s64(m, "dts", dts);
+    d += htsmsg_binary_write_s64(d, "dts", dts);
+    hm->hm_dts = dts;
   }
 
   uint32_t dur = hs->hs_90khz ? pkt->pkt_duration : ts_rescale(pkt->pkt_duration, 1000000);
-  htsmsg_add_u32(m, "duration", dur);
-  
-  pkt = pkt_merge_header(pkt);
+  d += htsmsg_binary_write_s64(d, "duration", dur);
+
+  plen = pktbuf_len(pkt->pkt_payload);
+  if(pkt->pkt_header)
+    plen += pktbuf_len(pkt->pkt_header);
+  d += htsmsg_binary_write_bin(d, "payload", plen);
+
+  len = d - hm->hm_data - 4 + plen;
+  hm->hm_data[0] = len >> 24;
+  hm->hm_data[1] = len >> 16;
+  hm->hm_data[2] = len >> 8;
+  hm->hm_data[3] = len;
+  hm->hm_datalen = d - hm->hm_data;
+
+  hm->hm_msg = NULL;
+  hm->hm_pb = pkt->pkt_payload;
+  if(hm->hm_pb != NULL)
+    pktbuf_ref_inc(hm->hm_pb);
+  hm->hm_hdr_pb = pkt->pkt_header;
+  if(hm->hm_hdr_pb != NULL)
+    pktbuf_ref_inc(hm->hm_hdr_pb);
+  hm->hm_payloadsize = plen;
 
-  /**
-   * Since we will serialize directly we use 'binptr' which is a binary
-   * object that just points to data, thus avoiding a copy.
-   */
-  htsmsg_add_binptr(m, "payload", pktbuf_ptr(pkt->pkt_payload),
-		    pktbuf_len(pkt->pkt_payload));
-  htsp_send(htsp, m, pkt->pkt_payload, &hs->hs_q, pktbuf_len(pkt->pkt_payload));
-  atomic_add(&hs->hs_s->ths_bytes_out, pktbuf_len(pkt->pkt_payload));
+  htsp_enqueue(htsp, hm, &hs->hs_q);
+  atomic_add(&hs->hs_s->ths_bytes_out, plen);
 
   if(hs->hs_last_report != dispatch_clock) {
 
@@ -2942,31 +3174,17 @@ htsp_stream_deliver(htsp_subscription_t *hs, th_pkt_t *pkt)
      */
     
     pthread_mutex_lock(&htsp->htsp_out_mutex);
+    ts = htsp_dts_window_get(&hs->hs_q.hmq_dts_max) -
+         htsp_dts_window_get(&hs->hs_q.hmq_dts_min);
+    pthread_mutex_unlock(&htsp->htsp_out_mutex);
 
-    int64_t min_dts = PTS_UNSET;
-    int64_t max_dts = PTS_UNSET;
-    TAILQ_FOREACH(hm, &hs->hs_q.hmq_q, hm_link) {
-      if(!hm->hm_msg)
-	continue;
-      if(htsmsg_get_s64(hm->hm_msg, "dts", &ts))
-	continue;
-      if(ts == PTS_UNSET)
-	continue;
-  
-      if(min_dts == PTS_UNSET)
-	min_dts = ts;
-      else
-	min_dts = MIN(ts, min_dts);
-
-      if(max_dts == PTS_UNSET)
-	max_dts = ts;
-      else
-	max_dts = MAX(ts, max_dts);
-    }
-
-    htsmsg_add_s64(m, "delay", max_dts - min_dts);
+    htsmsg_add_s64(m, "delay", ts);
 
-    pthread_mutex_unlock(&htsp->htsp_out_mutex);
+    /* Also shown with the subscription status */
+    hs->hs_s->ths_queue_delay = hs->hs_90khz ? ts / 90 : ts / 1000;
+    hs->hs_s->ths_drops = hs->hs_dropstats[PKT_B_FRAME] +
+                          hs->hs_dropstats[PKT_P_FRAME] +
+                          hs->hs_dropstats[PKT_I_FRAME];
 
     htsmsg_add_u32(m, "Bdrops", hs->hs_dropstats[PKT_B_FRAME]);
     htsmsg_add_u32(m, "Pdrops", hs->hs_dropstats[PKT_P_FRAME]);
@@ -2995,7 +3213,8 @@ htsp_subscription_start(htsp_subscription_t *hs, const streaming_start_t *ss)
 
   for(i = 0; i < ss->ss_num_components; i++) {
     const streaming_start_component_t *ssc = &ss->ss_components[i];
-    if (ssc->ssc_type == SCT_MPEG2VIDEO || ssc->ssc_type == SCT_H264) {
+    if (ssc->ssc_type == SCT_MPEG2VIDEO || ssc->ssc_type == SCT_H264 ||
+        ssc->ssc_type == SCT_HEVC) {
       if (ssc->ssc_width == 0 || ssc->ssc_height == 0) {
         hs->hs_wait_for_video = 1;
         return;
@@ -3025,7 +3244,8 @@ htsp_subscription_start(htsp_subscription_t *hs, const streaming_start_t *ss)
       htsmsg_add_u32(c, "ancillary_id", ssc->ssc_ancillary_id);
     }
 
-    if(ssc->ssc_type == SCT_MPEG2VIDEO || ssc->ssc_type == SCT_H264) {
+    if(ssc->ssc_type == SCT_MPEG2VIDEO || ssc->ssc_type == SCT_H264 ||
+       ssc->ssc_type == SCT_HEVC) {
       if(ssc->ssc_width)
         htsmsg_add_u32(c, "width", ssc->ssc_width);
       if(ssc->ssc_height)
@@ -84,6 +84,10 @@ tvh_input_stream_create_msg
   htsmsg_add_u32(m, "bps", st->stats.bps);
   htsmsg_add_u32(m, "te", st->stats.te);
   htsmsg_add_u32(m, "cc", st->stats.cc);
+  htsmsg_add_u32(m, "drop", st->stats.drop);
+  htsmsg_add_u32(m, "qfill", st->stats.qfill);
+  htsmsg_add_u32(m, "tbatch", st->stats.tbatch);
+  htsmsg_add_u32(m, "tlock", st->stats.tlock);
   htsmsg_add_u32(m, "ec_bit", st->stats.ec_bit);
   htsmsg_add_u32(m, "tc_bit", st->stats.tc_bit);
   htsmsg_add_u32(m, "ec_block", st->stats.ec_block);
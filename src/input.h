@@ -50,6 +50,10 @@ struct tvh_input_stream_stats
   int bps;    ///< bandwidth (bps)
   int cc;     ///< number of continuity errors
   int te;     ///< number of transport errors
+  int drop;   ///< number of packets dropped (input queue full)
+  int qfill;  ///< input queue fill level (percent)
+  int tbatch; ///< average table feed batch size (packets)
+  int tlock;  ///< average global_lock hold time per table batch (us)
 
   signal_status_scale_t signal_scale;
   signal_status_scale_t snr_scale;
@@ -20,7 +20,7 @@
 
 void
 mpegts_init ( int linuxdvb_mask, str_list_t *satip_client,
-              str_list_t *tsfiles, int tstuners )
+              str_list_t *tsfiles, int tstuners, int iptv_threads )
 {
   /* Register classes (avoid API 400 errors due to not yet defined) */
   idclass_register(&mpegts_network_class);
@@ -49,7 +49,7 @@ mpegts_init ( int linuxdvb_mask, str_list_t *satip_client,
 
   /* IPTV */
 #if ENABLE_IPTV
-  iptv_init();
+  iptv_init(iptv_threads);
 #endif
 
   /* Linux DVB */
@@ -69,18 +69,30 @@ extern const idclass_t mpegts_input_class;
  * *************************************************************************/
 
 void mpegts_init ( int linuxdvb_mask, str_list_t *satip_client,
-                   str_list_t *tsfiles, int tstuners );
+                   str_list_t *tsfiles, int tstuners, int iptv_threads );
 void mpegts_done ( void );
 
 /* **************************************************************************
  * Data / SI processing
  * *************************************************************************/
 
+/*
+ * Input ring chunk
+ *
+ * Each input owns a byte ring of these, filled by the frontend reader
+ * (producer) and processed in place by mpegts_input_thread (consumer).
+ * A chunk takes only the space of its data. Chunks never wrap, a chunk
+ * without data (mp_len == 0) tells that the next one is at the ring start.
+ */
+#define MPEGTS_RING_SIZE       (2 * 1024 * 1024)
+#define MPEGTS_RING_CHUNK_PKTS 100  /* max packets in one chunk */
+#define MPEGTS_RING_ALIGN      16
+
 struct mpegts_packet
 {
-  TAILQ_ENTRY(mpegts_packet)  mp_link;
-  size_t                      mp_len;
   mpegts_mux_t               *mp_mux;
+  uint32_t                    mp_len;   ///< Data length
+  uint32_t                    mp_size;  ///< Chunk length in the ring
   uint8_t                     mp_data[0];
 };
 
@@ -125,11 +137,26 @@ typedef struct mpegts_pid_sub
   void                     *mps_owner;
 } mpegts_pid_sub_t;
 
+/*
+ * Per-PID delivery target, rebuilt by the input thread when services
+ * start/stop or PID subscriptions change
+ */
+typedef struct mpegts_pid_fanout
+{
+  mpegts_service_t          *mpf_service;
+  elementary_stream_t       *mpf_stream; // valid while mpf_gen matches
+  int                        mpf_gen;    //   s_components_gen
+  int                        mpf_table;  // deliver as table data
+} mpegts_pid_fanout_t;
+
 typedef struct mpegts_pid
 {
   int                      mp_pid;
   int                      mp_fd;   // linuxdvb demux fd
+  int                      mp_type; // OR of all subscriber types (MPS_*)
   int8_t                   mp_cc;
+  int                      mp_fanout_count;
+  mpegts_pid_fanout_t     *mp_fanout; // services receiving this pid
   RB_HEAD(,mpegts_pid_sub) mp_subs; // subscribers to pid
   RB_ENTRY(mpegts_pid)     mp_link;
 } mpegts_pid_t;
@@ -214,12 +241,17 @@ struct mpegts_table
  * When in raw mode we need to enqueue raw TS packet
  * to a different thread because we need to hold
  * global_lock when doing delivery of the tables
+ *
+ * Packets are batched (all table packets from one input chunk,
+ * which always belongs to a single mux) to reduce the number
+ * of allocations and global_lock round trips
  */
 
 struct mpegts_table_feed {
   TAILQ_ENTRY(mpegts_table_feed) mtf_link;
-  uint8_t mtf_tsb[188];
   mpegts_mux_t *mtf_mux;
+  int mtf_len;      // number of packets
+  uint8_t mtf_tsb[0];
 };
 
 /*
@@ -375,8 +407,8 @@ struct mpegts_mux
    */
 
   RB_HEAD(, mpegts_pid)       mm_pids;
-  int                         mm_last_pid;
-  mpegts_pid_t               *mm_last_mp;
+  mpegts_pid_t              **mm_pid_table; // direct index (0..FULLMUX_PID)
+  int                         mm_fanout_dirty;
 
   int                         mm_num_tables;
   LIST_HEAD(, mpegts_table)   mm_tables;
@@ -551,11 +583,16 @@ struct mpegts_input
   time_t mi_last_dispatch;
 
   /* Data input */
-  // Note: this section is protected by mi_input_lock
+  // Note: the ring is single consumer (mpegts_input_thread), producers
+  //       are serialized by mi_input_lock, which the consumer only takes
+  //       to sleep when the ring is empty
   pthread_t                       mi_input_tid;
   pthread_mutex_t                 mi_input_lock;
   pthread_cond_t                  mi_input_cond;
-  TAILQ_HEAD(,mpegts_packet)      mi_input_queue;
+  uint8_t                        *mi_input_ring;
+  volatile int                    mi_input_head; ///< Next chunk to process
+  volatile int                    mi_input_tail; ///< Next chunk to fill
+  int                             mi_input_wait; ///< Consumer is sleeping
 
   /* Data processing/output */
   // Note: this lock (mi_output_lock) protects all the remaining
@@ -573,6 +610,9 @@ struct mpegts_input
   pthread_t                       mi_table_tid;
   pthread_cond_t                  mi_table_cond;
   mpegts_table_feed_queue_t       mi_table_queue;
+  int                             mi_table_batches;  ///< Since last status
+  int                             mi_table_pkts;     ///< Since last status
+  int64_t                         mi_table_lock_time;///< global_lock held (us)
 
   /* DBus */
 #if ENABLE_DBUS_1
@@ -749,13 +789,17 @@ void mpegts_mux_nice_name( mpegts_mux_t *mm, char *buf, size_t len );
 
 mpegts_pid_t *mpegts_mux_find_pid_(mpegts_mux_t *mm, int pid, int create);
 
+void mpegts_mux_remove_pid(mpegts_mux_t *mm, mpegts_pid_t *mp);
+
 static inline mpegts_pid_t *
 mpegts_mux_find_pid(mpegts_mux_t *mm, int pid, int create)
 {
-  if (mm->mm_last_pid != pid)
-    return mpegts_mux_find_pid_(mm, pid, create);
-  else
-    return mm->mm_last_mp;
+  mpegts_pid_t *mp = NULL;
+  if (mm->mm_pid_table && pid >= 0 && pid <= MPEGTS_FULLMUX_PID)
+    mp = mm->mm_pid_table[pid];
+  if (mp || !create)
+    return mp;
+  return mpegts_mux_find_pid_(mm, pid, create);
 }
 
 void mpegts_input_recv_packets
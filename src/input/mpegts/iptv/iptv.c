@@ -21,6 +21,7 @@
 #include "tvhpoll.h"
 #include "tcp.h"
 #include "settings.h"
+#include "atomic.h"
 
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -39,10 +40,8 @@
  * IPTV state
  * *************************************************************************/
 
-iptv_input_t   *iptv_input;
-tvhpoll_t      *iptv_poll;
-pthread_t       iptv_thread;
-pthread_mutex_t iptv_lock;
+iptv_input_t   *iptv_input[IPTV_THREADS_MAX];
+int             iptv_input_count;
 
 /* **************************************************************************
  * IPTV handlers
@@ -99,15 +98,28 @@ const idclass_t iptv_input_class = {
   }
 };
 
+/*
+ * Map the mux to the input (thread), the UUID is random enough
+ */
+iptv_input_t *
+iptv_input_find ( iptv_mux_t *im )
+{
+  const uint8_t *u = im->mm_id.in_uuid;
+  uint32_t h = (u[0] << 24) | (u[1] << 16) | (u[2] << 8) | u[3];
+  return iptv_input[h % iptv_input_count];
+}
+
 static int
 iptv_input_is_free ( mpegts_input_t *mi )
 {
-  int c = 0;
+  int c = 0, i;
   mpegts_mux_instance_t *mmi;
   mpegts_network_link_t *mnl;
   
-  LIST_FOREACH(mmi, &mi->mi_mux_active, mmi_active_link)
-    c++;
+  /* The limits are shared by all inputs */
+  for (i = 0; i < iptv_input_count; i++)
+    LIST_FOREACH(mmi, &iptv_input[i]->mi_mux_active, mmi_active_link)
+      c++;
   
   /* Limit reached */
   LIST_FOREACH(mnl, &mi->mi_networks, mnl_mi_link) {
@@ -129,32 +141,35 @@ iptv_input_is_free ( mpegts_input_t *mi )
 static int
 iptv_input_get_weight ( mpegts_input_t *mi, int flags )
 {
-  int c = 0, w = 0;
+  int w = 0, i;
   const th_subscription_t *ths;
   const service_t *s;
   const mpegts_mux_instance_t *mmi;
-  LIST_FOREACH(mmi, &mi->mi_mux_active, mmi_active_link)
-    c++;
+  mpegts_input_t *mi2;
 
-  /* Find the "min" weight */
+  /* Find the "min" weight (in all inputs) */
   if (!iptv_input_is_free(mi)) {
     w = 1000000;
 
-    /* Direct subs */
-    LIST_FOREACH(mmi, &mi->mi_mux_active, mmi_active_link) {
-      LIST_FOREACH(ths, &mmi->mmi_subs, ths_mmi_link) {
-        w = MIN(w, ths->ths_weight);
+    for (i = 0; i < iptv_input_count; i++) {
+      mi2 = (mpegts_input_t *)iptv_input[i];
+
+      /* Direct subs */
+      LIST_FOREACH(mmi, &mi2->mi_mux_active, mmi_active_link) {
+        LIST_FOREACH(ths, &mmi->mmi_subs, ths_mmi_link) {
+          w = MIN(w, ths->ths_weight);
+        }
       }
-    }
 
-    /* Service subs */
-    pthread_mutex_lock(&mi->mi_output_lock);
-    LIST_FOREACH(s, &mi->mi_transports, s_active_link) {
-      LIST_FOREACH(ths, &s->s_subscriptions, ths_service_link) {
-        w = MIN(w, ths->ths_weight);
+      /* Service subs */
+      pthread_mutex_lock(&mi2->mi_output_lock);
+      LIST_FOREACH(s, &mi2->mi_transports, s_active_link) {
+        LIST_FOREACH(ths, &s->s_subscriptions, ths_service_link) {
+          w = MIN(w, ths->ths_weight);
+        }
       }
+      pthread_mutex_unlock(&mi2->mi_output_lock);
     }
-    pthread_mutex_unlock(&mi->mi_output_lock);
   }
 
   return w;
@@ -194,17 +209,21 @@ iptv_input_warm_mux ( mpegts_input_t *mi, mpegts_mux_instance_t *mmi )
 
   /* Do we need to stop something? */
   if (!iptv_input_is_free(mi)) {
-    pthread_mutex_lock(&mi->mi_output_lock);
     mpegts_mux_instance_t *m, *s = NULL;
-    int w = 1000000;
-    LIST_FOREACH(m, &mi->mi_mux_active, mmi_active_link) {
-      int t = mpegts_mux_instance_weight(m);
-      if (t < w) {
-        s = m;
-        w = t;
+    mpegts_input_t *mi2;
+    int i, w = 1000000;
+    for (i = 0; i < iptv_input_count; i++) {
+      mi2 = (mpegts_input_t *)iptv_input[i];
+      pthread_mutex_lock(&mi2->mi_output_lock);
+      LIST_FOREACH(m, &mi2->mi_mux_active, mmi_active_link) {
+        int t = mpegts_mux_instance_weight(m);
+        if (t < w) {
+          s = m;
+          w = t;
+        }
       }
+      pthread_mutex_unlock(&mi2->mi_output_lock);
     }
-    pthread_mutex_unlock(&mi->mi_output_lock);
   
     /* Stop */
     if (s)
@@ -242,7 +261,7 @@ iptv_input_start_mux ( mpegts_input_t *mi, mpegts_mux_instance_t *mmi )
   }
 
   /* Start */
-  pthread_mutex_lock(&iptv_lock);
+  pthread_mutex_lock(&im->im_input->ii_lock);
   im->mm_active = mmi; // Note: must set here else mux_started call
                        // will not realise we're ready to accept pid open calls
   ret            = ih->start(im, &url);
@@ -250,7 +269,7 @@ iptv_input_start_mux ( mpegts_input_t *mi, mpegts_mux_instance_t *mmi )
     im->im_handler = ih;
   else
     im->mm_active  = NULL;
-  pthread_mutex_unlock(&iptv_lock);
+  pthread_mutex_unlock(&im->im_input->ii_lock);
 
   urlreset(&url);
   return ret;
@@ -262,7 +281,7 @@ iptv_input_stop_mux ( mpegts_input_t *mi, mpegts_mux_instance_t *mmi )
   iptv_mux_t *im = (iptv_mux_t*)mmi->mmi_mux;
   mpegts_network_link_t *mnl;
 
-  pthread_mutex_lock(&iptv_lock);
+  pthread_mutex_lock(&im->im_input->ii_lock);
 
   /* Stop */
   if (im->im_handler->stop)
@@ -284,25 +303,30 @@ iptv_input_stop_mux ( mpegts_input_t *mi, mpegts_mux_instance_t *mmi )
     in->in_bw_limited = 0;
   }
 
-  pthread_mutex_unlock(&iptv_lock);
+  pthread_mutex_unlock(&im->im_input->ii_lock);
 }
 
 static void
 iptv_input_display_name ( mpegts_input_t *mi, char *buf, size_t len )
 {
-  snprintf(buf, len, "IPTV");
+  iptv_input_t *ii = (iptv_input_t *)mi;
+  if (iptv_input_count > 1)
+    snprintf(buf, len, "IPTV #%d", ii->ii_index + 1);
+  else
+    snprintf(buf, len, "IPTV");
 }
 
 static void *
 iptv_input_thread ( void *aux )
 {
+  iptv_input_t *ii = aux;
   int nfds;
   ssize_t n;
   iptv_mux_t *im;
   tvhpoll_event_t ev;
 
   while ( tvheadend_running ) {
-    nfds = tvhpoll_wait(iptv_poll, &ev, 1, -1);
+    nfds = tvhpoll_wait(ii->ii_poll, &ev, 1, -1);
     if ( nfds < 0 ) {
       if (tvheadend_running) {
         tvhlog(LOG_ERR, "iptv", "poll() error %s, sleeping 1 second",
@@ -315,7 +339,7 @@ iptv_input_thread ( void *aux )
     }
     im = ev.data.ptr;
 
-    pthread_mutex_lock(&iptv_lock);
+    pthread_mutex_lock(&ii->ii_lock);
 
     /* Only when active */
     if (im->mm_active) {
@@ -328,7 +352,7 @@ iptv_input_thread ( void *aux )
       iptv_input_recv_packets(im, n);
     }
 
-    pthread_mutex_unlock(&iptv_lock);
+    pthread_mutex_unlock(&ii->ii_lock);
   }
   return NULL;
 }
@@ -336,29 +360,36 @@ iptv_input_thread ( void *aux )
 void
 iptv_input_recv_packets ( iptv_mux_t *im, ssize_t len )
 {
-  static time_t t1 = 0, t2;
   iptv_network_t *in = (iptv_network_t*)im->mm_network;
   mpegts_mux_instance_t *mmi;
-
-  in->in_bps += len * 8;
-  time(&t2);
-  if (t2 != t1) {
-    if (in->in_max_bandwidth &&
-        in->in_bps > in->in_max_bandwidth * 1024) {
-      if (!in->in_bw_limited) {
-        tvhinfo("iptv", "%s bandwidth limited exceeded",
-                idnode_get_title(&in->mn_id));
-        in->in_bw_limited = 1;
+  int t, bps;
+
+  /* The network might be fed from more input threads, so the bits are
+   * counted per mux and only added to the network once a second */
+  im->mm_iptv_bps += len * 8;
+  t = time(NULL);
+  if (im->mm_iptv_bps_time != t) {
+    im->mm_iptv_bps_time = t;
+    atomic_add(&in->in_bps, im->mm_iptv_bps);
+    im->mm_iptv_bps = 0;
+    if (atomic_get(&in->in_bps_time) != t &&
+        atomic_exchange(&in->in_bps_time, t) != t) {
+      bps = atomic_exchange(&in->in_bps, 0);
+      if (in->in_max_bandwidth &&
+          bps > in->in_max_bandwidth * 1024) {
+        if (!in->in_bw_limited) {
+          tvhinfo("iptv", "%s bandwidth limited exceeded",
+                  idnode_get_title(&in->mn_id));
+          in->in_bw_limited = 1;
+        }
       }
     }
-    in->in_bps = 0;
-    t1 = t2;
   }
 
   /* Pass on */
   mmi = im->mm_active;
   if (mmi)
-    mpegts_input_recv_packets((mpegts_input_t*)iptv_input, mmi,
+    mpegts_input_recv_packets((mpegts_input_t*)im->im_input, mmi,
                               &im->mm_iptv_buffer, NULL, NULL);
 }
 
@@ -379,7 +410,7 @@ iptv_input_mux_started ( iptv_mux_t *im )
     ev.data.ptr = im;
 
     /* Error? */
-    if (tvhpoll_add(iptv_poll, &ev, 1) == -1) {
+    if (tvhpoll_add(im->im_input->ii_poll, &ev, 1) == -1) {
       tvherror("iptv", "%s - failed to add to poll q", buf);
       close(im->mm_iptv_fd);
       im->mm_iptv_fd = -1;
@@ -500,6 +531,7 @@ iptv_network_create0
 {
   iptv_network_t *in = calloc(1, sizeof(*in));
   htsmsg_t *c;
+  int i;
 
   /* Init Network */
   in->in_priority       = 1;
@@ -521,7 +553,9 @@ iptv_network_create0
   }
 
   /* Link */
-  mpegts_input_add_network((mpegts_input_t*)iptv_input, (mpegts_network_t*)in);
+  for (i = 0; i < iptv_input_count; i++)
+    mpegts_input_add_network((mpegts_input_t*)iptv_input[i],
+                             (mpegts_network_t*)in);
 
   /* Load muxes */
   if ((c = hts_settings_load_r(1, "input/iptv/networks/%s/muxes",
@@ -572,46 +606,71 @@ iptv_network_init ( void )
   htsmsg_destroy(c);
 }
 
-void iptv_init ( void )
+static iptv_input_t *
+iptv_input_create ( int idx )
+{
+  iptv_input_t *ii = calloc(1, sizeof(iptv_input_t));
+
+  /* Init Input */
+  mpegts_input_create0((mpegts_input_t*)ii,
+                       &iptv_input_class, NULL, NULL);
+  ii->mi_warm_mux       = iptv_input_warm_mux;
+  ii->mi_start_mux      = iptv_input_start_mux;
+  ii->mi_stop_mux       = iptv_input_stop_mux;
+  ii->mi_is_free        = iptv_input_is_free;
+  ii->mi_get_weight     = iptv_input_get_weight;
+  ii->mi_get_grace      = iptv_input_get_grace;
+  ii->mi_get_priority   = iptv_input_get_priority;
+  ii->mi_display_name   = iptv_input_display_name;
+  ii->mi_enabled        = 1;
+  ii->ii_index          = idx;
+
+  /* Setup TS thread */
+  ii->ii_poll = tvhpoll_create(10);
+  pthread_mutex_init(&ii->ii_lock, NULL);
+  tvhthread_create(&ii->ii_thread, NULL, iptv_input_thread, ii);
+  return ii;
+}
+
+void iptv_init ( int threads )
 {
+  int i;
+
   /* Register handlers */
   iptv_http_init();
   iptv_udp_init();
 
-  iptv_input = calloc(1, sizeof(iptv_input_t));
-
-  /* Init Input */
-  mpegts_input_create0((mpegts_input_t*)iptv_input,
-                       &iptv_input_class, NULL, NULL);
-  iptv_input->mi_warm_mux       = iptv_input_warm_mux;
-  iptv_input->mi_start_mux      = iptv_input_start_mux;
-  iptv_input->mi_stop_mux       = iptv_input_stop_mux;
-  iptv_input->mi_is_free        = iptv_input_is_free;
-  iptv_input->mi_get_weight     = iptv_input_get_weight;
-  iptv_input->mi_get_grace      = iptv_input_get_grace;
-  iptv_input->mi_get_priority   = iptv_input_get_priority;
-  iptv_input->mi_display_name   = iptv_input_display_name;
-  iptv_input->mi_enabled        = 1;
+  /* Inputs */
+  if (threads <= 0)
+    threads = MIN(4, sysconf(_SC_NPROCESSORS_ONLN));
+  iptv_input_count = MAX(1, MIN(threads, IPTV_THREADS_MAX));
+  for (i = 0; i < iptv_input_count; i++)
+    iptv_input[i] = iptv_input_create(i);
+  tvhinfo("iptv", "using %d input thread%s", iptv_input_count,
+          iptv_input_count > 1 ? "s" : "");
 
   /* Init Network */
   iptv_network_init();
-
-  /* Setup TS thread */
-  iptv_poll = tvhpoll_create(10);
-  pthread_mutex_init(&iptv_lock, NULL);
-  tvhthread_create(&iptv_thread, NULL, iptv_input_thread, NULL);
 }
 
 void iptv_done ( void )
 {
-  pthread_kill(iptv_thread, SIGTERM);
-  pthread_join(iptv_thread, NULL);
-  tvhpoll_destroy(iptv_poll);
+  int i;
+
+  for (i = 0; i < iptv_input_count; i++) {
+    pthread_kill(iptv_input[i]->ii_thread, SIGTERM);
+    pthread_join(iptv_input[i]->ii_thread, NULL);
+    tvhpoll_destroy(iptv_input[i]->ii_poll);
+  }
   pthread_mutex_lock(&global_lock);
   mpegts_network_unregister_builder(&iptv_network_class);
   mpegts_network_class_delete(&iptv_network_class, 0);
-  mpegts_input_stop_all((mpegts_input_t*)iptv_input);
-  mpegts_input_delete((mpegts_input_t *)iptv_input, 0);
+  for (i = 0; i < iptv_input_count; i++) {
+    mpegts_input_stop_all((mpegts_input_t*)iptv_input[i]);
+    mpegts_input_delete((mpegts_input_t *)iptv_input[i], 0);
+    iptv_input[i] = NULL;
+  }
+  iptv_input_count = 0;
   pthread_mutex_unlock(&global_lock);
 }
 
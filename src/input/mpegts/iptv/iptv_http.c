@@ -45,14 +45,14 @@ iptv_http_data
 {
   iptv_mux_t *im = hc->hc_aux;
 
-  pthread_mutex_lock(&iptv_lock);
+  pthread_mutex_lock(&im->im_input->ii_lock);
 
   sbuf_append(&im->mm_iptv_buffer, buf, len);
 
   if (len > 0)
     iptv_input_recv_packets(im, len);
 
-  pthread_mutex_unlock(&iptv_lock);
+  pthread_mutex_unlock(&im->im_input->ii_lock);
 
   return 0;
 }
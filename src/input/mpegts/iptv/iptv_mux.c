@@ -196,8 +196,9 @@ iptv_mux_create0 ( iptv_network_t *in, const char *uuid, htsmsg_t *conf )
   im->mm_delete           = iptv_mux_delete;
 
   /* Create Instance */
+  im->im_input = iptv_input_find(im);
   (void)mpegts_mux_instance_create(mpegts_mux_instance, NULL,
-                                   (mpegts_input_t*)iptv_input,
+                                   (mpegts_input_t*)im->im_input,
                                    (mpegts_mux_t*)im);
 
   /* Services */
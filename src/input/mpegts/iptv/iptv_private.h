@@ -24,12 +24,12 @@
 #include "htsbuf.h"
 #include "url.h"
 #include "udp.h"
+#include "tvhpoll.h"
 
 #define IPTV_BUF_SIZE    (300*188)
 #define IPTV_PKTS        32
 #define IPTV_PKT_PAYLOAD 1472
-
-extern pthread_mutex_t iptv_lock;
+#define IPTV_THREADS_MAX 16
 
 typedef struct iptv_input   iptv_input_t;
 typedef struct iptv_network iptv_network_t;
@@ -49,11 +49,24 @@ struct iptv_handler
 
 void iptv_handler_register ( iptv_handler_t *ih, int num );
 
+/*
+ * The muxes are distributed (by the UUID hash) to several inputs, each
+ * input has its own receive thread, poll set and lock plus the mpegts
+ * input processing thread. The stream/bandwidth limits of the networks
+ * are shared by all inputs.
+ */
 struct iptv_input
 {
   mpegts_input_t;
+
+  int              ii_index;
+  tvhpoll_t       *ii_poll;
+  pthread_t        ii_thread;
+  pthread_mutex_t  ii_lock;
 };
 
+iptv_input_t *iptv_input_find ( iptv_mux_t *im );
+
 void iptv_input_mux_started ( iptv_mux_t *im );
 void iptv_input_recv_packets ( iptv_mux_t *im, ssize_t len );
 
@@ -62,6 +75,7 @@ struct iptv_network
   mpegts_network_t;
 
   int in_bps;
+  int in_bps_time;
   int in_bw_limited;
 
   int in_priority;
@@ -92,7 +106,10 @@ struct iptv_mux
   char                 *mm_iptv_svcname;
 
   sbuf_t                mm_iptv_buffer;
+  int                   mm_iptv_bps;
+  int                   mm_iptv_bps_time;
 
+  iptv_input_t         *im_input;
   iptv_handler_t       *im_handler;
 
   void                 *im_data;
@@ -111,7 +128,8 @@ iptv_service_t *iptv_service_create0
   ( iptv_mux_t *im, uint16_t sid, uint16_t pmt_pid,
     const char *uuid, htsmsg_t *conf );
 
-extern iptv_input_t   *iptv_input;
+extern iptv_input_t   *iptv_input[IPTV_THREADS_MAX];
+extern int             iptv_input_count;
 extern iptv_network_t *iptv_network;
 
 void iptv_mux_load_all ( void );
@@ -311,6 +311,25 @@ mps_cmp ( mpegts_pid_sub_t *a, mpegts_pid_sub_t *b )
   return 0;
 }
 
+/*
+ * Cache the combined subscriber type, so that the packet processing
+ * can classify the PID without walking the subscriber tree
+ */
+static void
+mpegts_input_update_pid_type ( mpegts_pid_t *mp )
+{
+  mpegts_pid_sub_t *mps;
+  int type = MPS_NONE;
+
+  if (mp->mp_pid == 0) {
+    mp->mp_type = MPS_STREAM | MPS_TABLE;
+    return;
+  }
+  RB_FOREACH(mps, &mp->mp_subs, mps_link)
+    type |= mps->mps_type;
+  mp->mp_type = type;
+}
+
 mpegts_pid_t *
 mpegts_input_open_pid
   ( mpegts_input_t *mi, mpegts_mux_t *mm, int pid, int type, void *owner )
@@ -327,6 +346,8 @@ mpegts_input_open_pid
       tvhdebug("mpegts", "%s - open PID %04X (%d) [%d/%p]",
                buf, mp->mp_pid, mp->mp_pid, type, owner);
       SKEL_USED(mpegts_pid_sub_skel);
+      mpegts_input_update_pid_type(mp);
+      mm->mm_fanout_dirty = 1;
     }
   }
   return mp;
@@ -345,22 +366,21 @@ mpegts_input_close_pid
   skel.mps_type  = type;
   skel.mps_owner = owner;
   mps = RB_FIND(&mp->mp_subs, &skel, mps_link, mps_cmp);
-  if (pid == mm->mm_last_pid) {
-    mm->mm_last_pid = -1;
-    mm->mm_last_mp = NULL;
-  }
   if (mps) {
     RB_REMOVE(&mp->mp_subs, mps, mps_link);
     free(mps);
+    mpegts_input_update_pid_type(mp);
+    mm->mm_fanout_dirty = 1;
 
     if (!RB_FIRST(&mp->mp_subs)) {
-      RB_REMOVE(&mm->mm_pids, mp, mp_link);
+      mpegts_mux_remove_pid(mm, mp);
       if (mp->mp_fd != -1) {
         mpegts_mux_nice_name(mm, buf, sizeof(buf));
         tvhdebug("mpegts", "%s - close PID %04X (%d) [%d/%p]",
                buf, mp->mp_pid, mp->mp_pid, type, owner);
         close(mp->mp_fd);
       }
+      free(mp->mp_fanout);
       free(mp);
     }
   }
@@ -377,6 +397,7 @@ mpegts_input_open_service ( mpegts_input_t *mi, mpegts_service_t *s, int init )
     LIST_INSERT_HEAD(&mi->mi_transports, ((service_t*)s), s_active_link);
     s->s_dvb_active_input = mi;
   }
+  s->s_dvb_mux->mm_fanout_dirty = 1;
 
   /* Register PIDs */
   pthread_mutex_lock(&s->s_stream_mutex);
@@ -416,6 +437,7 @@ mpegts_input_close_service ( mpegts_input_t *mi, mpegts_service_t *s )
     LIST_REMOVE(((service_t*)s), s_active_link);
     s->s_dvb_active_input = NULL;
   }
+  s->s_dvb_mux->mm_fanout_dirty = 1;
   
   /* Close PID */
   pthread_mutex_lock(&s->s_stream_mutex);
@@ -527,13 +549,61 @@ ts_sync_count ( const uint8_t *tsb, int len )
   return i;
 }
 
+static void
+mpegts_input_ring_push
+  ( mpegts_input_t *mi, mpegts_mux_instance_t *mmi,
+    const uint8_t *tsb, int len )
+{
+  mpegts_packet_t *mp;
+  int head, tail, next, l, size;
+
+  pthread_mutex_lock(&mi->mi_input_lock);
+  while (len > 0) {
+    head = atomic_get(&mi->mi_input_head);
+    tail = mi->mi_input_tail;
+    l    = MIN(len, MPEGTS_RING_CHUNK_PKTS * 188);
+    size = (sizeof(mpegts_packet_t) + l + MPEGTS_RING_ALIGN - 1) &
+           ~(MPEGTS_RING_ALIGN - 1);
+
+    /* Find the space (tail == head means empty, so it must not be reached) */
+    if (tail >= head && size <= MPEGTS_RING_SIZE - tail &&
+        (head > 0 || size < MPEGTS_RING_SIZE - tail)) {
+      mp   = (mpegts_packet_t *)(mi->mi_input_ring + tail);
+      next = (tail + size) % MPEGTS_RING_SIZE;
+    } else if (tail >= head && size < head) {
+      mp = (mpegts_packet_t *)(mi->mi_input_ring + tail);
+      mp->mp_len = 0; /* wrap */
+      mp   = (mpegts_packet_t *)mi->mi_input_ring;
+      next = size;
+    } else if (tail < head && size < head - tail) {
+      mp   = (mpegts_packet_t *)(mi->mi_input_ring + tail);
+      next = tail + size;
+    } else {
+      /* Full (consumer is not keeping up) */
+      mmi->mmi_stats.drop += len / 188;
+      break;
+    }
+
+    mp->mp_mux  = mmi->mmi_mux;
+    mp->mp_len  = l;
+    mp->mp_size = size;
+    memcpy(mp->mp_data, tsb, l);
+    atomic_set(&mi->mi_input_tail, next);
+
+    tsb += l;
+    len -= l;
+  }
+  if (mi->mi_input_wait)
+    pthread_cond_signal(&mi->mi_input_cond);
+  pthread_mutex_unlock(&mi->mi_input_lock);
+}
+
 void
 mpegts_input_recv_packets
   ( mpegts_input_t *mi, mpegts_mux_instance_t *mmi, sbuf_t *sb,
     int64_t *pcr, uint16_t *pcr_pid )
 {
   int i, p = 0, len2, off = 0;
-  mpegts_packet_t *mp;
   uint8_t *tsb = sb->sb_data;
   int     len  = sb->sb_ptr;
 #define MIN_TS_PKT 100
@@ -567,7 +637,7 @@ mpegts_input_recv_packets
     for (i = 0; i < p; i++, tmp += 188) {
       uint16_t pid = ((tmp[1] & 0x1f) << 8) | tmp[2];
       if (*pcr_pid == MPEGTS_PID_NONE || *pcr_pid == pid) {
-        ts_recv_packet1(NULL, tmp, pcr, 0);
+        ts_recv_packet1(NULL, NULL, tmp, pcr, 0);
         if (*pcr != PTS_UNSET) *pcr_pid = pid;
       }
     }
@@ -576,20 +646,11 @@ mpegts_input_recv_packets
   /* Pass */
   if (p >= MIN_TS_SYN) {
     len2 = p * 188;
-    
-    mp = malloc(sizeof(mpegts_packet_t) + len2);
-    mp->mp_mux  = mmi->mmi_mux;
-    mp->mp_len  = len2;
-    memcpy(mp->mp_data, tsb, len2);
+
+    mpegts_input_ring_push(mi, mmi, tsb, len2);
 
     len -= len2;
     off += len2;
-
-    pthread_mutex_lock(&mi->mi_input_lock);
-    if (TAILQ_FIRST(&mi->mi_input_queue) == NULL)
-      pthread_cond_signal(&mi->mi_input_cond);
-    TAILQ_INSERT_TAIL(&mi->mi_input_queue, mp, mp_link);
-    pthread_mutex_unlock(&mi->mi_input_lock);
   }
 
   /* Adjust buffer */
@@ -681,6 +742,57 @@ mpegts_input_table_waiting ( mpegts_input_t *mi, mpegts_mux_t *mm )
   pthread_mutex_unlock(&mm->mm_tables_lock);
 }
 
+/*
+ * Rebuild the per-PID service delivery lists for the mux
+ */
+static void
+mpegts_input_update_fanout ( mpegts_input_t *mi, mpegts_mux_t *mm )
+{
+  mpegts_pid_t *mp;
+  mpegts_pid_fanout_t *mpf;
+  service_t *s;
+  elementary_stream_t *st;
+  int n = 0, table;
+
+  lock_assert(&mi->mi_output_lock);
+
+  mm->mm_fanout_dirty = 0;
+
+  LIST_FOREACH(s, &mi->mi_transports, s_active_link)
+    if (((mpegts_service_t*)s)->s_dvb_mux == mm)
+      n++;
+
+  RB_FOREACH(mp, &mm->mm_pids, mp_link) {
+    free(mp->mp_fanout);
+    mp->mp_fanout       = NULL;
+    mp->mp_fanout_count = 0;
+    if (!n || !(mp->mp_type & MPS_STREAM))
+      continue;
+    table = mp->mp_type & (MPS_TABLE | MPS_FTABLE);
+    mp->mp_fanout = mpf = malloc(n * sizeof(mpegts_pid_fanout_t));
+    LIST_FOREACH(s, &mi->mi_transports, s_active_link) {
+      if (((mpegts_service_t*)s)->s_dvb_mux != mm) continue;
+      pthread_mutex_lock(&s->s_stream_mutex);
+      st = service_stream_find(s, mp->mp_pid);
+      if (st || table ||
+          mp->mp_pid == s->s_pmt_pid || mp->mp_pid == s->s_pcr_pid) {
+        mpf->mpf_service = (mpegts_service_t*)s;
+        mpf->mpf_stream  = st;
+        mpf->mpf_gen     = s->s_components_gen;
+        mpf->mpf_table   = table || mp->mp_pid == s->s_pmt_pid ||
+                           mp->mp_pid == s->s_pcr_pid;
+        mpf++;
+      }
+      pthread_mutex_unlock(&s->s_stream_mutex);
+    }
+    mp->mp_fanout_count = mpf - mp->mp_fanout;
+    if (!mp->mp_fanout_count) {
+      free(mp->mp_fanout);
+      mp->mp_fanout = NULL;
+    }
+  }
+}
+
 static void
 mpegts_input_process
   ( mpegts_input_t *mi, mpegts_packet_t *mpkt )
@@ -689,18 +801,22 @@ mpegts_input_process
   uint8_t cc;
   uint8_t *tsb = mpkt->mp_data;
   int len = mpkt->mp_len;
-  int table, stream, f;
+  int i, table, stream;
   mpegts_pid_t *mp;
-  mpegts_pid_sub_t *mps;
-  service_t *s;
-  int table_wakeup = 0;
+  mpegts_pid_fanout_t *mpf;
+  mpegts_table_feed_t *mtf;
+  uint16_t table_pkts[MPEGTS_RING_CHUNK_PKTS];
+  int table_count = 0;
   uint8_t *end = mpkt->mp_data + len;
   mpegts_mux_t          *mm  = mpkt->mp_mux;
   mpegts_mux_instance_t *mmi = mm->mm_active;
-  mpegts_pid_t *last_mp = NULL;
 
   mi->mi_live = 1;
 
+  /* Services or PID subscriptions changed */
+  if (mm->mm_fanout_dirty)
+    mpegts_input_update_fanout(mi, mm);
+
   /* Process */
   assert((len % 188) == 0);
   while ( tsb < end ) {
@@ -731,39 +847,14 @@ mpegts_input_process
         mp->mp_cc = (cc + 1) & 0xF;
       }
 
-      // Note: there is a minor danger this caching will get things
-      //       wrong for a brief period of time if the registrations on
-      //       the PID change
-      if (mp != last_mp) {
-        if (pid == 0) {
-          stream = MPS_STREAM;
-          table  = MPS_TABLE;
-        } else {
-          stream = table = 0;
-
-          /* Determine PID type */
-          RB_FOREACH(mps, &mp->mp_subs, mps_link) {
-            stream |= mps->mps_type & MPS_STREAM;
-            table  |= mps->mps_type & (MPS_TABLE | MPS_FTABLE);
-            if (table == (MPS_TABLE|MPS_FTABLE) && stream) break;
-          }
-
-          /* Special case streams */
-          LIST_FOREACH(s, &mi->mi_transports, s_active_link) {
-            if (((mpegts_service_t*)s)->s_dvb_mux != mmi->mmi_mux) continue;
-                 if (pid == s->s_pmt_pid) stream = MPS_STREAM;
-            else if (pid == s->s_pcr_pid) stream = MPS_STREAM;
-          }
-        }
-      }
-    
+      /* PID type (cached on subscription changes) */
+      stream = mp->mp_type & MPS_STREAM;
+      table  = mp->mp_type & (MPS_TABLE | MPS_FTABLE);
+
       /* Stream data */
       if (stream) {
-        LIST_FOREACH(s, &mi->mi_transports, s_active_link) {
-          if (((mpegts_service_t*)s)->s_dvb_mux != mmi->mmi_mux) continue;
-          f = table || (pid == s->s_pmt_pid) || (pid == s->s_pcr_pid);
-          ts_recv_packet1((mpegts_service_t*)s, tsb, NULL, f);
-        }
+        for (i = 0, mpf = mp->mp_fanout; i < mp->mp_fanout_count; i++, mpf++)
+          ts_recv_packet1(mpf->mpf_service, mpf, tsb, NULL, mpf->mpf_table);
       }
 
       /* Table data */
@@ -771,16 +862,8 @@ mpegts_input_process
         if (!(tsb[1] & 0x80)) {
           if (table & MPS_FTABLE)
             mpegts_input_table_dispatch(mm, tsb);
-          if (table & MPS_TABLE) {
-            // TODO: might be able to optimise this a bit by having slightly
-            //       larger buffering and trying to aggregate data (if we get
-            //       same PID multiple times in the loop)
-            mpegts_table_feed_t *mtf = malloc(sizeof(mpegts_table_feed_t));
-            memcpy(mtf->mtf_tsb, tsb, 188);
-            mtf->mtf_mux   = mm;
-            TAILQ_INSERT_TAIL(&mi->mi_table_queue, mtf, mtf_link);
-            table_wakeup = 1;
-          }
+          if (table & MPS_TABLE)
+            table_pkts[table_count++] = (tsb - mpkt->mp_data) / 188;
         } else {
           //tvhdebug("tsdemux", "%s - SI packet had errors", name);
         }
@@ -803,9 +886,16 @@ done:
     pktbuf_ref_dec(pb);
   }
 
-  /* Wake table */
-  if (table_wakeup)
+  /* Queue table batch */
+  if (table_count) {
+    mtf = malloc(sizeof(mpegts_table_feed_t) + table_count * 188);
+    mtf->mtf_mux = mm;
+    mtf->mtf_len = table_count;
+    for (i = 0; i < table_count; i++)
+      memcpy(mtf->mtf_tsb + i * 188, mpkt->mp_data + table_pkts[i] * 188, 188);
+    TAILQ_INSERT_TAIL(&mi->mi_table_queue, mtf, mtf_link);
     pthread_cond_signal(&mi->mi_table_cond);
+  }
 
   /* Bandwidth monitoring */
   atomic_add(&mmi->mmi_stats.bps, tsb - mpkt->mp_data);
@@ -816,37 +906,41 @@ mpegts_input_thread ( void * p )
 {
   mpegts_packet_t *mp;
   mpegts_input_t  *mi = p;
+  int head;
 
-  pthread_mutex_lock(&mi->mi_input_lock);
   while (mi->mi_running) {
+    head = mi->mi_input_head;
 
     /* Wait for a packet */
-    if (!(mp = TAILQ_FIRST(&mi->mi_input_queue))) {
-      pthread_cond_wait(&mi->mi_input_cond, &mi->mi_input_lock);
+    if (head == atomic_get(&mi->mi_input_tail)) {
+      pthread_mutex_lock(&mi->mi_input_lock);
+      if (mi->mi_running && head == mi->mi_input_tail) {
+        mi->mi_input_wait = 1;
+        pthread_cond_wait(&mi->mi_input_cond, &mi->mi_input_lock);
+        mi->mi_input_wait = 0;
+      }
+      pthread_mutex_unlock(&mi->mi_input_lock);
+      continue;
+    }
+    mp = (mpegts_packet_t *)(mi->mi_input_ring + head);
+
+    /* Wrap */
+    if (mp->mp_len == 0) {
+      atomic_set(&mi->mi_input_head, 0);
       continue;
     }
-    TAILQ_REMOVE(&mi->mi_input_queue, mp, mp_link);
-    pthread_mutex_unlock(&mi->mi_input_lock);
-      
-    /* Process */
+
+    /* Process (in place) */
     pthread_mutex_lock(&mi->mi_output_lock);
     if (mp->mp_mux && mp->mp_mux->mm_active) {
       mpegts_input_table_waiting(mi, mp->mp_mux);
       mpegts_input_process(mi, mp);
     }
-    pthread_mutex_unlock(&mi->mi_output_lock);
-
-    /* Cleanup */
-    free(mp);
-    pthread_mutex_lock(&mi->mi_input_lock);
-  }
 
-  /* Flush */
-  while ((mp = TAILQ_FIRST(&mi->mi_input_queue))) {
-    TAILQ_REMOVE(&mi->mi_input_queue, mp, mp_link);
-    free(mp);
+    /* Release chunk */
+    atomic_set(&mi->mi_input_head, (head + mp->mp_size) % MPEGTS_RING_SIZE);
+    pthread_mutex_unlock(&mi->mi_output_lock);
   }
-  pthread_mutex_unlock(&mi->mi_input_lock);
 
   return NULL;
 }
@@ -857,6 +951,7 @@ mpegts_input_table_thread ( void *aux )
   mpegts_table_feed_t   *mtf;
   mpegts_input_t        *mi = aux;
   int i;
+  int64_t t = 0;
 
   pthread_mutex_lock(&mi->mi_output_lock);
   while (mi->mi_running) {
@@ -869,27 +964,38 @@ mpegts_input_table_thread ( void *aux )
     TAILQ_REMOVE(&mi->mi_table_queue, mtf, mtf_link);
     pthread_mutex_unlock(&mi->mi_output_lock);
     
-    /* Process */
+    /* Process (whole batch under one lock) */
     if (mtf->mtf_mux) {
       pthread_mutex_lock(&global_lock);
+      t = getmonoclock();
       if (mi->mi_destroyed_muxes) {
         for (i = 0; i < mi->mi_destroyed_muxes_count; i++)
           if (mtf->mtf_mux == mi->mi_destroyed_muxes[i])
             goto clean;
-        mpegts_input_table_dispatch(mtf->mtf_mux, mtf->mtf_tsb);
+        for (i = 0; i < mtf->mtf_len; i++)
+          mpegts_input_table_dispatch(mtf->mtf_mux, mtf->mtf_tsb + i * 188);
 clean:
         free(mi->mi_destroyed_muxes);
         mi->mi_destroyed_muxes = NULL;
         mi->mi_destroyed_muxes_count = 0;
       } else {
-        mpegts_input_table_dispatch(mtf->mtf_mux, mtf->mtf_tsb);
+        for (i = 0; i < mtf->mtf_len; i++)
+          mpegts_input_table_dispatch(mtf->mtf_mux, mtf->mtf_tsb + i * 188);
       }
+      t = getmonoclock() - t;
       pthread_mutex_unlock(&global_lock);
     }
 
+    /* Stats */
+    pthread_mutex_lock(&mi->mi_output_lock);
+    if (mtf->mtf_mux) {
+      mi->mi_table_batches++;
+      mi->mi_table_pkts      += mtf->mtf_len;
+      mi->mi_table_lock_time += t;
+    }
+
     /* Cleanup */
     free(mtf);
-    pthread_mutex_lock(&mi->mi_output_lock);
   }
 
   /* Flush */
@@ -908,6 +1014,7 @@ mpegts_input_flush_mux
 {
   mpegts_table_feed_t *mtf;
   mpegts_packet_t *mp;
+  int i, tail;
 
   lock_assert(&global_lock);
 
@@ -915,16 +1022,22 @@ mpegts_input_flush_mux
   //       remove things from the Q, we simply invalidate by clearing
   //       the mux pointer and allow the threads to deal with the deletion
 
-  /* Flush input Q */
-  pthread_mutex_lock(&mi->mi_input_lock);
-  TAILQ_FOREACH(mp, &mi->mi_input_queue, mp_link) {
+  pthread_mutex_lock(&mi->mi_output_lock);
+
+  /* Flush input ring (chunk at head is not in use while we hold the lock) */
+  tail = atomic_get(&mi->mi_input_tail);
+  for (i = mi->mi_input_head; i != tail; ) {
+    mp = (mpegts_packet_t *)(mi->mi_input_ring + i);
+    if (mp->mp_len == 0) {
+      i = 0;
+      continue;
+    }
     if (mp->mp_mux == mm)
       mp->mp_mux = NULL;
+    i = (i + mp->mp_size) % MPEGTS_RING_SIZE;
   }
-  pthread_mutex_unlock(&mi->mi_input_lock);
 
   /* Flush table Q */
-  pthread_mutex_lock(&mi->mi_output_lock);
   TAILQ_FOREACH(mtf, &mi->mi_table_queue, mtf_link) {
     if (mtf->mtf_mux == mm)
       mtf->mtf_mux = NULL;
@@ -974,6 +1087,14 @@ mpegts_input_stream_status
   st->max_weight  = w;
   st->stats       = mmi->mmi_stats;
   st->stats.bps   = atomic_exchange(&mmi->mmi_stats.bps, 0) * 8;
+  st->stats.qfill = ((atomic_get(&mi->mi_input_tail) -
+                      atomic_get(&mi->mi_input_head) +
+                      MPEGTS_RING_SIZE) % MPEGTS_RING_SIZE) /
+                    (MPEGTS_RING_SIZE / 100);
+  if (mi->mi_table_batches) {
+    st->stats.tbatch = mi->mi_table_pkts / mi->mi_table_batches;
+    st->stats.tlock  = mi->mi_table_lock_time / mi->mi_table_batches;
+  }
 }
 
 static void
@@ -1049,6 +1170,9 @@ mpegts_input_status_timer ( void *p )
     subs += st.subs_count;
     tvh_input_stream_destroy(&st);
   }
+  mi->mi_table_batches   = 0;
+  mi->mi_table_pkts      = 0;
+  mi->mi_table_lock_time = 0;
   pthread_mutex_unlock(&mi->mi_output_lock);
   gtimer_arm(&mi->mi_status_timer, mpegts_input_status_timer, mi, 1);
   mpegts_input_dbus_notify(mi, subs);
@@ -1099,7 +1223,7 @@ mpegts_input_create0
   /* Init input/output structures */
   pthread_mutex_init(&mi->mi_input_lock, NULL);
   pthread_cond_init(&mi->mi_input_cond, NULL);
-  TAILQ_INIT(&mi->mi_input_queue);
+  mi->mi_input_ring = malloc(MPEGTS_RING_SIZE);
 
   pthread_mutex_init(&mi->mi_output_lock, NULL);
   pthread_cond_init(&mi->mi_table_cond, NULL);
@@ -1158,6 +1282,7 @@ mpegts_input_delete ( mpegts_input_t *mi, int delconf )
 
   pthread_mutex_destroy(&mi->mi_output_lock);
   pthread_cond_destroy(&mi->mi_table_cond);
+  free(mi->mi_input_ring);
   free(mi->mi_name);
   free(mi->mi_destroyed_muxes);
   free(mi);
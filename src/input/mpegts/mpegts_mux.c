@@ -686,20 +686,21 @@ mpegts_mux_stop ( mpegts_mux_t *mm, int force )
     mpegts_input_flush_mux(mi, mm);
 
   /* Ensure PIDs are cleared */
-  mm->mm_last_pid = -1;
-  mm->mm_last_mp = NULL;
   while ((mp = RB_FIRST(&mm->mm_pids))) {
     while ((mps = RB_FIRST(&mp->mp_subs))) {
       RB_REMOVE(&mp->mp_subs, mps, mps_link);
       free(mps);
     }
-    RB_REMOVE(&mm->mm_pids, mp, mp_link);
+    mpegts_mux_remove_pid(mm, mp);
     if (mp->mp_fd != -1) {
       tvhdebug("mpegts", "%s - close PID %04X (%d)", buf, mp->mp_pid, mp->mp_pid);
       close(mp->mp_fd);
     }
+    free(mp->mp_fanout);
     free(mp);
   }
+  free(mm->mm_pid_table);
+  mm->mm_pid_table = NULL;
 
   /* Scanning */
   mpegts_network_scan_mux_cancel(mm, 1);
@@ -936,8 +937,6 @@ mpegts_mux_create0
   TAILQ_INIT(&mm->mm_descrambler_emms);
   pthread_mutex_init(&mm->mm_descrambler_lock, NULL);
 
-  mm->mm_last_pid            = -1;
-
   /* Configuration */
   if (conf)
     idnode_load(&mm->mm_id, conf);
@@ -1096,30 +1095,37 @@ mpegts_mux_find_pid_ ( mpegts_mux_t *mm, int pid, int create )
 {
   mpegts_pid_t *mp;
   
-  if (pid > 0x2000) return NULL;
-
-  if (!create) {
-    mpegts_pid_t skel;
-    skel.mp_pid = pid;
-    mp = RB_FIND(&mm->mm_pids, &skel, mp_link, mp_cmp);
-  } else {
-    SKEL_ALLOC(mpegts_pid_skel);
-    mpegts_pid_skel->mp_pid = pid;
-    mp = RB_INSERT_SORTED(&mm->mm_pids, mpegts_pid_skel, mp_link, mp_cmp);
-    if (!mp) {
-      mp = mpegts_pid_skel;
-      SKEL_USED(mpegts_pid_skel);
-      mp->mp_fd = -1;
-      mp->mp_cc = -1;
-    }
-  }
-  if (mp) {
-    mm->mm_last_pid = pid;
-    mm->mm_last_mp = mp;
+  if (pid < 0 || pid > MPEGTS_FULLMUX_PID) return NULL;
+
+  if (!create)
+    return mm->mm_pid_table ? mm->mm_pid_table[pid] : NULL;
+
+  SKEL_ALLOC(mpegts_pid_skel);
+  mpegts_pid_skel->mp_pid = pid;
+  mp = RB_INSERT_SORTED(&mm->mm_pids, mpegts_pid_skel, mp_link, mp_cmp);
+  if (!mp) {
+    mp = mpegts_pid_skel;
+    SKEL_USED(mpegts_pid_skel);
+    mp->mp_fd   = -1;
+    mp->mp_cc   = -1;
+    mp->mp_type = MPS_NONE;
+    mp->mp_fanout_count = 0;
+    mp->mp_fanout = NULL;
+    if (!mm->mm_pid_table)
+      mm->mm_pid_table = calloc(MPEGTS_FULLMUX_PID + 1, sizeof(mpegts_pid_t *));
+    mm->mm_pid_table[pid] = mp;
   }
   return mp;
 }
 
+void
+mpegts_mux_remove_pid ( mpegts_mux_t *mm, mpegts_pid_t *mp )
+{
+  RB_REMOVE(&mm->mm_pids, mp, mp_link);
+  if (mm->mm_pid_table)
+    mm->mm_pid_table[mp->mp_pid] = NULL;
+}
+
 /******************************************************************************
  * Editor Configuration
  *
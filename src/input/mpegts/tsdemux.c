@@ -150,10 +150,13 @@ ts_process_pcr(mpegts_service_t *t, elementary_stream_t *st, int64_t pcr)
 
 /**
  * Process service stream packets, extract PCR and optionally descramble
+ *
+ * mpf (optional) caches the elementary stream for this service/PID pair
  */
 int
 ts_recv_packet1
-  (mpegts_service_t *t, const uint8_t *tsb, int64_t *pcrp, int table)
+  (mpegts_service_t *t, mpegts_pid_fanout_t *mpf,
+   const uint8_t *tsb, int64_t *pcrp, int table)
 {
   elementary_stream_t *st;
   int pid, r;
@@ -199,7 +202,15 @@ ts_recv_packet1
 
   pid = (tsb[1] & 0x1f) << 8 | tsb[2];
 
-  st = service_stream_find((service_t*)t, pid);
+  if (mpf && mpf->mpf_gen == t->s_components_gen) {
+    st = mpf->mpf_stream;
+  } else {
+    st = service_stream_find((service_t*)t, pid);
+    if (mpf) {
+      mpf->mpf_stream = st;
+      mpf->mpf_gen    = t->s_components_gen;
+    }
+  }
 
   /* Extract PCR */
   if (pcr != PTS_UNSET)
@@ -22,7 +22,8 @@
 int ts_resync ( const uint8_t *tsb, int *len, int *idx );
 
 int ts_recv_packet1
-  (struct mpegts_service *t, const uint8_t *tsb, int64_t *pcrp, int table);
+  (struct mpegts_service *t, struct mpegts_pid_fanout *mpf,
+   const uint8_t *tsb, int64_t *pcrp, int table);
 
 void ts_recv_packet2(struct mpegts_service *t, const uint8_t *tsb);
 
@@ -49,6 +49,7 @@
 #include "service_mapper.h"
 #include "descrambler.h"
 #include "dvr/dvr.h"
+#include "muxer/muxer_io.h"
 #include "htsp_server.h"
 #include "avahi.h"
 #include "bonjour.h"
@@ -479,6 +480,8 @@ main(int argc, char **argv)
               opt_threadid     = 0,
               opt_ipv6         = 0,
               opt_tsfile_tuner = 0,
+              opt_iptv_threads = 0,
+              opt_rec_io_threads = 0,
               opt_dump         = 0,
               opt_xspf         = 0,
               opt_dbus         = 0,
@@ -511,6 +514,8 @@ main(int argc, char **argv)
     { 'u', "user",      "Run as user",             OPT_STR,  &opt_user    },
     { 'g', "group",     "Run as group",            OPT_STR,  &opt_group   },
     { 'p', "pid",       "Alternate pid path",      OPT_STR,  &opt_pidpath },
+    {   0, "rec_io_threads", "Recording writer threads per filesystem (0 = 2)",
+      OPT_INT, &opt_rec_io_threads },
     { 'C', "firstrun",  "If no user account exists then create one with\n"
 	                      "no username and no password. Use with care as\n"
 	                      "it will allow world-wide administrative access\n"
@@ -530,6 +535,10 @@ main(int argc, char **argv)
 #if ENABLE_SATIP_CLIENT
     {   0, "satip_xml", "URL with the SAT>IP server XML location",
       OPT_STR_LIST, &opt_satip_xml },
+#endif
+#if ENABLE_IPTV
+    {   0, "iptv_threads", "Number of IPTV input threads (0 = auto)",
+      OPT_INT, &opt_iptv_threads },
 #endif
     {   0, NULL,         "Server Connectivity",    OPT_BOOL, NULL         },
     { '6', "ipv6",       "Listen on IPv6",         OPT_BOOL, &opt_ipv6    },
@@ -824,7 +833,8 @@ main(int argc, char **argv)
   service_init();
 
 #if ENABLE_MPEGTS
-  mpegts_init(adapter_mask, &opt_satip_xml, &opt_tsfile, opt_tsfile_tuner);
+  mpegts_init(adapter_mask, &opt_satip_xml, &opt_tsfile, opt_tsfile_tuner,
+              opt_iptv_threads);
 #endif
 
   channel_init();
@@ -853,6 +863,7 @@ main(int argc, char **argv)
   epggrab_init();
   epg_init();
 
+  muxer_io_init(opt_rec_io_threads);
   dvr_init();
 
   dbus_server_start();
@@ -926,6 +937,7 @@ main(int argc, char **argv)
   tvhftrace("main", service_done);
   tvhftrace("main", channel_done);
   tvhftrace("main", dvr_done);
+  tvhftrace("main", muxer_io_done);
   tvhftrace("main", subscription_done);
   tvhftrace("main", access_done);
   tvhftrace("main", epg_done);
@@ -47,6 +47,8 @@ typedef struct muxer_config {
   int                  m_rewrite_pat;
   int                  m_rewrite_pmt;
   int                  m_cache;
+  int                  m_io_backlog;  // max. write backlog (MB) for files
+  int                  m_io_drop;     // drop packets when the backlog is full
 
 /* 
  * directory_permissions should really be in dvr.h as it's not really needed for the muxer
@@ -62,6 +64,7 @@ struct streaming_start;
 struct th_pkt;
 struct epg_broadcast;
 struct service;
+struct streaming_queue;
 
 typedef struct muxer {
   int         (*m_open_stream)(struct muxer *, int fd);                 // Open for socket streaming
@@ -85,6 +88,7 @@ typedef struct muxer {
   int                    m_errors;     // Number of errors
   muxer_container_type_t m_container;  // The type of the container
   muxer_config_t         m_config;     // general configuration
+  struct streaming_queue *m_input;     // input queue (for the storage backpressure)
 } muxer_t;
 
 
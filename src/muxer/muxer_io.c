@@ -0,0 +1,519 @@
+/*
+ *  tvheadend, write-behind file output for the muxers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "tvheadend.h"
+#include "queue.h"
+#include "htsmsg.h"
+#include "muxer.h"
+#include "muxer_io.h"
+
+/* One target filesystem, its writer threads and statistics */
+typedef struct muxer_io_fs {
+  LIST_ENTRY(muxer_io_fs) fs_link;
+  TAILQ_HEAD(, muxer_io)  fs_queue;  /* files waiting for a writer */
+  pthread_cond_t          fs_cond;
+  pthread_t              *fs_tids;
+  dev_t     fs_dev;
+  char     *fs_path;   /* directory of the first file written to it */
+  uint64_t  fs_writes;
+  uint64_t  fs_bytes;
+  uint64_t  fs_drops;
+  int64_t   fs_lat_max;
+  uint64_t  fs_hist[MUXER_IO_HIST];
+} muxer_io_fs_t;
+
+typedef struct muxer_io_buf {
+  TAILQ_ENTRY(muxer_io_buf) mib_link;
+  off_t     mib_off;   /* file offset of the first byte */
+  size_t    mib_len;
+  size_t    mib_size;
+  uint8_t  *mib_data;
+} muxer_io_buf_t;
+
+struct muxer_io {
+  TAILQ_ENTRY(muxer_io)             mio_link;   /* on fs_queue */
+  TAILQ_HEAD(, muxer_io_buf)        mio_bufs;   /* waiting for the I/O threads */
+  muxer_t        *mio_muxer;
+  muxer_io_fs_t  *mio_fs;
+  int             mio_fd;
+  char           *mio_filename;
+  int             mio_queued;
+  int             mio_busy;
+  int             mio_error;   /* first write error (errno), sticky */
+  size_t          mio_backlog; /* bytes handed over, but not written yet */
+  size_t          mio_limit;   /* backlog limit, zero = unlimited */
+  int             mio_drop;    /* drop packets rather than wait */
+
+  /* Owned by the muxer thread */
+  muxer_io_buf_t *mio_cur;
+  time_t          mio_cur_time;
+  uint64_t        mio_dropped;
+  tvhlog_limit_t  mio_drop_log;
+};
+
+static pthread_mutex_t           muxer_io_mutex;
+static pthread_cond_t            muxer_io_done_cond;
+static LIST_HEAD(, muxer_io_fs)  muxer_io_fss;
+static int                       muxer_io_running;
+static int                       muxer_io_threads;
+
+/* **************************************************************************
+ * I/O thread
+ * *************************************************************************/
+
+static int
+muxer_io_pwrite(int fd, const uint8_t *data, size_t len, off_t off)
+{
+  ssize_t r;
+
+  while (len) {
+    r = pwrite(fd, data, len, off);
+    if (r < 0) {
+      if (ERRNO_AGAIN(errno))
+        continue;
+      return errno;
+    }
+    data += r;
+    len  -= r;
+    off  += r;
+  }
+  return 0;
+}
+
+static void
+muxer_io_buf_free(muxer_io_buf_t *b)
+{
+  free(b->mib_data);
+  free(b);
+}
+
+static void
+muxer_io_fs_update(muxer_io_fs_t *fs, size_t len, int64_t lat)
+{
+  int64_t ms = lat / 1000;
+  int i;
+
+  for (i = 0; i < MUXER_IO_HIST - 1 && ms >= (1 << (2 * i)); i++);
+  fs->fs_hist[i]++;
+  fs->fs_writes++;
+  fs->fs_bytes += len;
+  if (lat > fs->fs_lat_max)
+    fs->fs_lat_max = lat;
+}
+
+/*
+ * Each filesystem has its own writer threads, so a stalled filesystem
+ * parks only its own threads. Only one thread works on a file at any
+ * time (mio_busy), the file is put back to the end of the queue after
+ * each buffer, so the files on one filesystem are served fairly.
+ */
+static void *
+muxer_io_thread(void *aux)
+{
+  muxer_io_fs_t *fs = aux;
+  muxer_io_t *mio;
+  muxer_io_buf_t *b;
+  int64_t lat;
+  size_t len;
+  int e;
+
+  pthread_mutex_lock(&muxer_io_mutex);
+  while (muxer_io_running || TAILQ_FIRST(&fs->fs_queue)) {
+    mio = TAILQ_FIRST(&fs->fs_queue);
+    if (mio == NULL) {
+      pthread_cond_wait(&fs->fs_cond, &muxer_io_mutex);
+      continue;
+    }
+
+    b = TAILQ_FIRST(&mio->mio_bufs);
+    TAILQ_REMOVE(&mio->mio_bufs, b, mib_link);
+    TAILQ_REMOVE(&fs->fs_queue, mio, mio_link);
+    mio->mio_queued = 0;
+    mio->mio_busy = 1;
+    e = mio->mio_error;
+    pthread_mutex_unlock(&muxer_io_mutex);
+
+    lat = 0;
+    if (!e) {
+      lat = getmonoclock();
+      e = muxer_io_pwrite(mio->mio_fd, b->mib_data, b->mib_len, b->mib_off);
+      if (e)
+        tvhlog(LOG_ERR, "muxer", "%s: Write failed -- %s",
+               mio->mio_filename, strerror(e));
+      else
+        muxer_cache_update(mio->mio_muxer, mio->mio_fd, b->mib_off, b->mib_len);
+      lat = getmonoclock() - lat;
+    }
+    len = b->mib_len;
+    muxer_io_buf_free(b);
+
+    pthread_mutex_lock(&muxer_io_mutex);
+    if (e && !mio->mio_error)
+      mio->mio_error = e;
+    else if (!e)
+      muxer_io_fs_update(fs, len, lat);
+    mio->mio_backlog -= len;
+    mio->mio_busy = 0;
+    if (TAILQ_FIRST(&mio->mio_bufs)) {
+      mio->mio_queued = 1;
+      TAILQ_INSERT_TAIL(&fs->fs_queue, mio, mio_link);
+      pthread_cond_signal(&fs->fs_cond);
+    }
+    pthread_cond_broadcast(&muxer_io_done_cond);
+  }
+  pthread_mutex_unlock(&muxer_io_mutex);
+  return NULL;
+}
+
+/* **************************************************************************
+ * Muxer side
+ * *************************************************************************/
+
+/*
+ * Hand the current buffer over to the I/O threads
+ */
+static int
+muxer_io_submit(muxer_io_t *mio)
+{
+  muxer_io_buf_t *b = mio->mio_cur;
+  int e;
+
+  mio->mio_cur = NULL;
+  pthread_mutex_lock(&muxer_io_mutex);
+  e = mio->mio_error;
+  if (b) {
+    if (e) {
+      muxer_io_buf_free(b);
+    } else {
+      TAILQ_INSERT_TAIL(&mio->mio_bufs, b, mib_link);
+      mio->mio_backlog += b->mib_len;
+      if (!mio->mio_queued && !mio->mio_busy) {
+        mio->mio_queued = 1;
+        TAILQ_INSERT_TAIL(&mio->mio_fs->fs_queue, mio, mio_link);
+        pthread_cond_signal(&mio->mio_fs->fs_cond);
+      }
+    }
+  }
+  pthread_mutex_unlock(&muxer_io_mutex);
+  return e;
+}
+
+static muxer_io_buf_t *
+muxer_io_buf_alloc(muxer_io_t *mio, off_t off)
+{
+  muxer_io_buf_t *b = malloc(sizeof(*b));
+  void *p;
+
+  if (posix_memalign(&p, MUXER_IO_ALIGN, MUXER_IO_BUFSIZE)) {
+    free(b);
+    return NULL;
+  }
+  b->mib_data = p;
+  b->mib_off  = off;
+  b->mib_len  = 0;
+  b->mib_size = MUXER_IO_BUFSIZE;
+  mio->mio_cur = b;
+  mio->mio_cur_time = dispatch_clock;
+  return b;
+}
+
+/*
+ * Append data for the file position off. A write which does not
+ * continue the current buffer (a header rewrite) starts a new one.
+ */
+static int
+muxer_io_append(muxer_io_t *mio, const uint8_t *data, size_t len, off_t off)
+{
+  muxer_io_buf_t *b;
+  size_t l;
+  int e;
+
+  while (len) {
+    b = mio->mio_cur;
+    if (b && (b->mib_off + b->mib_len != off || b->mib_len == b->mib_size)) {
+      if ((e = muxer_io_submit(mio)) != 0)
+        return e;
+      b = NULL;
+    }
+    if (b == NULL && (b = muxer_io_buf_alloc(mio, off)) == NULL)
+      return ENOMEM;
+    l = MIN(len, b->mib_size - b->mib_len);
+    memcpy(b->mib_data + b->mib_len, data, l);
+    b->mib_len += l;
+    data += l;
+    len  -= l;
+    off  += l;
+  }
+  return 0;
+}
+
+static int
+muxer_io_check(muxer_io_t *mio)
+{
+  muxer_io_buf_t *b = mio->mio_cur;
+
+  if (b && (b->mib_len == b->mib_size ||
+            dispatch_clock - mio->mio_cur_time >= MUXER_IO_PERIOD))
+    return muxer_io_submit(mio);
+  return 0;
+}
+
+/*
+ * Queue len bytes to be written at the file offset off
+ */
+int
+muxer_io_write(muxer_io_t *mio, const void *data, size_t len, off_t off)
+{
+  int e;
+
+  if ((e = muxer_io_append(mio, data, len, off)) != 0)
+    return e;
+  return muxer_io_check(mio);
+}
+
+int
+muxer_io_writev(muxer_io_t *mio, const struct iovec *iov, int iovcnt, off_t off)
+{
+  int e;
+
+  for ( ; iovcnt > 0; iov++, iovcnt--) {
+    if ((e = muxer_io_append(mio, iov->iov_base, iov->iov_len, off)) != 0)
+      return e;
+    off += iov->iov_len;
+  }
+  return muxer_io_check(mio);
+}
+
+/*
+ * Size of the muxer input queue (the packets waiting for us)
+ */
+static size_t
+muxer_io_input_size(muxer_io_t *mio)
+{
+  streaming_queue_t *sq = mio->mio_muxer->m_input;
+  size_t size;
+
+  if (sq == NULL)
+    return 0;
+  pthread_mutex_lock(&sq->sq_mutex);
+  size = sq->sq_size;
+  pthread_mutex_unlock(&sq->sq_mutex);
+  return size;
+}
+
+/*
+ * Check the write backlog before a new packet is muxed
+ *
+ * When the storage cannot keep up, either wait for the I/O threads
+ * or tell the caller to drop the packet (returns zero). Waiting is
+ * given up when the input queue fills up to the backlog limit, too,
+ * so a stalled storage cannot eat all memory.
+ */
+int
+muxer_io_ready(muxer_io_t *mio)
+{
+  struct timespec ts;
+  struct timeval tv;
+  int r = 1;
+
+  if (!mio->mio_limit)
+    return 1;
+
+  pthread_mutex_lock(&muxer_io_mutex);
+  while (mio->mio_backlog >= mio->mio_limit && !mio->mio_error) {
+    if (mio->mio_drop || muxer_io_input_size(mio) >= mio->mio_limit) {
+      mio->mio_fs->fs_drops++;
+      r = 0;
+      break;
+    }
+    gettimeofday(&tv, NULL);
+    ts.tv_sec  = tv.tv_sec + (tv.tv_usec >= 900000);
+    ts.tv_nsec = ((tv.tv_usec + 100000) % 1000000) * 1000;
+    pthread_cond_timedwait(&muxer_io_done_cond, &muxer_io_mutex, &ts);
+  }
+  pthread_mutex_unlock(&muxer_io_mutex);
+
+  if (!r) {
+    mio->mio_dropped++;
+    if (tvhlog_limit(&mio->mio_drop_log, 10))
+      tvhlog(LOG_WARNING, "muxer", "%s: Storage too slow, %"PRIu64" packets dropped",
+             mio->mio_filename, mio->mio_dropped);
+  }
+  return r;
+}
+
+static muxer_io_fs_t *
+muxer_io_fs_find(int fd, const char *filename)
+{
+  muxer_io_fs_t *fs;
+  struct stat st;
+  char *s;
+  int i;
+
+  if (fstat(fd, &st))
+    st.st_dev = 0;
+  LIST_FOREACH(fs, &muxer_io_fss, fs_link)
+    if (fs->fs_dev == st.st_dev)
+      return fs;
+  fs = calloc(1, sizeof(*fs));
+  fs->fs_dev  = st.st_dev;
+  s = strdup(filename);
+  fs->fs_path = strdup(dirname(s));
+  free(s);
+  TAILQ_INIT(&fs->fs_queue);
+  pthread_cond_init(&fs->fs_cond, NULL);
+  fs->fs_tids = calloc(muxer_io_threads, sizeof(pthread_t));
+  for (i = 0; i < muxer_io_threads; i++)
+    tvhthread_create(&fs->fs_tids[i], NULL, muxer_io_thread, fs);
+  LIST_INSERT_HEAD(&muxer_io_fss, fs, fs_link);
+  tvhdebug("muxer", "%s: %d writer thread%s started", fs->fs_path,
+           muxer_io_threads, muxer_io_threads > 1 ? "s" : "");
+  return fs;
+}
+
+/*
+ * Take over the file descriptor fd (opened for writing)
+ */
+muxer_io_t *
+muxer_io_create(muxer_t *m, int fd, const char *filename)
+{
+  muxer_io_t *mio = calloc(1, sizeof(*mio));
+  size_t limit = (size_t)m->m_config.m_io_backlog * 1024 * 1024;
+
+  TAILQ_INIT(&mio->mio_bufs);
+  mio->mio_muxer    = m;
+  mio->mio_fd       = fd;
+  mio->mio_filename = strdup(filename);
+  mio->mio_limit    = limit ? MAX(limit, 2 * MUXER_IO_BUFSIZE) : 0;
+  mio->mio_drop     = m->m_config.m_io_drop;
+  pthread_mutex_lock(&muxer_io_mutex);
+  mio->mio_fs       = muxer_io_fs_find(fd, filename);
+  pthread_mutex_unlock(&muxer_io_mutex);
+  return mio;
+}
+
+/*
+ * Flush everything, wait for the I/O thread and close the file
+ *
+ * Returns the first write or close error (errno) or zero.
+ */
+int
+muxer_io_close(muxer_io_t *mio)
+{
+  int e;
+
+  muxer_io_submit(mio);
+
+  pthread_mutex_lock(&muxer_io_mutex);
+  while (mio->mio_queued || mio->mio_busy)
+    pthread_cond_wait(&muxer_io_done_cond, &muxer_io_mutex);
+  e = mio->mio_error;
+  pthread_mutex_unlock(&muxer_io_mutex);
+
+  if (close(mio->mio_fd) && !e)
+    e = errno;
+
+  if (mio->mio_dropped)
+    tvhlog(LOG_WARNING, "muxer", "%s: Storage too slow, %"PRIu64" packets dropped in total",
+           mio->mio_filename, mio->mio_dropped);
+
+  free(mio->mio_filename);
+  free(mio);
+  return e;
+}
+
+/* **************************************************************************
+ * Statistics
+ * *************************************************************************/
+
+htsmsg_t *
+muxer_io_stats(void)
+{
+  static const char *hist_names[MUXER_IO_HIST] = {
+    "lt1ms", "lt4ms", "lt16ms", "lt64ms", "lt256ms", "lt1s", "lt4s", "ge4s"
+  };
+  muxer_io_fs_t *fs;
+  htsmsg_t *l, *e, *h;
+  int i;
+
+  l = htsmsg_create_list();
+  pthread_mutex_lock(&muxer_io_mutex);
+  LIST_FOREACH(fs, &muxer_io_fss, fs_link) {
+    e = htsmsg_create_map();
+    htsmsg_add_str(e, "path", fs->fs_path);
+    htsmsg_add_s64(e, "writes", fs->fs_writes);
+    htsmsg_add_s64(e, "bytes", fs->fs_bytes);
+    htsmsg_add_s64(e, "drops", fs->fs_drops);
+    htsmsg_add_s64(e, "max", fs->fs_lat_max);
+    h = htsmsg_create_map();
+    for (i = 0; i < MUXER_IO_HIST; i++)
+      htsmsg_add_s64(h, hist_names[i], fs->fs_hist[i]);
+    htsmsg_add_msg(e, "latency", h);
+    htsmsg_add_msg(l, NULL, e);
+  }
+  pthread_mutex_unlock(&muxer_io_mutex);
+  return l;
+}
+
+/* **************************************************************************
+ * Init / done
+ * *************************************************************************/
+
+/*
+ * threads - number of the writer threads per filesystem (0 = default)
+ */
+void
+muxer_io_init(int threads)
+{
+  pthread_mutex_init(&muxer_io_mutex, NULL);
+  pthread_cond_init(&muxer_io_done_cond, NULL);
+  LIST_INIT(&muxer_io_fss);
+  muxer_io_running = 1;
+  if (threads <= 0)
+    threads = MUXER_IO_THREADS;
+  muxer_io_threads = MIN(threads, MUXER_IO_THREADS_MAX);
+}
+
+void
+muxer_io_done(void)
+{
+  muxer_io_fs_t *fs;
+  int i;
+
+  pthread_mutex_lock(&muxer_io_mutex);
+  muxer_io_running = 0;
+  LIST_FOREACH(fs, &muxer_io_fss, fs_link)
+    pthread_cond_broadcast(&fs->fs_cond);
+  pthread_mutex_unlock(&muxer_io_mutex);
+  while ((fs = LIST_FIRST(&muxer_io_fss)) != NULL) {
+    for (i = 0; i < muxer_io_threads; i++)
+      pthread_join(fs->fs_tids[i], NULL);
+    LIST_REMOVE(fs, fs_link);
+    pthread_cond_destroy(&fs->fs_cond);
+    free(fs->fs_tids);
+    free(fs->fs_path);
+    free(fs);
+  }
+}
@@ -0,0 +1,55 @@
+/*
+ *  tvheadend, write-behind file output for the muxers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUXER_IO_H_
+#define MUXER_IO_H_
+
+#include <sys/types.h>
+
+struct iovec;
+struct muxer;
+struct htsmsg;
+
+/*
+ * Recording output is collected into large page aligned buffers which
+ * are written by I/O threads, so the muxer thread never waits for the
+ * disk. Each target filesystem gets its own writer threads. Every buffer
+ * carries its file offset, so the header rewrites done by the muxers are
+ * simply queued as positioned writes. The buffers of one file are always
+ * written in order by one thread.
+ */
+#define MUXER_IO_BUFSIZE (2*1024*1024)
+#define MUXER_IO_ALIGN   4096
+#define MUXER_IO_PERIOD  5  /* seconds, max. age of the data in a buffer */
+#define MUXER_IO_THREADS 2  /* default writer threads per filesystem */
+#define MUXER_IO_THREADS_MAX 16
+#define MUXER_IO_HIST    8  /* latency buckets: <1ms, <4ms, ... <4s, more */
+
+typedef struct muxer_io muxer_io_t;
+
+void        muxer_io_init(int threads);
+void        muxer_io_done(void);
+
+muxer_io_t *muxer_io_create(struct muxer *m, int fd, const char *filename);
+int         muxer_io_write (muxer_io_t *mio, const void *data, size_t len, off_t off);
+int         muxer_io_writev(muxer_io_t *mio, const struct iovec *iov, int iovcnt, off_t off);
+int         muxer_io_ready (muxer_io_t *mio);
+int         muxer_io_close (muxer_io_t *mio);
+
+struct htsmsg *muxer_io_stats(void);
+
+#endif
@@ -27,6 +27,7 @@
 #include "service.h"
 #include "input/mpegts/dvb.h"
 #include "muxer_pass.h"
+#include "muxer_io.h"
 #include "dvr/dvr.h"
 
 typedef struct pass_muxer {
@@ -37,6 +38,9 @@ typedef struct pass_muxer {
   int   pm_fd;
   int   pm_seekable;
   int   pm_error;
+  muxer_io_t *pm_io;  /* write-behind output for files */
+  uint8_t pm_io_drop_pids[8192 / 8];  /* PIDs dropped until the next PUSI */
+  int     pm_io_drops;                /* number of the dropped PIDs */
 
   /* Filename is also used for logging */
   char *pm_filename;
@@ -389,6 +393,7 @@ pass_muxer_open_file(muxer_t *m, const char *filename)
   pm->pm_seekable = 1;
   pm->pm_fd       = fd;
   pm->pm_filename = strdup(filename);
+  pm->pm_io       = muxer_io_create(m, fd, filename);
   return 0;
 }
 
@@ -403,6 +408,14 @@ pass_muxer_write(muxer_t *m, const void *data, size_t size)
 
   if(pm->pm_error) {
     pm->m_errors++;
+  } else if(pm->pm_io) {
+    if((pm->pm_error = muxer_io_write(pm->pm_io, data, size, pm->pm_off)) != 0) {
+      tvhlog(LOG_ERR, "pass", "%s: Write failed -- %s", pm->pm_filename,
+	     strerror(pm->pm_error));
+      m->m_errors++;
+    } else {
+      pm->pm_off += size;
+    }
   } else if(tvh_write(pm->pm_fd, data, size)) {
     pm->pm_error = errno;
     if (!MC_IS_EOS_ERROR(errno))
@@ -484,6 +497,53 @@ pass_muxer_write_ts(muxer_t *m, pktbuf_t *pb)
 }
 
 
+/**
+ * The storage is too slow, drop whole PES packets
+ *
+ * A PID is dropped from its next payload unit start while the storage
+ * is busy and written again from the first payload unit start after
+ * it has caught up, so no PES is cut in the middle. PAT and PMT are
+ * always passed.
+ */
+static pktbuf_t *
+pass_muxer_io_filter(pass_muxer_t *pm, pktbuf_t *pb, int ready)
+{
+  uint8_t *tsb, *end, *dst, bit, *p;
+  pktbuf_t *out;
+  int pid;
+
+  if ((ready && !pm->pm_io_drops) || pb->pb_size < 188)
+    return pb;
+
+  out = pktbuf_alloc(NULL, pb->pb_size);
+  dst = out->pb_data;
+  end = pb->pb_data + pb->pb_size;
+  for (tsb = pb->pb_data; tsb + 188 <= end; tsb += 188) {
+    pid = (tsb[1] & 0x1f) << 8 | tsb[2];
+    if (pid && pid != pm->pm_pmt_pid) {
+      p   = &pm->pm_io_drop_pids[pid >> 3];
+      bit = 1 << (pid & 7);
+      if (tsb[1] & 0x40) { /* pusi */
+        if (!ready && !(*p & bit)) {
+          *p |= bit;
+          pm->pm_io_drops++;
+        } else if (ready && (*p & bit)) {
+          *p &= ~bit;
+          pm->pm_io_drops--;
+        }
+      }
+      if (*p & bit)
+        continue;
+    }
+    memcpy(dst, tsb, 188);
+    dst += 188;
+  }
+  out->pb_size = dst - out->pb_data;
+  pktbuf_ref_dec(pb);
+  return out;
+}
+
+
 /**
  * Write a packet directly to the file descriptor
  */
@@ -495,6 +555,9 @@ pass_muxer_write_pkt(muxer_t *m, streaming_message_type_t smt, void *data)
 
   assert(smt == SMT_MPEGTS);
 
+  if(pm->pm_io)
+    pb = pass_muxer_io_filter(pm, pb, muxer_io_ready(pm->pm_io));
+
   switch(smt) {
   case SMT_MPEGTS:
     pass_muxer_write_ts(m, pb);
@@ -527,8 +590,19 @@ static int
 pass_muxer_close(muxer_t *m)
 {
   pass_muxer_t *pm = (pass_muxer_t*)m;
+  int e;
 
-  if(pm->pm_seekable && close(pm->pm_fd)) {
+  if(pm->pm_io) {
+    e = muxer_io_close(pm->pm_io);
+    pm->pm_io = NULL;
+    if(e) {
+      pm->pm_error = e;
+      tvhlog(LOG_ERR, "pass", "%s: Unable to close file -- %s",
+	     pm->pm_filename, strerror(e));
+      pm->m_errors++;
+      return -1;
+    }
+  } else if(pm->pm_seekable && close(pm->pm_fd)) {
     pm->pm_error = errno;
     tvhlog(LOG_ERR, "pass", "%s: Unable to close file, close failed -- %s",
 	   pm->pm_filename, strerror(errno));
@@ -32,6 +32,7 @@
 #include "dvr/dvr.h"
 #include "mkmux.h"
 #include "ebml.h"
+#include "../muxer_io.h"
 
 extern int dvr_iov_max;
 
@@ -91,6 +92,8 @@ struct mk_mux {
   int error;
   off_t fdpos; // Current position in file
   int seekable;
+  muxer_io_t *io; // Write-behind output for files
+  int io_resync;  // Packets were dropped, wait for the next keyframe
 
   mk_track_t *tracks;
   int ntracks;
@@ -274,8 +277,9 @@ mk_build_tracks(mk_mux_t *mkm, const streaming_start_t *ss)
       break;
 
     case SCT_HEVC:
-      tvherror("mkv", "HEVC (H265) codec is not suppored for Matroska muxer (work in progress)");
-      continue;
+      tracktype = 1;
+      codec_id = "V_MPEGH/ISO/HEVC";
+      break;
 
     case SCT_MPEG2AUDIO:
       tracktype = 2;
@@ -335,6 +339,7 @@ mk_build_tracks(mk_mux_t *mkm, const streaming_start_t *ss)
     
     switch(ssc->ssc_type) {
     case SCT_H264:
+    case SCT_HEVC:
     case SCT_MPEG2VIDEO:
     case SCT_MP4A:
     case SCT_AAC:
@@ -442,6 +447,13 @@ mk_write_to_fd(mk_mux_t *mkm, htsbuf_queue_t *hq)
     iov[i++].iov_len  = hd->hd_data_len - hd->hd_data_off;
   }
 
+  if(mkm->io) {
+    if((mkm->error = muxer_io_writev(mkm->io, iov, i, mkm->fdpos)) != 0)
+      return -1;
+    mkm->fdpos += hq->hq_size;
+    return 0;
+  }
+
   do {
     ssize_t r;
     int iovcnt = i < dvr_iov_max ? i : dvr_iov_max;
@@ -468,7 +480,7 @@ mk_write_queue(mk_mux_t *mkm, htsbuf_queue_t *q)
 {
   if(!mkm->error && mk_write_to_fd(mkm, q) && !MC_IS_EOS_ERROR(mkm->error))
     tvhlog(LOG_ERR, "mkv", "%s: Write failed -- %s", mkm->filename, 
-	   strerror(errno));
+	   strerror(mkm->error));
 
   htsbuf_queue_flush(q);
 }
@@ -800,14 +812,8 @@ mk_write_metaseek(mk_mux_t *mkm, int first)
   } else if(mkm->seekable) {
     off_t prev = mkm->fdpos;
     mkm->fdpos = mkm->segment_pos;
-    if(lseek(mkm->fd, mkm->segment_pos, SEEK_SET) == (off_t) -1)
-      mkm->error = errno;
-
     mk_write_queue(mkm, &q);
     mkm->fdpos = prev;
-    if(lseek(mkm->fd, mkm->fdpos, SEEK_SET) == (off_t) -1)
-      mkm->error = errno;
-   
   }
   htsbuf_queue_flush(&q);
 }
@@ -1070,6 +1076,7 @@ mk_mux_open_file(mk_mux_t *mkm, const char *filename, int permissions)
 
   mkm->filename = strdup(filename);
   mkm->fd = fd;
+  mkm->io = muxer_io_create(mkm->m, fd, filename);
   mkm->cluster_maxsize = 2000000/4;
   mkm->seekable = 1;
 
@@ -1138,6 +1145,20 @@ mk_mux_write_pkt(mk_mux_t *mkm, th_pkt_t *pkt)
     return mkm->error;
   }
 
+  /* The storage is too slow, drop the rest of the GOP */
+  if(mkm->io) {
+    if(!muxer_io_ready(mkm->io))
+      mkm->io_resync = 1;
+    else if(mkm->io_resync &&
+            (!mkm->has_video ||
+             (SCT_ISVIDEO(t->type) && pkt->pkt_frametype == PKT_I_FRAME)))
+      mkm->io_resync = 0;
+    if(mkm->io_resync) {
+      pkt_ref_dec(pkt);
+      return mkm->error;
+    }
+  }
+
   mark = 0;
   if(pkt->pkt_channels != t->channels &&
      pkt->pkt_channels) {
@@ -1227,28 +1248,23 @@ mk_mux_close(mk_mux_t *mkm)
   totsize = mkm->fdpos;
 
   if(mkm->seekable) {
+    int e;
+
     // Rewrite segment info to update duration
-    if(lseek(mkm->fd, mkm->segmentinfo_pos, SEEK_SET) == mkm->segmentinfo_pos)
-      mk_write_master(mkm, 0x1549a966, mk_build_segment_info(mkm));
-    else {
-      mkm->error = errno;
-      tvhlog(LOG_ERR, "mkv", "%s: Unable to write duration, seek failed -- %s",
-	     mkm->filename, strerror(errno));
-    }
+    mkm->fdpos = mkm->segmentinfo_pos;
+    mk_write_master(mkm, 0x1549a966, mk_build_segment_info(mkm));
 
     // Rewrite segment header to update total size
-    if(lseek(mkm->fd, mkm->segment_header_pos, SEEK_SET) == mkm->segment_header_pos) {
-      mk_write_segment_header(mkm, totsize - mkm->segment_header_pos - 12);
-    } else {
-      mkm->error = errno;
-      tvhlog(LOG_ERR, "mkv", "%s: Unable to write total size, seek failed -- %s",
-	     mkm->filename, strerror(errno));
-    }
-
-    if(close(mkm->fd)) {
-      mkm->error = errno;
-      tvhlog(LOG_ERR, "mkv", "%s: Unable to close the file descriptor, close failed -- %s",
-	     mkm->filename, strerror(errno));
+    mkm->fdpos = mkm->segment_header_pos;
+    mk_write_segment_header(mkm, totsize - mkm->segment_header_pos - 12);
+
+    mkm->fdpos = totsize;
+    e = muxer_io_close(mkm->io);
+    mkm->io = NULL;
+    if(e && !mkm->error) {
+      mkm->error = e;
+      tvhlog(LOG_ERR, "mkv", "%s: Unable to close the file -- %s",
+	     mkm->filename, strerror(e));
     }
   }
 
@@ -20,6 +20,9 @@
  */
 
 #include "parser_avc.h"
+#include "parser_h264.h"
+#include "bitstream.h"
+
 static const uint8_t *
 avc_find_startcode_internal(const uint8_t *p, const uint8_t *end)
 {
@@ -207,8 +210,120 @@ isom_write_avcc(sbuf_t *sb, const uint8_t *data, int len)
   return 0;
 }
 
-th_pkt_t *
-avc_convert_pkt(th_pkt_t *src)
+/*
+ * HEVCDecoderConfigurationRecord (ISO/IEC 14496-15, 8.3.3.1)
+ *
+ * The profile, tier and level fields, the chroma format and the bit
+ * depths are taken from the first SPS, the VPS / SPS / PPS units are
+ * stored as they are.
+ */
+static int
+isom_write_hvcc(sbuf_t *sb, const uint8_t *data, int len)
+{
+  static const uint8_t types[3] = { 32, 33, 34 }; /* VPS, SPS, PPS */
+  uint8_t *buf = NULL, *p, *end, *sps = NULL;
+  uint8_t ptl[12] = { 0 };
+  int sps_size = 0, sub_layers = 0, nested = 0;
+  int chroma = 1, luma_depth = 0, chroma_depth = 0;
+  int count[3] = { 0 };
+  int i, j, arrays, profile[8], level[8];
+  unsigned int size;
+  bitstream_t bs;
+  void *f;
+
+  if (len <= 6 || (RB32(data) != 0x00000001 && RB24(data) != 0x000001)) {
+    sbuf_append(sb, data, len);
+    return 0;
+  }
+
+  avc_parse_nal_units_buf(data, &buf, &len);
+  end = buf + len;
+
+  for (p = buf; end - p > 4; p += size) {
+    size = FFMIN(RB32(p), end - p - 4);
+    p += 4;
+    if (size < 2 || size > UINT16_MAX)
+      continue;
+    for (j = 0; j < 3; j++)
+      if (((p[0] >> 1) & 0x3f) == types[j])
+        count[j]++;
+    if (((p[0] >> 1) & 0x3f) == types[1] && sps == NULL) {
+      sps = p;
+      sps_size = size;
+    }
+  }
+
+  if (!count[0] || !count[1] || !count[2]) {
+    free(buf);
+    return -1;
+  }
+
+  /* Skip both bytes of the NAL unit header */
+  f = h264_nal_deescape(&bs, sps + 1, sps_size - 1);
+  skip_bits(&bs, 4);                  /* sps_video_parameter_set_id */
+  sub_layers = read_bits(&bs, 3);     /* sps_max_sub_layers_minus1 */
+  nested = read_bits1(&bs);           /* sps_temporal_id_nesting_flag */
+  for (i = 0; i < 12; i++)
+    ptl[i] = read_bits(&bs, 8);       /* general profile_tier_level */
+  for (i = 0; i < sub_layers; i++) {
+    profile[i] = read_bits1(&bs);
+    level[i]   = read_bits1(&bs);
+  }
+  if (sub_layers > 0)
+    skip_bits(&bs, 2 * (8 - sub_layers));
+  for (i = 0; i < sub_layers; i++) {
+    if (profile[i])
+      skip_bits(&bs, 88);
+    if (level[i])
+      skip_bits(&bs, 8);
+  }
+  read_golomb_ue(&bs);                /* sps_seq_parameter_set_id */
+  chroma = read_golomb_ue(&bs);
+  if (chroma == 3)
+    skip_bits(&bs, 1);                /* separate_colour_plane_flag */
+  read_golomb_ue(&bs);                /* pic_width_in_luma_samples */
+  read_golomb_ue(&bs);                /* pic_height_in_luma_samples */
+  if (read_bits1(&bs))                /* conformance_window_flag */
+    for (i = 0; i < 4; i++)
+      read_golomb_ue(&bs);
+  luma_depth = read_golomb_ue(&bs);
+  chroma_depth = read_golomb_ue(&bs);
+  free(f);
+
+  sbuf_put_byte(sb, 1);               /* configurationVersion */
+  sbuf_append(sb, ptl, 12);           /* profile, compatibility, constraints, level */
+  sbuf_put_be16(sb, 0xf000);          /* min_spatial_segmentation_idc */
+  sbuf_put_byte(sb, 0xfc);            /* parallelismType */
+  sbuf_put_byte(sb, 0xfc | (chroma & 3));
+  sbuf_put_byte(sb, 0xf8 | (luma_depth & 7));
+  sbuf_put_byte(sb, 0xf8 | (chroma_depth & 7));
+  sbuf_put_be16(sb, 0);               /* avgFrameRate */
+  /* constantFrameRate, numTemporalLayers, temporalIdNested, lengthSizeMinusOne */
+  sbuf_put_byte(sb, ((sub_layers + 1) << 3) | (nested << 2) | 3);
+
+  for (arrays = j = 0; j < 3; j++)
+    arrays += count[j] > 0;
+  sbuf_put_byte(sb, arrays);          /* numOfArrays */
+
+  for (j = 0; j < 3; j++) {
+    sbuf_put_byte(sb, 0x80 | types[j]); /* array_completeness + NAL_unit_type */
+    sbuf_put_be16(sb, count[j]);
+    for (p = buf; end - p > 4; p += size) {
+      size = FFMIN(RB32(p), end - p - 4);
+      p += 4;
+      if (size < 2 || size > UINT16_MAX || ((p[0] >> 1) & 0x3f) != types[j])
+        continue;
+      sbuf_put_be16(sb, size);
+      sbuf_append(sb, p, size);
+    }
+  }
+
+  free(buf);
+  return 0;
+}
+
+static th_pkt_t *
+isom_convert_pkt(th_pkt_t *src, int (*write_header)(sbuf_t *, const uint8_t *, int))
 {
   th_pkt_t *pkt = malloc(sizeof(th_pkt_t));
   *pkt = *src;
@@ -220,8 +335,8 @@ avc_convert_pkt(th_pkt_t *src)
     sbuf_t headers;
     sbuf_init(&headers);
     
-    isom_write_avcc(&headers, pktbuf_ptr(src->pkt_header),
-		    pktbuf_len(src->pkt_header));
+    write_header(&headers, pktbuf_ptr(src->pkt_header),
+		 pktbuf_len(src->pkt_header));
     pkt->pkt_header = pktbuf_make(headers.sb_data, headers.sb_ptr);
   }
 
@@ -238,3 +353,15 @@ avc_convert_pkt(th_pkt_t *src)
   pkt->pkt_payload = pktbuf_make(payload.sb_data, payload.sb_ptr);
   return pkt;
 }
+
+th_pkt_t *
+avc_convert_pkt(th_pkt_t *src)
+{
+  return isom_convert_pkt(src, isom_write_avcc);
+}
+
+th_pkt_t *
+hevc_convert_pkt(th_pkt_t *src)
+{
+  return isom_convert_pkt(src, isom_write_hvcc);
+}
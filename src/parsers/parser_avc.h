@@ -27,4 +27,6 @@
 
 th_pkt_t *avc_convert_pkt(th_pkt_t *src);
 
+th_pkt_t *hevc_convert_pkt(th_pkt_t *src);
+
 #endif 
@@ -133,7 +133,7 @@ static const uint16_t h264_aspect[17][2] = {
 };
 
 
-static uint32_t
+uint32_t
 gcd(uint32_t a, uint32_t b)
 {
   uint32_t r;
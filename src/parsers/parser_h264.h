@@ -21,6 +21,8 @@
 
 #include "bitstream.h"
 
+uint32_t gcd(uint32_t a, uint32_t b);
+
 void *h264_nal_deescape(bitstream_t *bs, const uint8_t *data, int size);
 
 int h264_decode_seq_parameter_set(struct elementary_stream *st, bitstream_t *bs);
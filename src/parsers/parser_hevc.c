@@ -0,0 +1,471 @@
+/*
+ *  H.265 (HEVC) VPS / SPS / PPS / slice header parser
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tvheadend.h"
+#include "parsers.h"
+#include "parser_h264.h"
+#include "parser_hevc.h"
+#include "bitstream.h"
+#include "service.h"
+
+#define MAX_VPS_COUNT   16
+#define MAX_SPS_COUNT   16
+#define MAX_PPS_COUNT   64
+#define MAX_SUB_LAYERS  7
+#define MAX_ST_RPS      64
+
+typedef struct hevc_private {
+
+  struct {
+    char valid;
+    uint32_t num_units_in_tick;
+    uint32_t time_scale;
+  } vps[MAX_VPS_COUNT];
+
+  struct {
+    char valid;
+    char vps_id;
+    uint16_t width;
+    uint16_t height;
+    uint32_t num_units_in_tick;
+    uint32_t time_scale;
+    uint16_t aspect_num;
+    uint16_t aspect_den;
+  } sps[MAX_SPS_COUNT];
+
+  struct {
+    char valid;
+    char sps_id;
+    char dependent_slice_segments;
+    char num_extra_slice_header_bits;
+  } pps[MAX_PPS_COUNT];
+
+} hevc_private_t;
+
+static const uint16_t hevc_aspect[17][2] = {
+ {0, 1},
+ {1, 1},
+ {12, 11},
+ {10, 11},
+ {16, 11},
+ {40, 33},
+ {24, 11},
+ {20, 11},
+ {32, 11},
+ {80, 33},
+ {18, 11},
+ {15, 11},
+ {64, 33},
+ {160,99},
+ {4, 3},
+ {3, 2},
+ {2, 1},
+};
+
+static inline hevc_private_t *
+hevc_private(elementary_stream_t *st)
+{
+  if (st->es_priv == NULL)
+    st->es_priv = calloc(1, sizeof(hevc_private_t));
+  return st->es_priv;
+}
+
+static void
+profile_tier_level(bitstream_t *bs, int max_sub_layers_minus1)
+{
+  int i, profile[MAX_SUB_LAYERS], level[MAX_SUB_LAYERS];
+
+  skip_bits(bs, 88);  /* general profile space ... general_reserved_zero_43bits */
+  skip_bits(bs, 8);   /* general_level_idc */
+  for (i = 0; i < max_sub_layers_minus1; i++) {
+    profile[i] = read_bits1(bs);
+    level[i]   = read_bits1(bs);
+  }
+  if (max_sub_layers_minus1 > 0)
+    for (i = max_sub_layers_minus1; i < 8; i++)
+      skip_bits(bs, 2); /* reserved_zero_2bits */
+  for (i = 0; i < max_sub_layers_minus1; i++) {
+    if (profile[i])
+      skip_bits(bs, 88);
+    if (level[i])
+      skip_bits(bs, 8);
+  }
+}
+
+static void
+scaling_list_data(bitstream_t *bs)
+{
+  int size, matrix, i, coefs;
+
+  for (size = 0; size < 4; size++)
+    for (matrix = 0; matrix < 6; matrix += (size == 3) ? 3 : 1) {
+      if (!read_bits1(bs)) {          /* scaling_list_pred_mode_flag */
+        read_golomb_ue(bs);           /* scaling_list_pred_matrix_id_delta */
+      } else {
+        coefs = MIN(64, 1 << (4 + (size << 1)));
+        if (size > 1)
+          read_golomb_se(bs);         /* scaling_list_dc_coef_minus8 */
+        for (i = 0; i < coefs; i++)
+          read_golomb_se(bs);         /* scaling_list_delta_coef */
+      }
+    }
+}
+
+/* Returns the number of the delta POCs of the set or -1 */
+static int
+st_ref_pic_set(bitstream_t *bs, int idx, const int *num_delta_pocs)
+{
+  int i, neg, pos, count = 0;
+
+  if (idx && read_bits1(bs)) {        /* inter_ref_pic_set_prediction_flag */
+    read_bits1(bs);                   /* delta_rps_sign */
+    read_golomb_ue(bs);               /* abs_delta_rps_minus1 */
+    for (i = 0; i <= num_delta_pocs[idx - 1]; i++) {
+      if (read_bits1(bs))             /* used_by_curr_pic_flag */
+        count++;
+      else if (read_bits1(bs))        /* use_delta_flag */
+        count++;
+    }
+    return count;
+  }
+  neg = read_golomb_ue(bs);
+  pos = read_golomb_ue(bs);
+  if (neg > 16 || pos > 16)
+    return -1;
+  for (i = 0; i < neg + pos; i++) {
+    read_golomb_ue(bs);               /* delta_poc_sX_minus1 */
+    read_bits1(bs);                   /* used_by_curr_pic_sX_flag */
+  }
+  return neg + pos;
+}
+
+static void
+decode_vui(hevc_private_t *p, bitstream_t *bs, unsigned int sps_id)
+{
+  int aspect;
+
+  p->sps[sps_id].aspect_num = 0;
+  p->sps[sps_id].aspect_den = 1;
+
+  if (read_bits1(bs)) {               /* aspect_ratio_info_present_flag */
+    aspect = read_bits(bs, 8);
+    if (aspect == 255) {
+      p->sps[sps_id].aspect_num = read_bits(bs, 16);
+      p->sps[sps_id].aspect_den = read_bits(bs, 16);
+    } else if (aspect < 17) {
+      p->sps[sps_id].aspect_num = hevc_aspect[aspect][0];
+      p->sps[sps_id].aspect_den = hevc_aspect[aspect][1];
+    }
+  }
+
+  if (read_bits1(bs))                 /* overscan_info_present_flag */
+    read_bits1(bs);                   /* overscan_appropriate_flag */
+
+  if (read_bits1(bs)) {               /* video_signal_type_present_flag */
+    read_bits(bs, 3);                 /* video_format */
+    read_bits1(bs);                   /* video_full_range_flag */
+    if (read_bits1(bs))               /* colour_description_present_flag */
+      read_bits(bs, 24);
+  }
+
+  if (read_bits1(bs)) {               /* chroma_loc_info_present_flag */
+    read_golomb_ue(bs);
+    read_golomb_ue(bs);
+  }
+
+  read_bits1(bs);                     /* neutral_chroma_indication_flag */
+  read_bits1(bs);                     /* field_seq_flag */
+  read_bits1(bs);                     /* frame_field_info_present_flag */
+
+  if (read_bits1(bs)) {               /* default_display_window_flag */
+    read_golomb_ue(bs);
+    read_golomb_ue(bs);
+    read_golomb_ue(bs);
+    read_golomb_ue(bs);
+  }
+
+  if (read_bits1(bs)) {               /* vui_timing_info_present_flag */
+    p->sps[sps_id].num_units_in_tick = read_bits(bs, 32);
+    p->sps[sps_id].time_scale        = read_bits(bs, 32);
+  }
+}
+
+int
+hevc_decode_vps(elementary_stream_t *st, bitstream_t *bs)
+{
+  hevc_private_t *p = hevc_private(st);
+  int i, j, vps_id, max_sub_layers_minus1, ordering, max_layer_id, layer_sets;
+
+  vps_id = read_bits(bs, 4);
+  skip_bits(bs, 2);                   /* vps_base_layer_* flags */
+  skip_bits(bs, 6);                   /* vps_max_layers_minus1 */
+  max_sub_layers_minus1 = read_bits(bs, 3);
+  skip_bits(bs, 17);                  /* temporal_id_nesting, reserved 0xffff */
+  if (max_sub_layers_minus1 >= MAX_SUB_LAYERS)
+    return -1;
+
+  profile_tier_level(bs, max_sub_layers_minus1);
+
+  ordering = read_bits1(bs);
+  for (i = ordering ? 0 : max_sub_layers_minus1; i <= max_sub_layers_minus1; i++) {
+    read_golomb_ue(bs);               /* vps_max_dec_pic_buffering_minus1 */
+    read_golomb_ue(bs);               /* vps_max_num_reorder_pics */
+    read_golomb_ue(bs);               /* vps_max_latency_increase_plus1 */
+  }
+
+  max_layer_id = read_bits(bs, 6);
+  layer_sets   = read_golomb_ue(bs);  /* vps_num_layer_sets_minus1 */
+  if (layer_sets > 1023)
+    return -1;
+  for (i = 1; i <= layer_sets; i++)
+    for (j = 0; j <= max_layer_id; j++)
+      read_bits1(bs);                 /* layer_id_included_flag */
+
+  p->vps[vps_id].num_units_in_tick = 0;
+  p->vps[vps_id].time_scale = 0;
+  if (read_bits1(bs)) {               /* vps_timing_info_present_flag */
+    p->vps[vps_id].num_units_in_tick = read_bits(bs, 32);
+    p->vps[vps_id].time_scale        = read_bits(bs, 32);
+  }
+  if (bs_eof(bs))
+    return -1;
+  p->vps[vps_id].valid = 1;
+  return 0;
+}
+
+int
+hevc_decode_sps(elementary_stream_t *st, bitstream_t *bs)
+{
+  hevc_private_t *p = hevc_private(st);
+  unsigned int sps_id;
+  int vps_id, max_sub_layers_minus1, chroma_format_idc;
+  int width, height, sub_width, sub_height, log2_max_poc_lsb;
+  int i, rps_count, num_delta_pocs[MAX_ST_RPS];
+  int left, right, top, bottom;
+
+  vps_id = read_bits(bs, 4);
+  max_sub_layers_minus1 = read_bits(bs, 3);
+  read_bits1(bs);                     /* sps_temporal_id_nesting_flag */
+  if (max_sub_layers_minus1 >= MAX_SUB_LAYERS)
+    return -1;
+
+  profile_tier_level(bs, max_sub_layers_minus1);
+
+  sps_id = read_golomb_ue(bs);
+  if (sps_id >= MAX_SPS_COUNT)
+    return -1;
+
+  chroma_format_idc = read_golomb_ue(bs);
+  if (chroma_format_idc > 3)
+    return -1;
+  if (chroma_format_idc == 3 && read_bits1(bs)) /* separate_colour_plane_flag */
+    chroma_format_idc = 0;
+  sub_width  = (chroma_format_idc == 1 || chroma_format_idc == 2) ? 2 : 1;
+  sub_height = (chroma_format_idc == 1) ? 2 : 1;
+
+  width  = read_golomb_ue(bs);
+  height = read_golomb_ue(bs);
+  if (read_bits1(bs)) {               /* conformance_window_flag */
+    left   = read_golomb_ue(bs);
+    right  = read_golomb_ue(bs);
+    top    = read_golomb_ue(bs);
+    bottom = read_golomb_ue(bs);
+    width  -= sub_width * (left + right);
+    height -= sub_height * (top + bottom);
+  }
+  if (width <= 0 || height <= 0 || width > 16888 || height > 16888)
+    return -1;
+
+  read_golomb_ue(bs);                 /* bit_depth_luma_minus8 */
+  read_golomb_ue(bs);                 /* bit_depth_chroma_minus8 */
+  log2_max_poc_lsb = read_golomb_ue(bs) + 4;
+  if (log2_max_poc_lsb > 16)
+    return -1;
+
+  i = read_bits1(bs) ? 0 : max_sub_layers_minus1; /* sub_layer_ordering_info */
+  for ( ; i <= max_sub_layers_minus1; i++) {
+    read_golomb_ue(bs);
+    read_golomb_ue(bs);
+    read_golomb_ue(bs);
+  }
+
+  read_golomb_ue(bs);                 /* log2_min_luma_coding_block_size_minus3 */
+  read_golomb_ue(bs);                 /* log2_diff_max_min_luma_coding_block_size */
+  read_golomb_ue(bs);                 /* log2_min_luma_transform_block_size_minus2 */
+  read_golomb_ue(bs);                 /* log2_diff_max_min_luma_transform_block_size */
+  read_golomb_ue(bs);                 /* max_transform_hierarchy_depth_inter */
+  read_golomb_ue(bs);                 /* max_transform_hierarchy_depth_intra */
+
+  if (read_bits1(bs) && read_bits1(bs)) /* scaling_list_enabled, data present */
+    scaling_list_data(bs);
+
+  read_bits1(bs);                     /* amp_enabled_flag */
+  read_bits1(bs);                     /* sample_adaptive_offset_enabled_flag */
+
+  if (read_bits1(bs)) {               /* pcm_enabled_flag */
+    skip_bits(bs, 8);                 /* pcm_sample_bit_depth_*_minus1 */
+    read_golomb_ue(bs);
+    read_golomb_ue(bs);
+    read_bits1(bs);                   /* pcm_loop_filter_disabled_flag */
+  }
+
+  rps_count = read_golomb_ue(bs);     /* num_short_term_ref_pic_sets */
+  if (rps_count > MAX_ST_RPS)
+    return -1;
+  for (i = 0; i < rps_count; i++)
+    if ((num_delta_pocs[i] = st_ref_pic_set(bs, i, num_delta_pocs)) < 0)
+      return -1;
+
+  if (read_bits1(bs)) {               /* long_term_ref_pics_present_flag */
+    i = read_golomb_ue(bs);
+    if (i > 32)
+      return -1;
+    for ( ; i > 0; i--) {
+      skip_bits(bs, log2_max_poc_lsb);
+      read_bits1(bs);
+    }
+  }
+
+  read_bits1(bs);                     /* sps_temporal_mvp_enabled_flag */
+  read_bits1(bs);                     /* strong_intra_smoothing_enabled_flag */
+
+  p->sps[sps_id].num_units_in_tick = 0;
+  p->sps[sps_id].time_scale = 0;
+  p->sps[sps_id].aspect_num = 0;
+  p->sps[sps_id].aspect_den = 1;
+  if (read_bits1(bs))                 /* vui_parameters_present_flag */
+    decode_vui(p, bs, sps_id);
+
+  if (bs_eof(bs))
+    return -1;
+
+  p->sps[sps_id].vps_id = vps_id;
+  p->sps[sps_id].width  = width;
+  p->sps[sps_id].height = height;
+  p->sps[sps_id].valid  = 1;
+  return 0;
+}
+
+int
+hevc_decode_pps(elementary_stream_t *st, bitstream_t *bs)
+{
+  hevc_private_t *p = hevc_private(st);
+  unsigned int pps_id, sps_id;
+
+  pps_id = read_golomb_ue(bs);
+  if (pps_id >= MAX_PPS_COUNT)
+    return -1;
+  sps_id = read_golomb_ue(bs);
+  if (sps_id >= MAX_SPS_COUNT)
+    return -1;
+
+  p->pps[pps_id].sps_id = sps_id;
+  p->pps[pps_id].dependent_slice_segments = read_bits1(bs);
+  read_bits1(bs);                     /* output_flag_present_flag */
+  p->pps[pps_id].num_extra_slice_header_bits = read_bits(bs, 3);
+  p->pps[pps_id].valid = 1;
+  return 0;
+}
+
+/*
+ * Returns 0 for the first slice segment of a picture (*pkttype is set),
+ * 1 for the other slice segments and -1 on error
+ */
+int
+hevc_decode_slice_header(elementary_stream_t *st, bitstream_t *bs,
+                         int nal_type, int *pkttype)
+{
+  hevc_private_t *p = st->es_priv;
+  unsigned int pps_id, sps_id;
+  int vps_id, slice_type, d = 0;
+  uint32_t units, scale;
+
+  if (p == NULL)
+    return -1;
+
+  if (!read_bits1(bs))                /* first_slice_segment_in_pic_flag */
+    return 1;
+
+  if (HEVC_NAL_IS_IRAP(nal_type))
+    read_bits1(bs);                   /* no_output_of_prior_pics_flag */
+
+  pps_id = read_golomb_ue(bs);
+  if (pps_id >= MAX_PPS_COUNT || !p->pps[pps_id].valid)
+    return -1;
+  sps_id = p->pps[pps_id].sps_id;
+  if (!p->sps[sps_id].valid)
+    return -1;
+
+  skip_bits(bs, p->pps[pps_id].num_extra_slice_header_bits);
+  slice_type = read_golomb_ue(bs);
+
+  /* Random access points are always I frames for the indexes */
+  if (HEVC_NAL_IS_IRAP(nal_type)) {
+    *pkttype = PKT_I_FRAME;
+  } else {
+    switch (slice_type) {
+    case 0:
+      *pkttype = PKT_B_FRAME;
+      break;
+    case 1:
+      *pkttype = PKT_P_FRAME;
+      break;
+    case 2:
+      *pkttype = PKT_I_FRAME;
+      break;
+    default:
+      return -1;
+    }
+  }
+
+  /* Frame duration - SPS VUI, then VPS */
+  units = p->sps[sps_id].num_units_in_tick;
+  scale = p->sps[sps_id].time_scale;
+  vps_id = p->sps[sps_id].vps_id;
+  if ((!units || !scale) && p->vps[vps_id].valid) {
+    units = p->vps[vps_id].num_units_in_tick;
+    scale = p->vps[vps_id].time_scale;
+  }
+  if (units && scale)
+    d = 90000LL * units / scale;
+
+  st->es_vbv_delay = -1;
+
+  if (d && !st->es_buf.sb_err)
+    parser_set_stream_vparam(st, p->sps[sps_id].width,
+                             p->sps[sps_id].height, d);
+
+  if (p->sps[sps_id].aspect_num && p->sps[sps_id].aspect_den) {
+    int w = p->sps[sps_id].aspect_num * st->es_width;
+    int h = p->sps[sps_id].aspect_den * st->es_height;
+    if (w && h) {
+      int g = gcd(w, h);
+      st->es_aspect_num = w / g;
+      st->es_aspect_den = h / g;
+    }
+  } else {
+    st->es_aspect_num = 0;
+    st->es_aspect_den = 1;
+  }
+
+  return 0;
+}
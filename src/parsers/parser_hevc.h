@@ -0,0 +1,49 @@
+/*
+ *  H.265 (HEVC) VPS / SPS / PPS / slice header parser
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARSER_HEVC_H_
+#define PARSER_HEVC_H_
+
+#include "bitstream.h"
+
+/* NAL unit types (ITU-T H.265, table 7-1) */
+#define HEVC_NAL_TRAIL_N        0
+#define HEVC_NAL_RASL_R         9
+#define HEVC_NAL_BLA_W_LP       16
+#define HEVC_NAL_CRA_NUT        21
+#define HEVC_NAL_IRAP_VCL23     23
+#define HEVC_NAL_VPS            32
+#define HEVC_NAL_SPS            33
+#define HEVC_NAL_PPS            34
+#define HEVC_NAL_AUD            35
+#define HEVC_NAL_FD             38
+
+#define HEVC_NAL_IS_SLICE(t) \
+  ((t) <= HEVC_NAL_RASL_R || ((t) >= HEVC_NAL_BLA_W_LP && (t) <= HEVC_NAL_CRA_NUT))
+#define HEVC_NAL_IS_IRAP(t) \
+  ((t) >= HEVC_NAL_BLA_W_LP && (t) <= HEVC_NAL_IRAP_VCL23)
+
+int hevc_decode_vps(struct elementary_stream *st, bitstream_t *bs);
+
+int hevc_decode_sps(struct elementary_stream *st, bitstream_t *bs);
+
+int hevc_decode_pps(struct elementary_stream *st, bitstream_t *bs);
+
+int hevc_decode_slice_header(struct elementary_stream *st, bitstream_t *bs,
+                             int nal_type, int *pkttype);
+
+#endif /* PARSER_HEVC_H_ */
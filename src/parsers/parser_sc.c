@@ -0,0 +1,71 @@
+/*
+ *  Start code scanner for the elementary stream parsers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tvheadend.h"
+#include "parser_sc.h"
+
+static int parser_sc_find_init(const uint8_t *data, int len);
+
+int (*parser_sc_find)(const uint8_t *data, int len) = parser_sc_find_init;
+
+/*
+ * Look at every third byte only: when it is above one, none of the
+ * sequences ending at it or at the two following bytes can match
+ */
+int
+parser_sc_find_c(const uint8_t *data, int len)
+{
+  int i = 2;
+
+  while (i < len) {
+    if (data[i] > 1) {
+      i += 3;
+    } else if (data[i] == 1) {
+      if (data[i-1] == 0 && data[i-2] == 0)
+        return i - 2;
+      i += 3;
+    } else {
+      i++;
+    }
+  }
+  return -1;
+}
+
+static int
+parser_sc_find_init(const uint8_t *data, int len)
+{
+  const char *name = "C";
+
+  parser_sc_find = parser_sc_find_c;
+#if defined(__i386__) || defined(__x86_64__)
+  __builtin_cpu_init();
+#ifdef CONFIG_AVX2
+  if (parser_sc_find == parser_sc_find_c && __builtin_cpu_supports("avx2")) {
+    parser_sc_find = parser_sc_find_avx2;
+    name = "AVX2";
+  }
+#endif
+#ifdef CONFIG_SSE2
+  if (parser_sc_find == parser_sc_find_c && __builtin_cpu_supports("sse2")) {
+    parser_sc_find = parser_sc_find_sse2;
+    name = "SSE2";
+  }
+#endif
+#endif
+  tvhlog(LOG_INFO, "parser", "Using %s start code scanner", name);
+  return parser_sc_find(data, len);
+}
@@ -0,0 +1,36 @@
+/*
+ *  Start code scanner for the elementary stream parsers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARSER_SC_H_
+#define PARSER_SC_H_
+
+#include <stdint.h>
+
+/*
+ * Return the offset of the first 00 00 01 sequence in data (the whole
+ * sequence must be within len bytes) or -1 when there is none.
+ *
+ * The SSE2 / AVX2 variants are selected on the first call, when
+ * supported by the build and the CPU.
+ */
+extern int (*parser_sc_find)(const uint8_t *data, int len);
+
+int parser_sc_find_c(const uint8_t *data, int len);
+int parser_sc_find_sse2(const uint8_t *data, int len);
+int parser_sc_find_avx2(const uint8_t *data, int len);
+
+#endif /* PARSER_SC_H_ */
@@ -0,0 +1,44 @@
+/*
+ *  Start code scanner for the elementary stream parsers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <immintrin.h>
+
+#include "parser_sc.h"
+
+int
+parser_sc_find_avx2(const uint8_t *data, int len)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one  = _mm256_set1_epi8(1);
+  __m256i a, b, c;
+  uint32_t m;
+  int i, r;
+
+  /* 32 positions at a time, the loads cover bytes i .. i + 33 */
+  for (i = 0; i + 34 <= len; i += 32) {
+    a = _mm256_loadu_si256((const __m256i *)(data + i));
+    b = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+    c = _mm256_loadu_si256((const __m256i *)(data + i + 2));
+    m = _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(a, zero),
+                                                               _mm256_cmpeq_epi8(b, zero)),
+                                              _mm256_cmpeq_epi8(c, one)));
+    if (m)
+      return i + __builtin_ctz(m);
+  }
+  r = parser_sc_find_c(data + i, len - i);
+  return r < 0 ? r : i + r;
+}
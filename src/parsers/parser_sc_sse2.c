@@ -0,0 +1,43 @@
+/*
+ *  Start code scanner for the elementary stream parsers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <emmintrin.h>
+
+#include "parser_sc.h"
+
+int
+parser_sc_find_sse2(const uint8_t *data, int len)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one  = _mm_set1_epi8(1);
+  __m128i a, b, c;
+  int i, m;
+
+  /* 16 positions at a time, the loads cover bytes i .. i + 17 */
+  for (i = 0; i + 18 <= len; i += 16) {
+    a = _mm_loadu_si128((const __m128i *)(data + i));
+    b = _mm_loadu_si128((const __m128i *)(data + i + 1));
+    c = _mm_loadu_si128((const __m128i *)(data + i + 2));
+    m = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a, zero),
+                                                      _mm_cmpeq_epi8(b, zero)),
+                                        _mm_cmpeq_epi8(c, one)));
+    if (m)
+      return i + __builtin_ctz(m);
+  }
+  m = parser_sc_find_c(data + i, len - i);
+  return m < 0 ? m : i + m;
+}
@@ -28,7 +28,9 @@
 #include "tvheadend.h"
 #include "service.h"
 #include "parsers.h"
+#include "parser_sc.h"
 #include "parser_h264.h"
+#include "parser_hevc.h"
 #include "parser_latm.h"
 #include "bitstream.h"
 #include "packet.h"
@@ -87,6 +89,9 @@ static int parse_mpeg2video(service_t *t, elementary_stream_t *st, size_t len,
 static int parse_h264(service_t *t, elementary_stream_t *st, size_t len,
                       uint32_t next_startcode, int sc_offset);
 
+static int parse_hevc(service_t *t, elementary_stream_t *st, size_t len,
+                      uint32_t next_startcode, int sc_offset);
+
 typedef int (packet_parser_t)(service_t *t, elementary_stream_t *st, size_t len,
                               uint32_t next_startcode, int sc_offset);
 
@@ -145,6 +150,10 @@ parse_mpeg_ts(service_t *t, elementary_stream_t *st, const uint8_t *data,
     parse_sc(t, st, data, len, parse_h264);
     break;
 
+  case SCT_HEVC:
+    parse_sc(t, st, data, len, parse_hevc);
+    break;
+
   case SCT_MPEG2AUDIO:
     parse_sc(t, st, data, len, parse_mpa);
     break;
@@ -282,12 +291,32 @@ parse_aac(service_t *t, elementary_stream_t *st, const uint8_t *data,
  * We scan for startcodes a'la 0x000001xx and let a specific parser
  * derive further information.
  */
+/*
+ * Return the offset of the byte following the next 00 00 01 sequence,
+ * which may start in the previous data (sc), or len if there is none
+ */
+static inline int
+parse_sc_next(const uint8_t *data, int i, int len, uint32_t sc)
+{
+  int k, r;
+
+  for (k = i; k < len && k < i + 3; k++) {
+    if ((sc & 0xffffff) == 1)
+      return k;
+    sc = sc << 8 | data[k];
+  }
+  if (len - i < 4)
+    return len;
+  r = parser_sc_find(data + i, len - i - 1);
+  return r < 0 ? len : i + r + 3;
+}
+
 static void
 parse_sc(service_t *t, elementary_stream_t *st, const uint8_t *data, int len,
          packet_parser_t *vp)
 {
   uint32_t sc = st->es_startcond;
-  int i, r;
+  int i, j, k, r;
   sbuf_alloc(&st->es_buf, len);
 
   for(i = 0; i < len; i++) {
@@ -318,8 +347,15 @@ parse_sc(service_t *t, elementary_stream_t *st, const uint8_t *data, int len,
       continue;
     }
 
-    st->es_buf.sb_data[st->es_buf.sb_ptr++] = data[i];
-    sc = sc << 8 | data[i];
+    /* Copy everything up to (and including) the next start code */
+    k = parse_sc_next(data, i, len, sc);
+    if (k == len)
+      k--;
+    memcpy(st->es_buf.sb_data + st->es_buf.sb_ptr, data + i, k - i + 1);
+    st->es_buf.sb_ptr += k - i + 1;
+    for (j = MAX(i, k - 3); j <= k; j++)
+      sc = sc << 8 | data[j];
+    i = k;
     if((sc & 0xffffff00) != 0x00000100)
       continue;
 
@@ -1248,6 +1284,112 @@ parse_h264(service_t *t, elementary_stream_t *st, size_t len,
   return ret;
 }
 
+/**
+ * H.265 (HEVC) parser
+ */
+static int
+parse_hevc(service_t *t, elementary_stream_t *st, size_t len,
+           uint32_t next_startcode, int sc_offset)
+{
+  const uint8_t *buf = st->es_buf.sb_data + sc_offset;
+  uint32_t sc = st->es_startcode;
+  int l2, pkttype, type, r;
+  bitstream_t bs;
+  int ret = 0;
+
+  if(sc >= 0x000001e0 && sc <= 0x000001ef) {
+    /* System start codes for video */
+    if(len >= 9){
+      uint16_t plen = buf[4] << 8 | buf[5];
+      if(plen >= 0xffe9) st->es_incomplete =1;
+      parse_pes_header(t, st, buf + 6, len - 6);
+    }
+    st->es_prevdts = st->es_curdts;
+    return 1;
+  }
+
+  /* Two byte NAL unit header, broken units are handled as unspecified */
+  type = len >= 5 ? (sc >> 1) & 0x3f : 63;
+
+  switch(type) {
+
+  case HEVC_NAL_FD:
+    /* Filler data */
+    st->es_buf.sb_ptr -= len;
+    ret = 2;
+    break;
+
+  case HEVC_NAL_VPS:
+  case HEVC_NAL_SPS:
+  case HEVC_NAL_PPS:
+    if(!st->es_buf.sb_err) {
+      void *f = h264_nal_deescape(&bs, buf + 4, len - 4);
+      if(type == HEVC_NAL_VPS)
+        hevc_decode_vps(st, &bs);
+      else if(type == HEVC_NAL_SPS)
+        hevc_decode_sps(st, &bs);
+      else
+        hevc_decode_pps(st, &bs);
+      free(f);
+      parser_global_data_move(st, buf, len);
+    }
+    ret = 2;
+    break;
+
+  default:
+    if(!HEVC_NAL_IS_SLICE(type))
+      break;
+
+    l2 = len - 4 > 64 ? 64 : len - 4;
+    void *f = h264_nal_deescape(&bs, buf + 4, l2);
+    r = hevc_decode_slice_header(st, &bs, type, &pkttype);
+    free(f);
+    if(r < 0)
+      return 1;
+
+    /* Only the first slice segment starts a new picture */
+    if(r > 0 || st->es_curpkt != NULL || st->es_frame_duration == 0)
+      break;
+
+    st->es_curpkt = pkt_alloc(NULL, 0, st->es_curpts, st->es_curdts);
+    st->es_curpkt->pkt_frametype = pkttype;
+    st->es_curpkt->pkt_field = 0;
+    st->es_curpkt->pkt_duration = st->es_frame_duration;
+    st->es_curpkt->pkt_commercial = t->s_tt_commercial_advice;
+    break;
+  }
+
+  if(next_startcode >= 0x000001e0 && next_startcode <= 0x000001ef) {
+    /* Complete frame */
+    if (st->es_incomplete)
+      return 4;
+    th_pkt_t *pkt = st->es_curpkt;
+
+    if(pkt != NULL) {
+
+      if(st->es_global_data) {
+        pkt->pkt_header = pktbuf_make(st->es_global_data,
+                                      st->es_global_data_len);
+        st->es_global_data = NULL;
+        st->es_global_data_len = 0;
+      }
+
+      pkt->pkt_payload = pktbuf_make(st->es_buf.sb_data,
+                                     st->es_buf.sb_ptr - 4);
+      sbuf_steal_data(&st->es_buf);
+      parser_deliver(t, st, pkt, st->es_buf.sb_err);
+
+      st->es_curpkt = NULL;
+
+      st->es_curdts = PTS_UNSET;
+      st->es_curpts = PTS_UNSET;
+    }
+    return 1;
+  }
+
+  return ret;
+}
+
 /**
  * http://broadcasting.ru/pdf-standard-specifications/subtitling/dvb-sub/en300743.v1.2.1.pdf
  */
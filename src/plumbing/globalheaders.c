@@ -90,6 +90,7 @@ apply_header(streaming_start_component_t *ssc, th_pkt_t *pkt)
     break;
 
   case SCT_H264:
+  case SCT_HEVC:
   case SCT_MPEG2VIDEO:
   case SCT_VORBIS:
 
@@ -123,6 +124,7 @@ header_complete(streaming_start_component_t *ssc, int not_so_picky)
   
   if(ssc->ssc_gh == NULL &&
      (ssc->ssc_type == SCT_H264 ||
+      ssc->ssc_type == SCT_HEVC ||
       ssc->ssc_type == SCT_MPEG2VIDEO ||
       ssc->ssc_type == SCT_MP4A ||
       ssc->ssc_type == SCT_AAC ||
@@ -176,6 +178,12 @@ convertpkt(streaming_start_component_t *ssc, th_pkt_t *pkt, int hold)
       pkt_ref_dec(pkt);
     break;
 
+  case SCT_HEVC:
+    r = hevc_convert_pkt(pkt);
+    if (!hold)
+      pkt_ref_dec(pkt);
+    break;
+
   default:
     r = pkt;
     if (hold)
@@ -282,6 +282,7 @@ service_stream_destroy(service_t *t, elementary_stream_t *es)
   }
 
   TAILQ_REMOVE(&t->s_components, es, es_link);
+  t->s_components_gen++;
 
   while ((c = LIST_FIRST(&es->es_caids)) != NULL) {
     LIST_REMOVE(c, link);
@@ -953,6 +954,7 @@ service_stream_create(service_t *t, int pid,
   st->es_type = type;
 
   TAILQ_INSERT_TAIL(&t->s_components, st, es_link);
+  t->s_components_gen++;
   st->es_service = t;
 
   st->es_pid = pid;
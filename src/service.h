@@ -428,6 +428,7 @@ typedef struct service {
   struct elementary_stream_queue s_filt_components;
   int s_last_pid;
   elementary_stream_t *s_last_es;
+  int s_components_gen; ///< Bumped when a component is created/destroyed
 
 
   /**
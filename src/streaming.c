@@ -47,6 +47,25 @@ streaming_target_init(streaming_target_t *st, st_callback_t *cb, void *opaque,
 }
 
 
+/**
+ * Payload size of a data message (0 for control messages)
+ */
+static size_t
+streaming_message_data_size(streaming_message_t *sm)
+{
+  if (sm->sm_type == SMT_PACKET) {
+    th_pkt_t *pkt = sm->sm_data;
+    if (pkt && pkt->pkt_payload)
+      return pkt->pkt_payload->pb_size;
+  } else if (sm->sm_type == SMT_MPEGTS) {
+    pktbuf_t *pkt_payload = sm->sm_data;
+    if (pkt_payload)
+      return pkt_payload->pb_size;
+  }
+  return 0;
+}
+
+
 /**
  *
  */
@@ -54,17 +73,17 @@ static void
 streaming_queue_deliver(void *opauqe, streaming_message_t *sm)
 {
   streaming_queue_t *sq = opauqe;
+  size_t size = streaming_message_data_size(sm);
 
   pthread_mutex_lock(&sq->sq_mutex);
 
-  /* queue size protection */
-  // TODO: would be better to update size as we go, but this would
-  //       require updates elsewhere to ensure all removals from the queue
-  //       are covered (new function)
-  if (sq->sq_maxsize && streaming_queue_size(&sq->sq_queue) >= sq->sq_maxsize)
+  /* queue size protection, control messages are always queued */
+  if (size && sq->sq_maxsize && sq->sq_size >= sq->sq_maxsize) {
     streaming_msg_free(sm);
-  else
+  } else {
     TAILQ_INSERT_TAIL(&sq->sq_queue, sm, sm_link);
+    sq->sq_size += size;
+  }
 
   pthread_cond_signal(&sq->sq_cond);
   pthread_mutex_unlock(&sq->sq_mutex);
@@ -83,6 +102,7 @@ streaming_queue_init2(streaming_queue_t *sq, int reject_filter, size_t maxsize)
   pthread_cond_init(&sq->sq_cond, NULL);
   TAILQ_INIT(&sq->sq_queue);
 
+  sq->sq_size = 0;
   sq->sq_maxsize = maxsize;
 }
 
@@ -103,6 +123,7 @@ void
 streaming_queue_deinit(streaming_queue_t *sq)
 {
   streaming_queue_clear(&sq->sq_queue);
+  sq->sq_size = 0;
   pthread_mutex_destroy(&sq->sq_mutex);
   pthread_cond_destroy(&sq->sq_cond);
 }
@@ -365,32 +386,27 @@ streaming_queue_clear(struct streaming_message_queue *q)
 }
 
 
+/**
+ * Remove a message from the queue, sq_mutex must be held
+ */
+void
+streaming_queue_remove(streaming_queue_t *sq, streaming_message_t *sm)
+{
+  sq->sq_size -= streaming_message_data_size(sm);
+  TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+}
+
+
 /**
  *
  */
 size_t streaming_queue_size(struct streaming_message_queue *q)
 {
   streaming_message_t *sm;
-  int size = 0;
-
-  TAILQ_FOREACH(sm, q, sm_link) {
-    if (sm->sm_type == SMT_PACKET)
-    {
-      th_pkt_t *pkt = sm->sm_data;
-      if (pkt && pkt->pkt_payload)
-      {
-        size += pkt->pkt_payload->pb_size;
-      }
-    }
-    else if (sm->sm_type == SMT_MPEGTS)
-    {
-      pktbuf_t *pkt_payload = sm->sm_data;
-      if (pkt_payload)
-      {
-        size += pkt_payload->pb_size;
-      }
-    }
-  }
+  size_t size = 0;
+
+  TAILQ_FOREACH(sm, q, sm_link)
+    size += streaming_message_data_size(sm);
   return size;
 }
 
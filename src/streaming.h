@@ -79,6 +79,8 @@ void streaming_queue_init2
 
 void streaming_queue_clear(struct streaming_message_queue *q);
 
+void streaming_queue_remove(streaming_queue_t *sq, streaming_message_t *sm);
+
 size_t streaming_queue_size(struct streaming_message_queue *q);
 
 void streaming_queue_deinit(streaming_queue_t *sq);
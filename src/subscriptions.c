@@ -813,6 +813,8 @@ subscription_create_msg(th_subscription_t *s)
   htsmsg_add_u32(m, "id", s->ths_id);
   htsmsg_add_u32(m, "start", s->ths_start);
   htsmsg_add_u32(m, "errors", s->ths_total_err);
+  htsmsg_add_u32(m, "delay", s->ths_queue_delay);
+  htsmsg_add_u32(m, "drops", s->ths_drops);
 
   const char *state;
   switch(s->ths_state) {
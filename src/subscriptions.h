@@ -69,6 +69,8 @@ typedef struct th_subscription {
   int ths_total_err; /* total errors during entire subscription */
   int ths_bytes_in;   // Reset every second to get aprox. bandwidth (in)
   int ths_bytes_out; // Reset every second to get approx bandwidth (out)
+  int ths_queue_delay; // Output queue delay (ms), set by the client side
+  int ths_drops;       // Packets dropped by the output (queue full)
 
   streaming_target_t ths_input;
 
@@ -34,6 +34,10 @@
 
 static int timeshift_index = 0;
 
+static LIST_HEAD(,timeshift_store) timeshift_stores;
+static pthread_mutex_t timeshift_stores_lock = PTHREAD_MUTEX_INITIALIZER;
+int timeshift_store_count;
+
 uint32_t  timeshift_enabled;
 int       timeshift_ondemand;
 char     *timeshift_path;
@@ -41,6 +45,7 @@ int       timeshift_unlimited_period;
 uint32_t  timeshift_max_period;
 int       timeshift_unlimited_size;
 uint64_t  timeshift_max_size;
+uint64_t  timeshift_ram_size;
 
 /*
  * Intialise global file manager
@@ -61,6 +66,7 @@ void timeshift_init ( void )
   timeshift_max_period       = 3600;                    // 1Hr
   timeshift_unlimited_size   = 0;
   timeshift_max_size         = 10000 * (size_t)1048576; // 10G
+  timeshift_ram_size         = 0;                       // Disk only
 
   /* Load settings */
   if ((m = hts_settings_load("timeshift/config"))) {
@@ -77,6 +83,8 @@ void timeshift_init ( void )
       timeshift_unlimited_size = u32 ? 1 : 0;
     if (!htsmsg_get_u32(m, "max_size", &u32))
       timeshift_max_size = 1048576LL * u32;
+    if (!htsmsg_get_u32(m, "ram_size", &u32))
+      timeshift_ram_size = 1048576LL * u32;
     htsmsg_destroy(m);
   }
 }
@@ -107,10 +115,316 @@ void timeshift_save ( void )
   htsmsg_add_u32(m, "max_period", timeshift_max_period);
   htsmsg_add_u32(m, "unlimited_size", timeshift_unlimited_size);
   htsmsg_add_u32(m, "max_size", timeshift_max_size / 1048576);
+  htsmsg_add_u32(m, "ram_size", timeshift_ram_size / 1048576);
 
   hts_settings_save(m, "timeshift/config");
 }
 
+/* **************************************************************************
+ * Buffer store
+ * *************************************************************************/
+
+static void timeshift_store_known ( timeshift_t *ts, int64_t offset )
+{
+  ts->ts_offset = offset;
+  ts->ts_known  = 1;
+  if (ts->match_pb) {
+    pktbuf_ref_dec(ts->match_pb);
+    ts->match_pb = NULL;
+  }
+  tvhlog(LOG_DEBUG, "timeshift", "ts %d buffer offset %"PRId64,
+         ts->id, offset);
+}
+
+/*
+ * Line up timelines
+ *
+ * tsfix rebases the timestamps of every subscription to its own start, so
+ * the same packet carries different timestamps in each timeshift sharing a
+ * store. The payload buffer is shared by all of them though, which lets us
+ * work out the exact offset to the buffer timeline.
+ */
+static void timeshift_store_match
+  ( timeshift_store_t *tss, timeshift_t *ts, th_pkt_t *pkt )
+{
+  timeshift_match_t *m;
+  timeshift_t *t;
+  int i;
+
+  /* Feeder: remember what went into the buffer */
+  if (tss->feeder == ts) {
+    m = &tss->match[tss->match_idx];
+    tss->match_idx = (tss->match_idx + 1) % TIMESHIFT_MATCH_PKTS;
+    if (m->pb)
+      pktbuf_ref_dec(m->pb);
+    pktbuf_ref_inc(pkt->pkt_payload);
+    m->pb   = pkt->pkt_payload;
+    m->dts  = pkt->pkt_dts - ts->ts_offset;
+    m->time = getmonoclock();
+
+    /* Members that got this packet before us */
+    LIST_FOREACH(t, &tss->members, store_link)
+      if (!t->ts_known && t->match_pb == m->pb)
+        timeshift_store_known(t, t->match_dts - m->dts);
+    return;
+  }
+
+  if (ts->ts_known)
+    return;
+
+  for (i = 0; i < TIMESHIFT_MATCH_PKTS; i++) {
+    m = &tss->match[i];
+    if (m->pb && m->pb == pkt->pkt_payload) {
+      timeshift_store_known(ts, pkt->pkt_dts - m->dts);
+      return;
+    }
+  }
+
+  /* Not written yet, the feeder will pick it up */
+  if (ts->match_pb)
+    pktbuf_ref_dec(ts->match_pb);
+  pktbuf_ref_inc(pkt->pkt_payload);
+  ts->match_pb  = pkt->pkt_payload;
+  ts->match_dts = pkt->pkt_dts;
+}
+
+/*
+ * Take over writing the buffer
+ */
+static void timeshift_store_takeover
+  ( timeshift_store_t *tss, timeshift_t *ts, th_pkt_t *pkt )
+{
+  timeshift_match_t *m;
+
+  /* Never lined up, estimate from the last packet written */
+  if (!ts->ts_known) {
+    m = &tss->match[(tss->match_idx + TIMESHIFT_MATCH_PKTS - 1) %
+                    TIMESHIFT_MATCH_PKTS];
+    if (m->pb)
+      timeshift_store_known(ts, pkt->pkt_dts - m->dts -
+                                (getmonoclock() - m->time) * 9 / 100);
+    else
+      timeshift_store_known(ts, 0);
+  }
+  tvhlog(LOG_DEBUG, "timeshift", "ts %d now writing buffer of ts %d",
+         ts->id, tss->id);
+  tss->feeder = ts;
+}
+
+/*
+ * Pass stream data to the store (only the feeder actually writes)
+ */
+static void timeshift_store_input
+  ( timeshift_t *ts, streaming_message_t *sm )
+{
+  timeshift_store_t *tss = ts->store;
+  th_pkt_t *pkt = NULL;
+
+  if (sm->sm_type == SMT_PACKET) {
+    pkt = sm->sm_data;
+    if (!pkt->pkt_payload || pkt->pkt_dts == PTS_UNSET)
+      pkt = NULL;
+  } else if (sm->sm_type != SMT_START &&
+             sm->sm_type != SMT_MPEGTS &&
+             sm->sm_type != SMT_SIGNAL_STATUS) {
+    streaming_msg_free(sm);
+    return;
+  }
+
+  pthread_mutex_lock(&tss->feed_mutex);
+  if (!tss->feeder && (ts->ts_known || pkt))
+    timeshift_store_takeover(tss, ts, pkt);
+  if (pkt)
+    timeshift_store_match(tss, ts, pkt);
+  if (tss->feeder == ts) {
+
+    /* What the buffer holds, for subscriptions looking to share it */
+    if (sm->sm_type == SMT_START) {
+      if (tss->ss)
+        streaming_start_unref(tss->ss);
+      tss->ss = sm->sm_data;
+      atomic_add(&tss->ss->ss_refcount, 1);
+    }
+
+    /* Write in buffer timeline */
+    if (sm->sm_type == SMT_PACKET && ts->ts_offset) {
+      streaming_message_t *sm2;
+      pkt = pkt_copy_shallow(sm->sm_data);
+      if (pkt->pkt_dts != PTS_UNSET)
+        pkt->pkt_dts -= ts->ts_offset;
+      if (pkt->pkt_pts != PTS_UNSET)
+        pkt->pkt_pts -= ts->ts_offset;
+      sm2 = streaming_msg_create_pkt(pkt);
+      pkt_ref_dec(pkt);
+      sm2->sm_time = sm->sm_time;
+      streaming_msg_free(sm);
+      sm = sm2;
+    }
+    streaming_target_deliver2(&tss->wr_queue.sq_st, sm);
+    sm = NULL;
+  }
+  pthread_mutex_unlock(&tss->feed_mutex);
+
+  if (sm)
+    streaming_msg_free(sm);
+}
+
+/*
+ * Same service (and component layout) as in the buffer
+ *
+ * Subscriptions on one channel can run on different services (another
+ * mux or tuner), their packets would never line up with the buffer.
+ */
+static int timeshift_store_same
+  ( const streaming_start_t *a, const streaming_start_t *b )
+{
+  const streaming_start_component_t *ca, *cb;
+  int i;
+
+  if (a->ss_service_id     != b->ss_service_id ||
+      a->ss_pmt_pid        != b->ss_pmt_pid ||
+      a->ss_pcr_pid        != b->ss_pcr_pid ||
+      a->ss_num_components != b->ss_num_components ||
+      strcmp(a->ss_si.si_adapter ?: "", b->ss_si.si_adapter ?: "") ||
+      strcmp(a->ss_si.si_network ?: "", b->ss_si.si_network ?: "") ||
+      strcmp(a->ss_si.si_mux ?: "", b->ss_si.si_mux ?: ""))
+    return 0;
+  for (i = 0; i < a->ss_num_components; i++) {
+    ca = &a->ss_components[i];
+    cb = &b->ss_components[i];
+    if (ca->ssc_index != cb->ssc_index ||
+        ca->ssc_type  != cb->ssc_type ||
+        ca->ssc_pid   != cb->ssc_pid)
+      return 0;
+  }
+  return 1;
+}
+
+/*
+ * Attach to a store of the channel fed from the same service (or create
+ * a new one), called on the first SMT_START
+ */
+static timeshift_store_t *timeshift_store_attach
+  ( timeshift_t *ts, void *key, time_t max_time, streaming_start_t *ss )
+{
+  timeshift_store_t *tss = NULL;
+  int same;
+
+  pthread_mutex_lock(&timeshift_stores_lock);
+  if (key)
+    LIST_FOREACH(tss, &timeshift_stores, link) {
+      if (tss->key != key)
+        continue;
+      pthread_mutex_lock(&tss->feed_mutex);
+      same = tss->ss && timeshift_store_same(tss->ss, ss);
+      pthread_mutex_unlock(&tss->feed_mutex);
+      if (same)
+        break;
+    }
+
+  if (!tss) {
+    tss = calloc(1, sizeof(timeshift_store_t));
+    tss->ss       = ss;
+    atomic_add(&ss->ss_refcount, 1);
+    tss->key      = key;
+    tss->id       = ts->id;
+    tss->max_time = max_time;
+    tss->vididx   = -1;
+    TAILQ_INIT(&tss->files);
+    LIST_INIT(&tss->members);
+    pthread_mutex_init(&tss->rdwr_mutex, NULL);
+    pthread_mutex_init(&tss->feed_mutex, NULL);
+    streaming_queue_init(&tss->wr_queue, 0);
+    tvhthread_create(&tss->wr_thread, NULL, timeshift_writer, tss);
+    if (key)
+      LIST_INSERT_HEAD(&timeshift_stores, tss, link);
+    atomic_add(&timeshift_store_count, 1);
+    tss->feeder  = ts;
+    ts->ts_known = 1;
+  } else {
+    /* The data already buffered belongs to the other subscriptions */
+    ts->join_time = getmonoclock();
+    tvhlog(LOG_DEBUG, "timeshift", "ts %d share buffer of ts %d",
+           ts->id, tss->id);
+  }
+
+  pthread_mutex_lock(&tss->feed_mutex);
+  LIST_INSERT_HEAD(&tss->members, ts, store_link);
+  pthread_mutex_unlock(&tss->feed_mutex);
+
+  /* Keep the longest period (0 = unlimited) */
+  pthread_mutex_lock(&tss->rdwr_mutex);
+  if (!max_time || (tss->max_time && max_time > tss->max_time))
+    tss->max_time = max_time;
+  tss->refcount++;
+  pthread_mutex_unlock(&tss->rdwr_mutex);
+  pthread_mutex_unlock(&timeshift_stores_lock);
+
+  return tss;
+}
+
+/*
+ * Detach from the store (the last one out removes it)
+ */
+static void timeshift_store_detach ( timeshift_t *ts )
+{
+  timeshift_store_t *tss = ts->store;
+  timeshift_t *t;
+  int i;
+
+  /* Never started */
+  if (!tss)
+    return;
+
+  pthread_mutex_lock(&tss->feed_mutex);
+  LIST_REMOVE(ts, store_link);
+  if (tss->feeder == ts) {
+    tss->feeder = NULL;
+    LIST_FOREACH(t, &tss->members, store_link)
+      if (t->ts_known) {
+        timeshift_store_takeover(tss, t, NULL);
+        break;
+      }
+  }
+  if (ts->match_pb)
+    pktbuf_ref_dec(ts->match_pb);
+  pthread_mutex_unlock(&tss->feed_mutex);
+
+  pthread_mutex_lock(&timeshift_stores_lock);
+  pthread_mutex_lock(&tss->rdwr_mutex);
+  i = --tss->refcount;
+  pthread_mutex_unlock(&tss->rdwr_mutex);
+  if (!i && tss->key)
+    LIST_REMOVE(tss, link);
+  pthread_mutex_unlock(&timeshift_stores_lock);
+  if (i)
+    return;
+
+  atomic_add(&timeshift_store_count, -1);
+
+  /* Stop the writer */
+  streaming_target_deliver2(&tss->wr_queue.sq_st,
+                            streaming_msg_create(SMT_EXIT));
+  pthread_join(tss->wr_thread, NULL);
+  streaming_queue_deinit(&tss->wr_queue);
+
+  /* Flush files */
+  timeshift_filemgr_flush(tss, NULL);
+
+  for (i = 0; i < TIMESHIFT_MATCH_PKTS; i++)
+    if (tss->match[i].pb)
+      pktbuf_ref_dec(tss->match[i].pb);
+  if (tss->ss)
+    streaming_start_unref(tss->ss);
+  free(tss->iframes);
+  free(tss->path);
+  free(tss);
+}
+
+/* **************************************************************************
+ * Timeshift
+ * *************************************************************************/
+
 /*
  * Receive data
  */
@@ -137,6 +451,9 @@ static void timeshift_input
     /* Start */
     if (sm->sm_type == SMT_START && ts->state == TS_INIT) {
       ts->state  = TS_LIVE;
+      if (!ts->store)
+        ts->store = timeshift_store_attach(ts, ts->store_key, ts->max_time,
+                                           sm->sm_data);
     }
 
     if (sm->sm_type == SMT_PACKET) {
@@ -189,7 +506,7 @@ static void timeshift_input
                  pkt->pkt_duration,
                  pktbuf_len(pkt->pkt_payload));
       }
-      streaming_target_deliver2(&ts->wr_queue.sq_st, sm);
+      timeshift_store_input(ts, sm);
     } else
       streaming_msg_free(sm);
 
@@ -210,39 +527,29 @@ void
 timeshift_destroy(streaming_target_t *pad)
 {
   timeshift_t *ts = (timeshift_t*)pad;
-  streaming_message_t *sm;
 
   /* Must hold global lock */
   lock_assert(&global_lock);
 
-  /* Ensure the threads exits */
-  // Note: this is a workaround for the fact the Q might have been flushed
-  //       in reader thread (VERY unlikely)
+  /* Ensure the reader exits */
   pthread_mutex_lock(&ts->state_mutex);
-  sm = streaming_msg_create(SMT_EXIT);
-  streaming_target_deliver2(&ts->wr_queue.sq_st, sm);
   timeshift_write_exit(ts->rd_pipe.wr);
   pthread_mutex_unlock(&ts->state_mutex);
 
-  /* Wait for all threads */
+  /* Wait for the reader */
   pthread_join(ts->rd_thread, NULL);
-  pthread_join(ts->wr_thread, NULL);
 
   /* Shut stuff down */
-  streaming_queue_deinit(&ts->wr_queue);
-
   close(ts->rd_pipe.rd);
   close(ts->rd_pipe.wr);
 
-  /* Flush files */
-  timeshift_filemgr_flush(ts, NULL);
+  /* Release buffer (writer and files go with the last user) */
+  timeshift_store_detach(ts);
 
   /* Release SMT_START index */
   if (ts->smt_start)
     streaming_start_unref(ts->smt_start);
 
-  if (ts->path)
-    free(ts->path);
   free(ts);
 }
 
@@ -251,9 +558,10 @@ timeshift_destroy(streaming_target_t *pad)
  *
  * max_period of buffer in seconds (0 = unlimited)
  * max_size   of buffer in bytes   (0 = unlimited)
+ * ch         channel to share the buffer on (NULL = private buffer)
  */
 streaming_target_t *timeshift_create
-  (streaming_target_t *out, time_t max_time)
+  (streaming_target_t *out, time_t max_time, struct channel *ch)
 {
   timeshift_t *ts = calloc(1, sizeof(timeshift_t));
 
@@ -261,26 +569,23 @@ streaming_target_t *timeshift_create
   lock_assert(&global_lock);
 
   /* Setup structure */
-  TAILQ_INIT(&ts->files);
   ts->output     = out;
-  ts->path       = NULL;
-  ts->max_time   = max_time;
   ts->state      = TS_INIT;
-  ts->full       = 0;
-  ts->vididx     = -1;
   ts->id         = timeshift_index;
   ts->ondemand   = timeshift_ondemand;
   ts->pts_delta  = PTS_UNSET;
-  pthread_mutex_init(&ts->rdwr_mutex, NULL);
   pthread_mutex_init(&ts->state_mutex, NULL);
 
+  /* On-demand buffers are trimmed by their reader, never share them
+   * (the store is picked once the service is known, on SMT_START) */
+  ts->store_key  = ts->ondemand ? NULL : ch;
+  ts->max_time   = max_time;
+
   /* Initialise output */
   tvh_pipe(O_NONBLOCK, &ts->rd_pipe);
 
   /* Initialise input */
-  streaming_queue_init(&ts->wr_queue, 0);
   streaming_target_init(&ts->input, timeshift_input, ts, 0);
-  tvhthread_create(&ts->wr_thread, NULL, timeshift_writer, ts);
   tvhthread_create(&ts->rd_thread, NULL, timeshift_reader, ts);
 
   /* Update index */
@@ -26,7 +26,9 @@ extern int       timeshift_unlimited_period;
 extern uint32_t  timeshift_max_period;
 extern int       timeshift_unlimited_size;
 extern uint64_t  timeshift_max_size;
+extern uint64_t  timeshift_ram_size;
 extern uint64_t  timeshift_total_size;
+extern uint64_t  timeshift_total_ram_size;
 
 typedef struct timeshift_status
 {
@@ -40,8 +42,10 @@ void timeshift_init ( void );
 void timeshift_term ( void );
 void timeshift_save ( void );
 
+struct channel;
+
 streaming_target_t *timeshift_create
-  (streaming_target_t *out, time_t max_period);
+  (streaming_target_t *out, time_t max_period, struct channel *ch);
 
 void timeshift_destroy(streaming_target_t *pad);
 
@@ -21,6 +21,12 @@
 
 #define TIMESHIFT_PLAY_BUF     200000 // us to buffer in TX
 #define TIMESHIFT_FILE_PERIOD      60 // number of secs in each buffer file
+#define TIMESHIFT_WBUF_SIZE    262144 // bytes held back before writing out
+#define TIMESHIFT_WBUF_PERIOD 1000000 // us before held back data is written
+#define TIMESHIFT_RBUF_SIZE    262144 // bytes read ahead from buffer files
+#define TIMESHIFT_MATCH_PKTS       64 // written packets kept for timeline matching
+
+struct timeshift_file;
 
 /**
  * Indexes of import data in the stream
@@ -29,11 +35,9 @@ typedef struct timeshift_index_iframe
 {
   off_t                               pos;    ///< Position in the file
   int64_t                             time;   ///< Packet time
-  TAILQ_ENTRY(timeshift_index_iframe) link;   ///< List entry
+  struct timeshift_file               *file;  ///< File containing it
 } timeshift_index_iframe_t;
 
-typedef TAILQ_HEAD(timeshift_index_iframe_list,timeshift_index_iframe) timeshift_index_iframe_list_t;
-
 /**
  * Indexes of import data in the stream
  */
@@ -46,8 +50,22 @@ typedef struct timeshift_index_data
 
 typedef TAILQ_HEAD(timeshift_index_data_list,timeshift_index_data) timeshift_index_data_list_t;
 
+/**
+ * Message held in memory (RAM tier)
+ */
+typedef struct timeshift_ram
+{
+  off_t                         pos;      ///< Position in the (logical) file
+  size_t                        len;      ///< Record length once written
+  streaming_message_t           *sm;      ///< Message (referenced)
+} timeshift_ram_t;
+
 /**
  * Timeshift file
+ *
+ * Files start out in memory when a RAM budget is configured: messages are
+ * referenced rather than serialized, at the offsets they would have in the
+ * file. They are written out (spilled) when the budget is exceeded.
  */
 typedef struct timeshift_file
 {
@@ -60,9 +78,18 @@ typedef struct timeshift_file
 
   uint8_t                       bad;      ///< File is broken
 
+  uint8_t                       ram;      ///< Held in memory
+  uint8_t                       ram_eof;  ///< Closed (in memory)
+  timeshift_ram_t               *rams;    ///< Messages (in memory)
+  int                           ram_count;///< Number of messages
+  int                           ram_alloc;///< Allocated messages
+
+  uint8_t                       *wbuf;    ///< Pending (unwritten) data
+  size_t                        wbuf_len; ///< Pending data length
+  int64_t                       wbuf_time;///< Time of oldest pending data
+
   int                           refcount; ///< Reader ref count
 
-  timeshift_index_iframe_list_t iframes;  ///< I-frame indexing
   timeshift_index_data_list_t   sstart;   ///< Stream start messages
 
   TAILQ_ENTRY(timeshift_file) link;     ///< List entry
@@ -70,6 +97,55 @@ typedef struct timeshift_file
 
 typedef TAILQ_HEAD(timeshift_file_list,timeshift_file) timeshift_file_list_t;
 
+/**
+ * Recently written packet (used to line up subscriber timelines)
+ */
+typedef struct timeshift_match
+{
+  pktbuf_t                    *pb;        ///< Payload (referenced)
+  int64_t                     dts;        ///< DTS in buffer timeline
+  int64_t                     time;       ///< Time written
+} timeshift_match_t;
+
+/**
+ * Buffer store
+ *
+ * Permanent timeshifts on the same channel, running on the same service,
+ * share a single store: the files are written once (by the current
+ * feeder) and each timeshift only keeps its own reader position.
+ */
+typedef struct timeshift_store {
+  void                        *key;       ///< Channel (NULL = private)
+  int                         id;         ///< Reference number
+  int                         refcount;   ///< Attached timeshifts
+  char                        *path;      ///< Directory containing buffer
+  time_t                      max_time;   ///< Maximum period to shift
+  uint8_t                     full;       ///< Buffer is full
+  int                         vididx;     ///< Index of (current) video stream
+
+  streaming_queue_t           wr_queue;   ///< Writer queue
+  pthread_t                   wr_thread;  ///< Writer thread
+
+  pthread_mutex_t             rdwr_mutex; ///< Buffer protection
+  timeshift_file_list_t       files;      ///< List of files
+  uint64_t                    ram_size;   ///< Bytes held in memory
+  struct timeshift_file       *spill;     ///< File being written out
+  uint8_t                     spill_removed;///< ... and removed meanwhile
+  timeshift_index_iframe_t    *iframes;   ///< I-frames (all files, by time)
+  int                         iframe_first;///< First valid I-frame
+  int                         iframe_count;///< I-frames (incl. removed)
+  int                         iframe_alloc;///< Allocated I-frames
+
+  pthread_mutex_t             feed_mutex; ///< Protect feeder/members/match
+  struct timeshift            *feeder;    ///< Timeshift writing the buffer
+  streaming_start_t           *ss;        ///< Latest start of the feeder
+  LIST_HEAD(,timeshift)       members;    ///< Attached timeshifts
+  timeshift_match_t           match[TIMESHIFT_MATCH_PKTS];
+  int                         match_idx;  ///< Next match slot
+
+  LIST_ENTRY(timeshift_store) link;       ///< Shared stores
+} timeshift_store_t;
+
 /**
  *
  */
@@ -79,11 +155,19 @@ typedef struct timeshift {
   streaming_target_t          *output;    ///< Output dest
 
   int                         id;         ///< Reference number
-  char                        *path;      ///< Directory containing buffer
-  time_t                      max_time;   ///< Maximum period to shift
   int                         ondemand;   ///< Whether this is an on-demand timeshift
   int64_t                     pts_delta;  ///< Delta between system clock and PTS
 
+  timeshift_store_t           *store;     ///< Buffer store (set on start)
+  void                        *store_key; ///< Channel to share on (or NULL)
+  time_t                      max_time;   ///< Maximum period to shift
+  LIST_ENTRY(timeshift)       store_link; ///< Store members
+  int64_t                     ts_offset;  ///< Own timestamps - buffer timestamps
+  uint8_t                     ts_known;   ///< Offset is valid
+  int64_t                     join_time;  ///< Buffer time at attach (no rewind before it)
+  pktbuf_t                    *match_pb;  ///< Last payload (offset unknown)
+  int64_t                     match_dts;  ///< Last DTS (offset unknown)
+
   enum {
     TS_INIT,
     TS_EXIT,
@@ -92,37 +176,41 @@ typedef struct timeshift {
     TS_PLAY,
   }                           state;       ///< Play state
   pthread_mutex_t             state_mutex; ///< Protect state changes
-  uint8_t                     full;        ///< Buffer is full
   
   streaming_start_t          *smt_start;   ///< Current stream makeup
 
-  streaming_queue_t           wr_queue;   ///< Writer queue
-  pthread_t                   wr_thread;  ///< Writer thread
-
   pthread_t                   rd_thread;  ///< Reader thread
   th_pipe_t                   rd_pipe;    ///< Message passing to reader
 
-  pthread_mutex_t             rdwr_mutex; ///< Buffer protection
-  timeshift_file_list_t       files;      ///< List of files
-
-  int                         vididx;     ///< Index of (current) video stream
-
 } timeshift_t;
 
 /*
  * Write functions
  */
 ssize_t timeshift_write_start   ( int fd, int64_t time, streaming_start_t *ss );
-ssize_t timeshift_write_sigstat ( int fd, int64_t time, signal_status_t *ss );
-ssize_t timeshift_write_packet  ( int fd, int64_t time, th_pkt_t *pkt );
-ssize_t timeshift_write_mpegts  ( int fd, int64_t time, void *data );
+ssize_t timeshift_write_sigstat
+  ( timeshift_file_t *tsf, int64_t time, signal_status_t *ss );
+ssize_t timeshift_write_packet
+  ( timeshift_file_t *tsf, int64_t time, th_pkt_t *pkt );
+ssize_t timeshift_write_mpegts
+  ( timeshift_file_t *tsf, int64_t time, void *data );
 ssize_t timeshift_write_skip    ( int fd, streaming_skip_t *skip );
 ssize_t timeshift_write_speed   ( int fd, int speed );
 ssize_t timeshift_write_stop    ( int fd, int code );
 ssize_t timeshift_write_exit    ( int fd );
-ssize_t timeshift_write_eof     ( int fd );
+ssize_t timeshift_write_eof     ( timeshift_file_t *tsf );
+int     timeshift_write_sync    ( timeshift_file_t *tsf );
+int     timeshift_write_spill
+  ( timeshift_ram_t *rams, int count, const char *path );
+int     timeshift_write_spill_done
+  ( timeshift_file_t *tsf, int fd, int count );
+
+void timeshift_writer_flush ( timeshift_store_t *tss );
 
-void timeshift_writer_flush ( timeshift_t *ts );
+/*
+ * Number of the active stores (they share the memory budget)
+ */
+extern int timeshift_store_count;
 
 /*
  * Threads
@@ -135,21 +223,44 @@ void *timeshift_writer ( void *p );
  */
 void timeshift_filemgr_init     ( void );
 void timeshift_filemgr_term     ( void );
-int  timeshift_filemgr_makedirs ( int ts_index, char *buf, size_t len );
+int  timeshift_filemgr_makedirs
+  ( int ts_index, char *buf, size_t len, int create );
 
 timeshift_file_t *timeshift_filemgr_get
-  ( timeshift_t *ts, int create );
+  ( timeshift_store_t *tss, int create );
 timeshift_file_t *timeshift_filemgr_oldest
-  ( timeshift_t *ts );
+  ( timeshift_store_t *tss );
 timeshift_file_t *timeshift_filemgr_newest
-  ( timeshift_t *ts );
+  ( timeshift_store_t *tss );
 timeshift_file_t *timeshift_filemgr_prev
   ( timeshift_file_t *ts, int *end, int keep );
 timeshift_file_t *timeshift_filemgr_next
   ( timeshift_file_t *ts, int *end, int keep );
 void timeshift_filemgr_remove
-  ( timeshift_t *ts, timeshift_file_t *tsf, int force );
-void timeshift_filemgr_flush ( timeshift_t *ts, timeshift_file_t *end );
-void timeshift_filemgr_close ( timeshift_file_t *tsf );
+  ( timeshift_store_t *tss, timeshift_file_t *tsf, int force );
+void timeshift_filemgr_flush ( timeshift_store_t *tss, timeshift_file_t *end );
+void timeshift_filemgr_close ( timeshift_store_t *tss, timeshift_file_t *tsf );
+void timeshift_filemgr_spill ( timeshift_store_t *tss );
+ssize_t timeshift_filemgr_ram_read
+  ( timeshift_file_t *tsf, off_t pos, streaming_message_t **sm );
+void timeshift_filemgr_ram_free ( timeshift_file_t *tsf );
+
+void timeshift_filemgr_index_add
+  ( timeshift_store_t *tss, timeshift_file_t *tsf, int64_t time );
+int  timeshift_filemgr_index_find
+  ( timeshift_store_t *tss, int64_t time, int back,
+    timeshift_index_iframe_t *ti );
+timeshift_index_iframe_t *timeshift_filemgr_index_first
+  ( timeshift_store_t *tss, int64_t time );
+timeshift_index_iframe_t *timeshift_filemgr_index_last
+  ( timeshift_store_t *tss );
+
+/*
+ * File is still being written
+ */
+static inline int timeshift_file_open ( timeshift_file_t *tsf )
+{
+  return tsf->fd != -1 || (tsf->ram && !tsf->ram_eof);
+}
 
 #endif /* __TVH_TIMESHIFT_PRIVATE_H__ */
@@ -39,6 +39,7 @@ static pthread_mutex_t       timeshift_reaper_lock;
 static pthread_cond_t        timeshift_reaper_cond;
 
 uint64_t                     timeshift_total_size;
+uint64_t                     timeshift_total_ram_size;
 
 /* **************************************************************************
  * File reaper thread
@@ -48,7 +49,6 @@ static void* timeshift_reaper_callback ( void *p )
 {
   char *dpath;
   timeshift_file_t *tsf;
-  timeshift_index_iframe_t *ti;
   timeshift_index_data_t *tid;
   streaming_message_t *sm;
   pthread_mutex_lock(&timeshift_reaper_lock);
@@ -66,24 +66,23 @@ static void* timeshift_reaper_callback ( void *p )
     tvhtrace("timeshift", "remove file %s", tsf->path);
 
     /* Remove */
-    unlink(tsf->path);
+    if (!tsf->ram)
+      unlink(tsf->path);
     dpath = dirname(tsf->path);
     if (rmdir(dpath) == -1)
-      if (errno != ENOTEMPTY)
+      if (errno != ENOTEMPTY && errno != ENOENT)
         tvhlog(LOG_ERR, "timeshift", "failed to remove %s [e=%s]",
                dpath, strerror(errno));
 
     /* Free memory */
-    while ((ti = TAILQ_FIRST(&tsf->iframes))) {
-      TAILQ_REMOVE(&tsf->iframes, ti, link);
-      free(ti);
-    }
     while ((tid = TAILQ_FIRST(&tsf->sstart))) {
       TAILQ_REMOVE(&tsf->sstart, tid, link);
       sm = tid->data;
       streaming_msg_free(sm);
       free(tid);
     }
+    timeshift_filemgr_ram_free(tsf);
+    free(tsf->wbuf);
     free(tsf->path);
     free(tsf);
 
@@ -126,26 +125,38 @@ timeshift_filemgr_get_root ( char *buf, size_t len )
 
 /*
  * Create timeshift directories (for a given instance)
+ *
+ * With create unset, only the path is returned.
  */
-int timeshift_filemgr_makedirs ( int index, char *buf, size_t len )
+int timeshift_filemgr_makedirs ( int index, char *buf, size_t len, int create )
 {
   if (timeshift_filemgr_get_root(buf, len))
     return 1;
   snprintf(buf+strlen(buf), len-strlen(buf), "/%d", index);
-  return makedirs(buf, 0700);
+  return create ? makedirs(buf, 0700) : 0;
 }
 
 /*
  * Close file
  */
-void timeshift_filemgr_close ( timeshift_file_t *tsf )
+void timeshift_filemgr_close ( timeshift_store_t *tss, timeshift_file_t *tsf )
 {
-  ssize_t r = timeshift_write_eof(tsf->fd);
+  ssize_t r = timeshift_write_eof(tsf);
   if (r > 0)
   {
     tsf->size += r;
-    atomic_add_u64(&timeshift_total_size, r);
+    if (tsf->ram)
+      tss->ram_size += r;
+    atomic_add_u64(tsf->ram ? &timeshift_total_ram_size :
+                              &timeshift_total_size, r);
   }
+  if (tsf->ram) {
+    tsf->ram_eof = 1;
+    return;
+  }
+  timeshift_write_sync(tsf);
+  free(tsf->wbuf);
+  tsf->wbuf = NULL;
   close(tsf->fd);
   tsf->fd = -1;
 }
@@ -154,34 +165,279 @@ void timeshift_filemgr_close ( timeshift_file_t *tsf )
  * Remove file
  */
 void timeshift_filemgr_remove
-  ( timeshift_t *ts, timeshift_file_t *tsf, int force )
+  ( timeshift_store_t *tss, timeshift_file_t *tsf, int force )
 {
   if (tsf->fd != -1)
     close(tsf->fd);
-  tvhlog(LOG_DEBUG, "timeshift", "ts %d remove %s", ts->id, tsf->path);
-  TAILQ_REMOVE(&ts->files, tsf, link);
-  atomic_add_u64(&timeshift_total_size, -tsf->size);
+  tvhlog(LOG_DEBUG, "timeshift", "ts %d remove %s", tss->id, tsf->path);
+  TAILQ_REMOVE(&tss->files, tsf, link);
+  while (tss->iframe_first < tss->iframe_count &&
+         tss->iframes[tss->iframe_first].file == tsf)
+    tss->iframe_first++;
+  if (tsf->ram) {
+    tss->ram_size -= tsf->size;
+    atomic_add_u64(&timeshift_total_ram_size, -tsf->size);
+  } else {
+    atomic_add_u64(&timeshift_total_size, -tsf->size);
+  }
+  /* Being written out, the spill hands it to the reaper when done */
+  if (tss->spill == tsf) {
+    tss->spill_removed = 1;
+    return;
+  }
   timeshift_reaper_remove(tsf);
 }
 
+/*
+ * Write out the oldest files held in memory until back within budget
+ * (rdwr_mutex held)
+ *
+ * Each store gets an equal share of the memory budget, so a busy store
+ * spills its own files instead of pushing the others to the disk.
+ * Files held in memory are always the newest ones of a store.
+ *
+ * The mutex is dropped while a file is written, readers keep reading it
+ * from memory until it is switched over to the disk. The records written
+ * are a referenced copy, as the reader thread may add more meanwhile
+ * (timeshift_writer_flush()).
+ */
+void timeshift_filemgr_spill ( timeshift_store_t *tss )
+{
+  timeshift_file_t *tsf, *prev;
+  timeshift_ram_t *rams;
+  uint64_t share;
+  char *path;
+  int i, count, fd;
+
+  /* Already in progress (on the other thread) */
+  if (tss->spill)
+    return;
+
+  share = timeshift_ram_size / MAX(1, atomic_get(&timeshift_store_count));
+  while (tss->ram_size > share) {
+    tsf = TAILQ_LAST(&tss->files, timeshift_file_list);
+    if (!tsf || !tsf->ram)
+      break;
+    while ((prev = TAILQ_PREV(tsf, timeshift_file_list, link)) && prev->ram)
+      tsf = prev;
+    tvhtrace("timeshift", "ts %d spill file %s (%zu bytes)",
+             tss->id, tsf->path, tsf->size);
+
+    count = tsf->ram_count;
+    rams  = malloc(count * sizeof(*rams));
+    for (i = 0; i < count; i++) {
+      rams[i]    = tsf->rams[i];
+      rams[i].sm = streaming_msg_clone(tsf->rams[i].sm);
+    }
+    path  = strdup(tsf->path);
+    tss->spill = tsf;
+    tss->spill_removed = 0;
+    pthread_mutex_unlock(&tss->rdwr_mutex);
+    fd = timeshift_write_spill(rams, count, path);
+    for (i = 0; i < count; i++)
+      streaming_msg_free(rams[i].sm);
+    free(rams);
+    free(path);
+    pthread_mutex_lock(&tss->rdwr_mutex);
+    tss->spill = NULL;
+
+    /* Removed meanwhile (and accounted for), let the reaper finish it */
+    if (tss->spill_removed) {
+      if (fd >= 0) {
+        close(fd);
+        tsf->ram = 0;
+      }
+      timeshift_reaper_remove(tsf);
+      continue;
+    }
+
+    if (fd < 0 || timeshift_write_spill_done(tsf, fd, count)) {
+      tsf->bad  = 1;
+      tss->full = 1; ///< Stop any more writing
+    }
+    if (!tsf->ram) {
+      tss->ram_size -= tsf->size;
+      atomic_add_u64(&timeshift_total_ram_size, -tsf->size);
+      atomic_add_u64(&timeshift_total_size, tsf->size);
+    }
+    if (tss->full)
+      break;
+  }
+}
+
+/*
+ * Read message at pos from a file held in memory (rdwr_mutex held)
+ *
+ * Returns the record length (as stored on disk), 0 if not written yet
+ * or -1 on error.
+ */
+ssize_t timeshift_filemgr_ram_read
+  ( timeshift_file_t *tsf, off_t pos, streaming_message_t **sm )
+{
+  int lo = 0, hi = tsf->ram_count - 1, mid;
+  timeshift_ram_t *r;
+  th_pkt_t *pkt;
+
+  *sm = NULL;
+
+  /* End of file */
+  if (tsf->ram_eof && pos == tsf->size - sizeof(size_t))
+    return sizeof(size_t);
+
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    r   = &tsf->rams[mid];
+    if (r->pos < pos)
+      lo = mid + 1;
+    else if (r->pos > pos)
+      hi = mid - 1;
+    else {
+      /* Readers adjust timestamps, hand out a copy */
+      if (r->sm->sm_type == SMT_PACKET) {
+        pkt = pkt_copy_shallow(r->sm->sm_data);
+        *sm = streaming_msg_create_pkt(pkt);
+        (*sm)->sm_time = r->sm->sm_time;
+        pkt_ref_dec(pkt);
+      } else {
+        *sm = streaming_msg_clone(r->sm);
+      }
+      return r->len;
+    }
+  }
+  return pos >= tsf->size ? 0 : -1;
+}
+
+/*
+ * Release messages held in memory
+ */
+void timeshift_filemgr_ram_free ( timeshift_file_t *tsf )
+{
+  int i;
+  for (i = 0; i < tsf->ram_count; i++)
+    streaming_msg_free(tsf->rams[i].sm);
+  free(tsf->rams);
+  tsf->rams      = NULL;
+  tsf->ram_count = 0;
+  tsf->ram_alloc = 0;
+}
+
 /*
  * Flush all files
  */
-void timeshift_filemgr_flush ( timeshift_t *ts, timeshift_file_t *end )
+void timeshift_filemgr_flush ( timeshift_store_t *tss, timeshift_file_t *end )
 {
   timeshift_file_t *tsf;
-  while ((tsf = TAILQ_FIRST(&ts->files))) {
+  while ((tsf = TAILQ_FIRST(&tss->files))) {
     if (tsf == end) break;
-    timeshift_filemgr_remove(ts, tsf, 1);
+    timeshift_filemgr_remove(tss, tsf, 1);
+  }
+}
+
+/* **************************************************************************
+ * I-frame index
+ *
+ * A single array (per store) ordered by time. Files are removed oldest
+ * first, so their entries always form the head of the array.
+ * *************************************************************************/
+
+/*
+ * Add I-frame at the current end of the file
+ */
+void timeshift_filemgr_index_add
+  ( timeshift_store_t *tss, timeshift_file_t *tsf, int64_t time )
+{
+  timeshift_index_iframe_t *ti;
+
+  if (tss->iframe_count == tss->iframe_alloc) {
+    if (tss->iframe_first > tss->iframe_alloc / 2) {
+      tss->iframe_count -= tss->iframe_first;
+      memmove(tss->iframes, tss->iframes + tss->iframe_first,
+              tss->iframe_count * sizeof(*ti));
+      tss->iframe_first = 0;
+    } else {
+      tss->iframe_alloc = tss->iframe_alloc ? tss->iframe_alloc * 2 : 1024;
+      tss->iframes = realloc(tss->iframes, tss->iframe_alloc * sizeof(*ti));
+    }
+  }
+  ti = &tss->iframes[tss->iframe_count++];
+  ti->pos  = tsf->size;
+  ti->time = time;
+  ti->file = tsf;
+}
+
+/*
+ * Find the I-frame at or before (back) / at or after the given time
+ *
+ * Returns 0 if found, otherwise the first (-1) or last (1) I-frame in the
+ * buffer is returned instead. ti->file is NULL if there are none.
+ */
+int timeshift_filemgr_index_find
+  ( timeshift_store_t *tss, int64_t time, int back,
+    timeshift_index_iframe_t *ti )
+{
+  int lo = tss->iframe_first, hi = tss->iframe_count, mid, end = 0;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (back ? tss->iframes[mid].time <= time : tss->iframes[mid].time < time)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (back)
+    lo--;
+  if (lo < tss->iframe_first) {
+    lo  = tss->iframe_first;
+    end = -1;
+  } else if (lo >= tss->iframe_count) {
+    lo  = tss->iframe_count - 1;
+    end = 1;
+  }
+  if (tss->iframe_first == tss->iframe_count)
+    memset(ti, 0, sizeof(*ti));
+  else
+    *ti = tss->iframes[lo];
+  return end;
+}
+
+/*
+ * First I-frame at or after the given time (NULL if none)
+ */
+timeshift_index_iframe_t *timeshift_filemgr_index_first
+  ( timeshift_store_t *tss, int64_t time )
+{
+  int lo = tss->iframe_first, hi = tss->iframe_count, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (tss->iframes[mid].time < time)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
+  if (lo == tss->iframe_count)
+    return NULL;
+  return &tss->iframes[lo];
 }
 
+timeshift_index_iframe_t *timeshift_filemgr_index_last
+  ( timeshift_store_t *tss )
+{
+  if (tss->iframe_first == tss->iframe_count)
+    return NULL;
+  return &tss->iframes[tss->iframe_count - 1];
+}
+
+/* **************************************************************************
+ * File list
+ * *************************************************************************/
+
 /*
  * Get current / new file
  */
-timeshift_file_t *timeshift_filemgr_get ( timeshift_t *ts, int create )
+timeshift_file_t *timeshift_filemgr_get ( timeshift_store_t *tss, int create )
 {
-  int fd;
+  int fd, ram;
   struct timespec tp;
   timeshift_file_t *tsf_tl, *tsf_hd, *tsf_tmp;
   timeshift_index_data_t *ti;
@@ -190,33 +446,33 @@ timeshift_file_t *timeshift_filemgr_get ( timeshift_t *ts, int create )
 
   /* Return last file */
   if (!create)
-    return timeshift_filemgr_newest(ts);
+    return timeshift_filemgr_newest(tss);
 
   /* No space */
-  if (ts->full)
+  if (tss->full)
     return NULL;
 
   /* Store to file */
   clock_gettime(CLOCK_MONOTONIC_COARSE, &tp);
   time   = tp.tv_sec / TIMESHIFT_FILE_PERIOD;
-  tsf_tl = TAILQ_LAST(&ts->files, timeshift_file_list);
+  tsf_tl = TAILQ_LAST(&tss->files, timeshift_file_list);
   if (!tsf_tl || tsf_tl->time != time) {
-    tsf_hd = TAILQ_FIRST(&ts->files);
+    tsf_hd = TAILQ_FIRST(&tss->files);
 
     /* Close existing */
-    if (tsf_tl && tsf_tl->fd != -1)
-      timeshift_filemgr_close(tsf_tl);
+    if (tsf_tl && timeshift_file_open(tsf_tl))
+      timeshift_filemgr_close(tss, tsf_tl);
 
     /* Check period */
-    if (ts->max_time && tsf_hd && tsf_tl) {
+    if (tss->max_time && tsf_hd && tsf_tl) {
       time_t d = (tsf_tl->time - tsf_hd->time) * TIMESHIFT_FILE_PERIOD;
-      if (d > (ts->max_time+5)) {
+      if (d > (tss->max_time+5)) {
         if (!tsf_hd->refcount) {
-          timeshift_filemgr_remove(ts, tsf_hd, 0);
+          timeshift_filemgr_remove(tss, tsf_hd, 0);
           tsf_hd = NULL;
         } else {
-          tvhlog(LOG_DEBUG, "timeshift", "ts %d buffer full", ts->id);
-          ts->full = 1;
+          tvhlog(LOG_DEBUG, "timeshift", "ts %d buffer full", tss->id);
+          tss->full = 1;
         }
       }
     }
@@ -227,44 +483,48 @@ timeshift_file_t *timeshift_filemgr_get ( timeshift_t *ts, int create )
 
       /* Remove the last file (if we can) */
       if (tsf_hd && !tsf_hd->refcount) {
-        timeshift_filemgr_remove(ts, tsf_hd, 0);
+        timeshift_filemgr_remove(tss, tsf_hd, 0);
 
       /* Full */
       } else {
-        tvhlog(LOG_DEBUG, "timeshift", "ts %d buffer full", ts->id);
-        ts->full = 1;
+        tvhlog(LOG_DEBUG, "timeshift", "ts %d buffer full", tss->id);
+        tss->full = 1;
       }
     }
       
     /* Create new file */
     tsf_tmp = NULL;
-    if (!ts->full) {
+    if (!tss->full) {
 
-      /* Create directories */
-      if (!ts->path) {
-        if (timeshift_filemgr_makedirs(ts->id, path, sizeof(path)))
+      /* Create directories (memory files get them on the first spill) */
+      ram = timeshift_ram_size ? 1 : 0;
+      if (!tss->path || !ram) {
+        if (timeshift_filemgr_makedirs(tss->id, path, sizeof(path), !ram))
           return NULL;
-        ts->path = strdup(path);
+        if (!tss->path)
+          tss->path = strdup(path);
       }
 
-      /* Create File */
-      snprintf(path, sizeof(path), "%s/tvh-%"PRItime_t, ts->path, time);
-      tvhtrace("timeshift", "ts %d create file %s", ts->id, path);
-      if ((fd = open(path, O_WRONLY | O_CREAT, 0600)) > 0) {
+      /* Create File (or hold it in memory) */
+      snprintf(path, sizeof(path), "%s/tvh-%"PRItime_t, tss->path, time);
+      tvhtrace("timeshift", "ts %d create file %s%s", tss->id, path,
+               ram ? " (memory)" : "");
+      fd = ram ? -1 : open(path, O_WRONLY | O_CREAT, 0600);
+      if (fd > 0 || ram) {
         tsf_tmp = calloc(1, sizeof(timeshift_file_t));
         tsf_tmp->time     = time;
         tsf_tmp->fd       = fd;
+        tsf_tmp->ram      = ram;
         tsf_tmp->path     = strdup(path);
         tsf_tmp->refcount = 0;
         tsf_tmp->last     = getmonoclock();
-        TAILQ_INIT(&tsf_tmp->iframes);
         TAILQ_INIT(&tsf_tmp->sstart);
-        TAILQ_INSERT_TAIL(&ts->files, tsf_tmp, link);
+        TAILQ_INSERT_TAIL(&tss->files, tsf_tmp, link);
 
         /* Copy across last start message */
         if (tsf_tl && (ti = TAILQ_LAST(&tsf_tl->sstart, timeshift_index_data_list))) {
           tvhtrace("timeshift", "ts %d copy smt_start to new file",
-                   ts->id);
+                   tss->id);
           timeshift_index_data_t *ti2 = calloc(1, sizeof(timeshift_index_data_t));
           ti2->data = streaming_msg_clone(ti->data);
           TAILQ_INSERT_TAIL(&tsf_tmp->sstart, ti2, link);
@@ -306,9 +566,9 @@ timeshift_file_t *timeshift_filemgr_prev
 /*
  * Get the oldest file
  */
-timeshift_file_t *timeshift_filemgr_oldest ( timeshift_t *ts )
+timeshift_file_t *timeshift_filemgr_oldest ( timeshift_store_t *tss )
 {
-  timeshift_file_t *tsf = TAILQ_FIRST(&ts->files);
+  timeshift_file_t *tsf = TAILQ_FIRST(&tss->files);
   if (tsf)
     tsf->refcount++;
   return tsf;
@@ -317,9 +577,9 @@ timeshift_file_t *timeshift_filemgr_oldest ( timeshift_t *ts )
 /*
  * Get the newest file
  */
-timeshift_file_t *timeshift_filemgr_newest ( timeshift_t *ts )
+timeshift_file_t *timeshift_filemgr_newest ( timeshift_store_t *tss )
 {
-  timeshift_file_t *tsf = TAILQ_LAST(&ts->files, timeshift_file_list);
+  timeshift_file_t *tsf = TAILQ_LAST(&tss->files, timeshift_file_list);
   if (tsf)
     tsf->refcount++;
   return tsf;
@@ -342,6 +602,7 @@ void timeshift_filemgr_init ( void )
 
   /* Size processing */
   timeshift_total_size = 0;
+  timeshift_total_ram_size = 0;
 
   /* Start the reaper thread */
   timeshift_reaper_run = 1;
@@ -41,40 +41,39 @@
  * File Reading
  * *************************************************************************/
 
-static ssize_t _read_pktbuf ( int fd, pktbuf_t **pktbuf )
+/*
+ * Parse packet buffer (only measure it if pktbuf is NULL)
+ */
+static ssize_t _parse_pktbuf
+  ( const uint8_t *buf, size_t len, pktbuf_t **pktbuf )
 {
-  ssize_t r, cnt = 0;
   size_t sz;
 
   /* Size */
-  r = read(fd, &sz, sizeof(sz));
-  if (r < 0) return -1;
-  if (r != sizeof(sz)) return 0;
-  cnt += r;
+  if (len < sizeof(sz)) return 0;
+  memcpy(&sz, buf, sizeof(sz));
 
-  /* Empty And Sanity Check */
-  if (!sz || sz > 1024 * 1024) {
-    *pktbuf = NULL;
-    return cnt;
-  }
+  /* Sanity check */
+  if (sz > 1024 * 1024) return -1;
 
   /* Data */
-  *pktbuf = pktbuf_alloc(NULL, sz);
-  r = read(fd, (*pktbuf)->pb_data, sz);
-  if (r != sz) {
-    free((*pktbuf)->pb_data);
-    free(*pktbuf);
-    return r < 0 ? -1 : 0;
-  }
-  cnt += r;
+  if (len - sizeof(sz) < sz) return 0;
+  if (pktbuf)
+    *pktbuf = sz ? pktbuf_alloc(buf + sizeof(sz), sz) : NULL;
 
-  return cnt;
+  return sizeof(sz) + sz;
 }
 
-
-static ssize_t _read_msg ( int fd, streaming_message_t **sm )
+/*
+ * Parse message
+ *
+ * Returns the number of bytes consumed, 0 if the record is not complete
+ * yet or -1 on error.
+ */
+static ssize_t _parse_msg
+  ( const uint8_t *buf, size_t len, streaming_message_t **sm )
 {
-  ssize_t r, cnt = 0;
+  ssize_t r1, r2, cnt = 0;
   size_t sz;
   streaming_message_type_t type;
   int64_t time;
@@ -85,32 +84,29 @@ static ssize_t _read_msg ( int fd, streaming_message_t **sm )
   *sm = NULL;
 
   /* Size */
-  r = read(fd, &sz, sizeof(sz));
-  if (r < 0) return -1;
-  if (r != sizeof(sz)) return 0;
-  cnt += r;
+  if (len < sizeof(sz)) return 0;
+  memcpy(&sz, buf, sizeof(sz));
+  cnt += sizeof(sz);
 
   /* EOF */
   if (sz == 0) return cnt;
 
   /* Wrong data size */
-  if (sz > 1024 * 1024) return -1;
+  if (sz > 1024 * 1024 || sz < sizeof(type) + sizeof(time)) return -1;
+
+  /* Incomplete */
+  if (len - cnt < sz) return 0;
 
   /* Type */
-  r = read(fd, &type, sizeof(type));
-  if (r < 0) return -1;
-  if (r != sizeof(type)) return 0;
-  cnt += r;
+  memcpy(&type, buf + cnt, sizeof(type));
+  cnt += sizeof(type);
 
   /* Time */
-  r = read(fd, &time, sizeof(time));
-  if (r < 0) return -1;
-  if (r != sizeof(time)) return 0;
-  cnt += r;
+  memcpy(&time, buf + cnt, sizeof(time));
+  cnt += sizeof(time);
 
   /* Adjust size */
   sz -= sizeof(type) + sizeof(time);
-  cnt += sz;
 
   /* Standard messages */
   switch (type) {
@@ -127,46 +123,34 @@ static ssize_t _read_msg ( int fd, streaming_message_t **sm )
     case SMT_EXIT:
     case SMT_SPEED:
       if (sz != sizeof(code)) return -1;
-      r = read(fd, &code, sz);
-      if (r != sz) {
-        if (r < 0) return -1;
-        return 0;
-      }
+      memcpy(&code, buf + cnt, sz);
       *sm = streaming_msg_create_code(type, code);
       break;
 
+    /* Packet (header and payload follow) */
+    case SMT_PACKET:
+      if (sz != sizeof(th_pkt_t)) return -1;
+      r1 = _parse_pktbuf(buf + cnt + sz, len - cnt - sz, NULL);
+      if (r1 <= 0) return r1;
+      r2 = _parse_pktbuf(buf + cnt + sz + r1, len - cnt - sz - r1, NULL);
+      if (r2 <= 0) return r2;
+      th_pkt_t *pkt = malloc(sz);
+      memcpy(pkt, buf + cnt, sz);
+      _parse_pktbuf(buf + cnt + sz, r1, &pkt->pkt_header);
+      _parse_pktbuf(buf + cnt + sz + r1, r2, &pkt->pkt_payload);
+      pkt->pkt_refcount = 0;
+      *sm = streaming_msg_create_pkt(pkt);
+      (*sm)->sm_time = time;
+      cnt += r1 + r2;
+      break;
+
     /* Data */
     case SMT_SKIP:
     case SMT_SIGNAL_STATUS:
     case SMT_MPEGTS:
-    case SMT_PACKET:
       data = malloc(sz);
-      r = read(fd, data, sz);
-      if (r != sz) {
-        free(data);
-        if (r < 0) return -1;
-        return 0;
-      }
-      if (type == SMT_PACKET) {
-        th_pkt_t *pkt = data;
-        pkt->pkt_payload  = pkt->pkt_header = NULL;
-        pkt->pkt_refcount = 0;
-        *sm = streaming_msg_create_pkt(pkt);
-        r   = _read_pktbuf(fd, &pkt->pkt_header);
-        if (r < 0) {
-          streaming_msg_free(*sm);
-          return r;
-        }
-        cnt += r;
-        r   = _read_pktbuf(fd, &pkt->pkt_payload);
-        if (r < 0) {
-          streaming_msg_free(*sm);
-          return r;
-        }
-        cnt += r;
-      } else {
-        *sm = streaming_msg_create_data(type, data);
-      }
+      memcpy(data, buf + cnt, sz);
+      *sm = streaming_msg_create_data(type, data);
       (*sm)->sm_time = time;
       break;
 
@@ -175,7 +159,106 @@ static ssize_t _read_msg ( int fd, streaming_message_t **sm )
   }
 
   /* OK */
-  return cnt;
+  return cnt + sz;
+}
+
+/*
+ * Read control message (from the pipe)
+ */
+static ssize_t _read_msg ( int fd, streaming_message_t **sm )
+{
+  uint8_t buf[256];
+  ssize_t r;
+  size_t sz;
+
+  /* Clear */
+  *sm = NULL;
+
+  /* Size */
+  r = read(fd, buf, sizeof(sz));
+  if (r < 0) return -1;
+  if (r != sizeof(sz)) return 0;
+  memcpy(&sz, buf, sizeof(sz));
+  if (sz > sizeof(buf) - sizeof(sz)) return -1;
+
+  /* Message (always written in one go) */
+  if (sz) {
+    r = read(fd, buf + sizeof(sz), sz);
+    if (r != sz) return r < 0 ? -1 : 0;
+  }
+
+  return _parse_msg(buf, sizeof(sz) + sz, sm);
+}
+
+/*
+ * Read-ahead buffer
+ */
+typedef struct timeshift_rbuf
+{
+  int      fd;    ///< Read descriptor
+  uint8_t *data;  ///< Buffered file data
+  size_t   size;  ///< Allocated size
+  size_t   len;   ///< Valid data length
+  off_t    off;   ///< File offset of data[0]
+} timeshift_rbuf_t;
+
+static void _rbuf_close ( timeshift_rbuf_t *rb )
+{
+  if (rb->fd != -1)
+    close(rb->fd);
+  rb->fd  = -1;
+  rb->len = 0;
+  rb->off = 0;
+}
+
+/*
+ * Refill the buffer starting at pos, keeping whatever is already held
+ * from that offset on. Returns the number of new bytes.
+ */
+static ssize_t _rbuf_fill ( timeshift_rbuf_t *rb, off_t pos )
+{
+  size_t keep = 0;
+  ssize_t r;
+
+  if (pos >= rb->off && pos <= rb->off + rb->len) {
+    keep = rb->off + rb->len - pos;
+    if (keep && pos != rb->off)
+      memmove(rb->data, rb->data + (pos - rb->off), keep);
+  }
+  rb->off = pos;
+  rb->len = keep;
+
+  /* Record larger than the buffer */
+  if (keep == rb->size) {
+    rb->size = rb->size ? rb->size * 2 : TIMESHIFT_RBUF_SIZE;
+    rb->data = realloc(rb->data, rb->size);
+  }
+
+  r = pread(rb->fd, rb->data + keep, rb->size - keep, pos + keep);
+  if (r > 0)
+    rb->len += r;
+  return r;
+}
+
+/*
+ * Read message at pos (from file)
+ */
+static ssize_t _rbuf_read_msg
+  ( timeshift_rbuf_t *rb, off_t pos, streaming_message_t **sm )
+{
+  ssize_t r;
+
+  *sm = NULL;
+  while (1) {
+    if (pos >= rb->off && pos < rb->off + rb->len) {
+      r = _parse_msg(rb->data + (pos - rb->off), rb->off + rb->len - pos, sm);
+      if (r != 0)
+        return r;
+    }
+    r = _rbuf_fill(rb, pos);
+    if (r <= 0)
+      return r;
+  }
 }
 
 /* **************************************************************************
@@ -195,121 +278,51 @@ static streaming_message_t *_timeshift_find_sstart
   return ti ? ti->data : NULL;
 }
 
-static timeshift_index_iframe_t *_timeshift_first_frame
-  ( timeshift_t *ts )
-{ 
-  int end;
-  timeshift_index_iframe_t *tsi = NULL;
-  timeshift_file_t *tsf = timeshift_filemgr_oldest(ts);
-  while (tsf && !tsi) {
-    if (!(tsi = TAILQ_FIRST(&tsf->iframes))) {
-      tsf = timeshift_filemgr_next(tsf, &end, 0);
-    }
-  }
-  if (tsf)
-    tsf->refcount--;
-  return tsi;
-}
-
-static timeshift_index_iframe_t *_timeshift_last_frame
-  ( timeshift_t *ts )
+/*
+ * Compare stream makeup (a shared buffer holds the feeder's copy)
+ */
+static int _timeshift_same_start
+  ( streaming_start_t *a, streaming_start_t *b )
 {
-  int end;
-  timeshift_index_iframe_t *tsi = NULL;
-  timeshift_file_t *tsf = timeshift_filemgr_get(ts, 0);
-  while (tsf && !tsi) {
-    if (!(tsi = TAILQ_LAST(&tsf->iframes, timeshift_index_iframe_list))) {
-      tsf = timeshift_filemgr_prev(tsf, &end, 0);
-    }
-  }
-  if (tsf)
-    tsf->refcount--;
-  return tsi;
+  int i;
+
+  if (a == b)
+    return 1;
+  if (!a || !b || a->ss_num_components != b->ss_num_components)
+    return 0;
+  for (i = 0; i < a->ss_num_components; i++)
+    if (a->ss_components[i].ssc_index != b->ss_components[i].ssc_index ||
+        a->ss_components[i].ssc_type  != b->ss_components[i].ssc_type)
+      return 0;
+  return 1;
 }
 
+/*
+ * Find the I-frame to continue from (rdwr_mutex held)
+ *
+ * A member of a shared buffer cannot go back before it joined, the
+ * first I-frame after that is its start of the buffer.
+ *
+ * The file returned is referenced.
+ */
 static int _timeshift_skip
   ( timeshift_t *ts, int64_t req_time, int64_t cur_time,
-    timeshift_file_t *cur_file, timeshift_file_t **new_file,
-    timeshift_index_iframe_t **iframe )
+    timeshift_file_t **new_file, timeshift_index_iframe_t *iframe )
 {
-  timeshift_index_iframe_t *tsi  = *iframe;
-  timeshift_file_t         *tsf  = cur_file;
-  int64_t                   sec  = req_time / (1000000 * TIMESHIFT_FILE_PERIOD);
-  int                       back = (req_time < cur_time) ? 1 : 0;
-  int                       end  = 0;
-  
-  /* Hold local ref */
-  if (cur_file)
-    cur_file->refcount++;
-
-  /* Coarse search */
-  if (!tsi) {
-    while (tsf && !end) {
-      if (back) {
-        if ((tsf->time <= sec) &&
-            (tsi = TAILQ_LAST(&tsf->iframes, timeshift_index_iframe_list)))
-          break;
-        tsf = timeshift_filemgr_prev(tsf, &end, 1);
-      } else {
-        if ((tsf->time >= sec) &&
-            (tsi = TAILQ_FIRST(&tsf->iframes)))
-          break;
-        tsf = timeshift_filemgr_next(tsf, &end, 0);
-      }
-      tsi = NULL;
-    }
-  }
-
-  /* Fine search */
-  if (back) {
-    while (!end && tsf && tsi && (tsi->time > req_time)) {
-      tsi = TAILQ_PREV(tsi, timeshift_index_iframe_list, link);
-      while (!end && tsf && !tsi) {
-        if ((tsf = timeshift_filemgr_prev(tsf, &end, 1)))
-          tsi = TAILQ_LAST(&tsf->iframes, timeshift_index_iframe_list);
-      }
-    }
-  } else {
-    while (!end && tsf && tsi && (tsi->time < req_time)) {
-      tsi = TAILQ_NEXT(tsi, link);
-      while (!end && tsf && !tsi) {
-        if ((tsf = timeshift_filemgr_next(tsf, &end, 0)))
-          tsi = TAILQ_FIRST(&tsf->iframes);
-      }
-    }
-  }
-
-  /* End */
-  if (!tsf || !tsi)
-    end = 1;
-
-  /* Find start/end of buffer */
-  if (end) {
-    if (back) {
-      tsf = timeshift_filemgr_oldest(ts);
-      tsi = NULL;
-      while (tsf && !tsi) {
-        if (!(tsi = TAILQ_FIRST(&tsf->iframes)))
-          tsf = timeshift_filemgr_next(tsf, &end, 0);
-      }
-      end = -1;
-    } else {
-      tsf = timeshift_filemgr_get(ts, 0);
-      tsi = NULL;
-      while (tsf && !tsi) {
-        if (!(tsi = TAILQ_LAST(&tsf->iframes, timeshift_index_iframe_list)))
-          tsf = timeshift_filemgr_prev(tsf, &end, 0);
-      }
-      end = 1;
-    }
+  timeshift_index_iframe_t *first;
+  int end = timeshift_filemgr_index_find(ts->store, req_time,
+                                         req_time < cur_time, iframe);
+  if (req_time < ts->join_time ||
+      (iframe->file && iframe->time < ts->join_time)) {
+    if ((first = timeshift_filemgr_index_first(ts->store, ts->join_time)))
+      *iframe = *first;
+    else
+      memset(iframe, 0, sizeof(*iframe));
+    end = -1;
   }
-
-  if (cur_file)
-    cur_file->refcount--;
-
-  /* Done */
-  *new_file = tsf;
-  *iframe   = tsi;
+  if (iframe->file)
+    iframe->file->refcount++;
+  *new_file = iframe->file;
   return end;
 }
 
@@ -317,24 +330,45 @@ static int _timeshift_skip
  * Output packet
  */
 static int _timeshift_read
-  ( timeshift_t *ts, timeshift_file_t **cur_file, off_t *cur_off, int *fd,
-    streaming_message_t **sm, int *wait )
+  ( timeshift_t *ts, timeshift_file_t **cur_file, off_t *cur_off,
+    timeshift_rbuf_t *rb, streaming_message_t **sm, int *wait )
 {
   if (*cur_file) {
-
-    /* Open file */
-    if (*fd < 0) {
-      tvhtrace("timeshift", "ts %d open file %s",
-               ts->id, (*cur_file)->path);
-      *fd = open((*cur_file)->path, O_RDONLY);
-      if (*fd < 0)
-        return -1;
+    ssize_t r = 0;
+    int ram;
+
+    /* Held in memory */
+    pthread_mutex_lock(&ts->store->rdwr_mutex);
+    if ((ram = (*cur_file)->ram))
+      r = timeshift_filemgr_ram_read(*cur_file, *cur_off, sm);
+    pthread_mutex_unlock(&ts->store->rdwr_mutex);
+
+    if (!ram) {
+
+      /* Open file */
+      if (rb->fd < 0) {
+        tvhtrace("timeshift", "ts %d open file %s",
+                 ts->id, (*cur_file)->path);
+        rb->fd = open((*cur_file)->path, O_RDONLY);
+        if (rb->fd < 0)
+          return -1;
+      }
+      tvhtrace("timeshift", "ts %d seek to %jd", ts->id, (intmax_t)*cur_off);
+
+      /* Read msg */
+      r = _rbuf_read_msg(rb, *cur_off, sm);
+
+      /* Incomplete - the rest may still be held in the write buffer */
+      if (r == 0) {
+        int flushed;
+        pthread_mutex_lock(&ts->store->rdwr_mutex);
+        flushed = (*cur_file)->wbuf_len && !timeshift_write_sync(*cur_file);
+        pthread_mutex_unlock(&ts->store->rdwr_mutex);
+        if (flushed)
+          r = _rbuf_read_msg(rb, *cur_off, sm);
+      }
     }
-    tvhtrace("timeshift", "ts %d seek to %jd", ts->id, (intmax_t)*cur_off);
-    lseek(*fd, *cur_off, SEEK_SET);
 
-    /* Read msg */
-    ssize_t r = _read_msg(*fd, sm);
     if (r < 0) {
       streaming_message_t *e = streaming_msg_create_code(SMT_STOP, SM_CODE_UNDEFINED_ERROR);
       streaming_target_deliver2(ts->output, e);
@@ -348,34 +382,40 @@ static int _timeshift_read
 #endif
 
     /* Incomplete */
-    if (r == 0) {
-      lseek(*fd, *cur_off, SEEK_SET);
+    if (r == 0)
       return 0;
-    }
 
     /* Update */
     *cur_off += r;
 
     /* Special case - EOF */
     if (r == sizeof(size_t) || *cur_off > (*cur_file)->size) {
-      close(*fd);
-      *fd       = -1;
-      pthread_mutex_lock(&ts->rdwr_mutex);
+      _rbuf_close(rb);
+      pthread_mutex_lock(&ts->store->rdwr_mutex);
       *cur_file = timeshift_filemgr_next(*cur_file, NULL, 0);
-      pthread_mutex_unlock(&ts->rdwr_mutex);
+      pthread_mutex_unlock(&ts->store->rdwr_mutex);
       *cur_off  = 0; // reset
       *wait     = 0;
 
     /* Check SMT_START index */
     } else {
       streaming_message_t *ssm = _timeshift_find_sstart(*cur_file, (*sm)->sm_time);
-      if (ssm && ssm->sm_data != ts->smt_start) {
+      if (ssm && !_timeshift_same_start(ssm->sm_data, ts->smt_start)) {
         streaming_target_deliver2(ts->output, streaming_msg_clone(ssm));
         if (ts->smt_start)
           streaming_start_unref(ts->smt_start);
         ts->smt_start = ssm->sm_data;
         atomic_add(&ts->smt_start->ss_refcount, 1);
       }
+
+      /* Move packets onto our own timeline (shared buffer) */
+      if ((*sm)->sm_type == SMT_PACKET && ts->ts_offset) {
+        th_pkt_t *pkt = (*sm)->sm_data;
+        if (pkt->pkt_dts != PTS_UNSET)
+          pkt->pkt_dts += ts->ts_offset;
+        if (pkt->pkt_pts != PTS_UNSET)
+          pkt->pkt_pts += ts->ts_offset;
+      }
     }
   }
   return 0;
@@ -386,12 +426,12 @@ static int _timeshift_read
  * Flush all data to live
  */
 static int _timeshift_flush_to_live
-  ( timeshift_t *ts, timeshift_file_t **cur_file, off_t *cur_off, int *fd,
-    streaming_message_t **sm, int *wait )
+  ( timeshift_t *ts, timeshift_file_t **cur_file, off_t *cur_off,
+    timeshift_rbuf_t *rb, streaming_message_t **sm, int *wait )
 {
   time_t pts = 0;
   while (*cur_file) {
-    if (_timeshift_read(ts, cur_file, cur_off, fd, sm, wait) == -1)
+    if (_timeshift_read(ts, cur_file, cur_off, rb, sm, wait) == -1)
       return -1;
     if (!*sm) break;
     if ((*sm)->sm_type == SMT_PACKET) {
@@ -415,18 +455,20 @@ static int _timeshift_flush_to_live
 void *timeshift_reader ( void *p )
 {
   timeshift_t *ts = p;
-  int nfds, end, fd = -1, run = 1, wait = -1;
+  timeshift_store_t *tss = NULL;
+  int nfds, end, run = 1, wait = -1;
   timeshift_file_t *cur_file = NULL;
   off_t cur_off = 0;
   int cur_speed = 100, keyframe_mode = 0;
   int64_t pause_time = 0, play_time = 0, last_time = 0;
   int64_t now, deliver, skip_time = 0;
   streaming_message_t *sm = NULL, *ctrl = NULL;
-  timeshift_index_iframe_t *tsi = NULL;
+  timeshift_index_iframe_t tsi;
   streaming_skip_t *skip = NULL;
   time_t last_status = 0;
   tvhpoll_t *pd;
   tvhpoll_event_t ev = { 0 };
+  timeshift_rbuf_t rb = { .fd = -1 };
 
   pd = tvhpoll_create(1);
   ev.fd     = ts->rd_pipe.rd;
@@ -453,6 +495,7 @@ void *timeshift_reader ( void *p )
 
     /* Control */
     pthread_mutex_lock(&ts->state_mutex);
+    tss = ts->store;
     if (nfds == 1) {
       if (_read_msg(ts->rd_pipe.rd, &ctrl) > 0) {
 
@@ -492,14 +535,14 @@ void *timeshift_reader ( void *p )
               } else {
                 tvhlog(LOG_DEBUG, "timeshift", "ts %d enter timeshift mode",
                        ts->id);
-                timeshift_writer_flush(ts);
-                pthread_mutex_lock(&ts->rdwr_mutex);
-                if ((cur_file   = timeshift_filemgr_get(ts, 1))) {
+                timeshift_writer_flush(tss);
+                pthread_mutex_lock(&tss->rdwr_mutex);
+                if ((cur_file   = timeshift_filemgr_get(tss, 1))) {
                   cur_off    = cur_file->size;
                   pause_time = cur_file->last;
                   last_time  = pause_time;
                 }
-                pthread_mutex_unlock(&ts->rdwr_mutex);
+                pthread_mutex_unlock(&tss->rdwr_mutex);
               }
 
             /* Buffer playback */
@@ -516,9 +559,6 @@ void *timeshift_reader ( void *p )
               tvhlog(LOG_DEBUG, "timeshift", "using keyframe mode? %s",
                      keyframe ? "yes" : "no");
               keyframe_mode = keyframe;
-              if (keyframe) {
-                tsi = NULL;
-              }
             }
 
             /* Update */
@@ -542,12 +582,13 @@ void *timeshift_reader ( void *p )
             case SMT_SKIP_LIVE:
               if (ts->state != TS_LIVE) {
 
-                /* Reset */
-                if (ts->full) {
-                  pthread_mutex_lock(&ts->rdwr_mutex);
-                  timeshift_filemgr_flush(ts, NULL);
-                  ts->full = 0;
-                  pthread_mutex_unlock(&ts->rdwr_mutex);
+                /* Reset (others may still be using a shared buffer) */
+                if (tss->full) {
+                  pthread_mutex_lock(&tss->rdwr_mutex);
+                  if (tss->refcount == 1)
+                    timeshift_filemgr_flush(tss, NULL);
+                  tss->full = 0;
+                  pthread_mutex_unlock(&tss->rdwr_mutex);
                 }
 
                 /* Release */
@@ -575,15 +616,15 @@ void *timeshift_reader ( void *p )
 
               /* Live playback (stage1) */
               if (ts->state == TS_LIVE) {
-                pthread_mutex_lock(&ts->rdwr_mutex);
-                if ((cur_file   = timeshift_filemgr_get(ts, !ts->ondemand))) {
+                pthread_mutex_lock(&tss->rdwr_mutex);
+                if ((cur_file   = timeshift_filemgr_get(tss, !ts->ondemand))) {
                   cur_off    = cur_file->size;
                   last_time  = cur_file->last;
                 } else {
                   tvhlog(LOG_ERR, "timeshift", "ts %d failed to get current file", ts->id);
                   skip = NULL;
                 }
-                pthread_mutex_unlock(&ts->rdwr_mutex);
+                pthread_mutex_unlock(&tss->rdwr_mutex);
               }
 
               /* May have failed */
@@ -609,7 +650,6 @@ void *timeshift_reader ( void *p )
                 /* Adjust time */
                 play_time  = now;
                 pause_time = skip_time;
-                tsi        = NULL;
 
                 /* Clear existing packet */
                 if (sm)
@@ -639,14 +679,15 @@ void *timeshift_reader ( void *p )
     }
 
     /* Status message */
-    if (now >= (last_status + 1000000)) {
+    if (tss && now >= (last_status + 1000000)) {
       streaming_message_t *tsm;
       timeshift_status_t *status;
       timeshift_index_iframe_t *fst, *lst;
       status = calloc(1, sizeof(timeshift_status_t));
-      fst    = _timeshift_first_frame(ts);
-      lst    = _timeshift_last_frame(ts);
-      status->full  = ts->full;
+      pthread_mutex_lock(&tss->rdwr_mutex);
+      fst    = timeshift_filemgr_index_first(tss, ts->join_time);
+      lst    = timeshift_filemgr_index_last(tss);
+      status->full  = tss->full;
       status->shift = ts->state <= TS_LIVE ? 0 : ts_rescale_i(now - last_time, 1000000);
       if (lst && fst && lst != fst && ts->pts_delta != PTS_UNSET) {
         status->pts_start = ts_rescale_i(fst->time - ts->pts_delta, 1000000);
@@ -655,6 +696,7 @@ void *timeshift_reader ( void *p )
         status->pts_start = PTS_UNSET;
         status->pts_end   = PTS_UNSET;
       }
+      pthread_mutex_unlock(&tss->rdwr_mutex);
       tsm = streaming_msg_create_data(SMT_TIMESHIFT_STATUS, status);
       streaming_target_deliver2(ts->output, tsm);
       last_status = now;
@@ -687,31 +729,30 @@ void *timeshift_reader ( void *p )
         tvhlog(LOG_DEBUG, "timeshift", "ts %d skip to %"PRId64" from %"PRId64, ts->id, req_time, last_time);
 
         /* Find */
-        pthread_mutex_lock(&ts->rdwr_mutex);
-        end = _timeshift_skip(ts, req_time, last_time,
-                              cur_file, &tsf, &tsi);
-        pthread_mutex_unlock(&ts->rdwr_mutex);
-        if (tsi)
-          tvhlog(LOG_DEBUG, "timeshift", "ts %d skip found pkt @ %"PRId64, ts->id, tsi->time);
+        pthread_mutex_lock(&tss->rdwr_mutex);
+        end = _timeshift_skip(ts, req_time, last_time, &tsf, &tsi);
+        pthread_mutex_unlock(&tss->rdwr_mutex);
+        if (tsf)
+          tvhlog(LOG_DEBUG, "timeshift", "ts %d skip found pkt @ %"PRId64, ts->id, tsi.time);
 
         /* File changed (close) */
-        if ((tsf != cur_file) && (fd != -1)) {
-          close(fd);
-          fd = -1;
-        }
+        if ((tsf != cur_file) && (rb.fd != -1))
+          _rbuf_close(&rb);
 
         /* Position */
+        pthread_mutex_lock(&tss->rdwr_mutex);
         if (cur_file)
           cur_file->refcount--;
+        pthread_mutex_unlock(&tss->rdwr_mutex);
         cur_file = tsf;
-        if (tsi)
-          cur_off = tsi->pos;
+        if (tsf)
+          cur_off = tsi.pos;
         else
           cur_off = 0;
       }
 
       /* Find packet */
-      if (_timeshift_read(ts, &cur_file, &cur_off, &fd, &sm, &wait) == -1) {
+      if (_timeshift_read(ts, &cur_file, &cur_off, &rb, &sm, &wait) == -1) {
         pthread_mutex_unlock(&ts->state_mutex);
         break;
       }
@@ -774,7 +815,7 @@ void *timeshift_reader ( void *p )
         end = (cur_speed > 0) ? 1 : -1;
 
       /* Back to live (unless buffer is full) */
-      if (end == 1 && !ts->full) {
+      if (end == 1 && !tss->full) {
         tvhlog(LOG_DEBUG, "timeshift", "ts %d eob revert to live mode", ts->id);
         ts->state = TS_LIVE;
         cur_speed = 100;
@@ -782,18 +823,15 @@ void *timeshift_reader ( void *p )
         streaming_target_deliver2(ts->output, ctrl);
 
         /* Flush timeshift buffer to live */
-        if (_timeshift_flush_to_live(ts, &cur_file, &cur_off, &fd, &sm, &wait) == -1)
+        if (_timeshift_flush_to_live(ts, &cur_file, &cur_off, &rb, &sm, &wait) == -1)
           break;
 
         /* Close file (if open) */
-        if (fd != -1) {
-          close(fd);
-          fd = -1;
-        }
+        _rbuf_close(&rb);
 
         /* Flush ALL files */
         if (ts->ondemand)
-          timeshift_filemgr_flush(ts, NULL);
+          timeshift_filemgr_flush(tss, NULL);
 
       /* Pause */
       } else {
@@ -813,17 +851,23 @@ void *timeshift_reader ( void *p )
 
     /* Flush unwanted */
     } else if (ts->ondemand && cur_file) {
-      pthread_mutex_lock(&ts->rdwr_mutex);
-      timeshift_filemgr_flush(ts, cur_file);
-      pthread_mutex_unlock(&ts->rdwr_mutex);
+      pthread_mutex_lock(&tss->rdwr_mutex);
+      timeshift_filemgr_flush(tss, cur_file);
+      pthread_mutex_unlock(&tss->rdwr_mutex);
     }
 
     pthread_mutex_unlock(&ts->state_mutex);
   }
 
   /* Cleanup */
+  if (cur_file) {
+    pthread_mutex_lock(&tss->rdwr_mutex);
+    cur_file->refcount--;
+    pthread_mutex_unlock(&tss->rdwr_mutex);
+  }
   tvhpoll_destroy(pd);
-  if (fd != -1) close(fd);
+  _rbuf_close(&rb);
+  free(rb.data);
   if (sm)       streaming_msg_free(sm);
   if (ctrl)     streaming_msg_free(ctrl);
   tvhtrace("timeshift", "ts %d exit reader thread", ts->id);
@@ -24,9 +24,11 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <libgen.h>
 #include <assert.h>
 
 /* **************************************************************************
@@ -34,103 +36,175 @@
  * *************************************************************************/
 
 /*
- * Write data (retry on EAGAIN)
+ * Write out pending file data followed by the given vectors
  */
-static ssize_t _write
-  ( int fd, const void *buf, size_t count )
+static int _write_out
+  ( timeshift_file_t *tsf, struct iovec *iov, int iovcnt )
 {
-  ssize_t r;
-  size_t  n = 0;
-  while ( n < count ) {
-    r = write(fd, buf+n, count-n);
-    if (r == -1) {
-      if (ERRNO_AGAIN(errno))
-        continue;
-      else
-        return -1;
-    }
-    n += r;
+  struct iovec v[9];
+  int n = 0;
+
+  if (tsf->wbuf_len) {
+    v[n].iov_base = tsf->wbuf;
+    v[n].iov_len  = tsf->wbuf_len;
+    n++;
+  }
+  if (iovcnt) {
+    memcpy(v + n, iov, iovcnt * sizeof(*iov));
+    n += iovcnt;
+  }
+  tsf->wbuf_len = 0;
+  if (n && tvh_writev(tsf->fd, v, n)) {
+    tsf->bad = 1;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Append a record to the file write buffer
+ *
+ * Records are held back until the buffer fills, and then written out
+ * together with the record that did not fit in a single writev().
+ */
+static ssize_t _write_buf
+  ( timeshift_file_t *tsf, struct iovec *iov, int iovcnt )
+{
+  size_t len = 0;
+  int i;
+
+  for (i = 0; i < iovcnt; i++)
+    len += iov[i].iov_len;
+
+  /* In memory, only the size is needed */
+  if (tsf->ram)
+    return len;
+
+  if (tsf->wbuf_len + len > TIMESHIFT_WBUF_SIZE)
+    return _write_out(tsf, iov, iovcnt) < 0 ? -1 : len;
+
+  if (!tsf->wbuf)
+    tsf->wbuf = malloc(TIMESHIFT_WBUF_SIZE);
+  if (!tsf->wbuf_len)
+    tsf->wbuf_time = getmonoclock();
+  for (i = 0; i < iovcnt; i++) {
+    memcpy(tsf->wbuf + tsf->wbuf_len, iov[i].iov_base, iov[i].iov_len);
+    tsf->wbuf_len += iov[i].iov_len;
   }
-  return count == n ? n : -1;
+  return len;
 }
 
 /*
- * Write message
+ * Write out everything held in the file write buffer
+ */
+int timeshift_write_sync ( timeshift_file_t *tsf )
+{
+  return _write_out(tsf, NULL, 0);
+}
+
+/*
+ * Message header
+ */
+typedef struct timeshift_msg_hdr
+{
+  size_t                   len;
+  streaming_message_type_t type;
+  int64_t                  time;
+} timeshift_msg_hdr_t;
+
+static int _msg_iov
+  ( struct iovec *iov, timeshift_msg_hdr_t *hdr,
+    streaming_message_type_t type, int64_t time,
+    const void *buf, size_t len )
+{
+  hdr->len  = len + sizeof(type) + sizeof(time);
+  hdr->type = type;
+  hdr->time = time;
+  iov[0].iov_base = &hdr->len;
+  iov[0].iov_len  = sizeof(hdr->len);
+  iov[1].iov_base = &hdr->type;
+  iov[1].iov_len  = sizeof(hdr->type);
+  iov[2].iov_base = &hdr->time;
+  iov[2].iov_len  = sizeof(hdr->time);
+  iov[3].iov_base = (void *)buf;
+  iov[3].iov_len  = len;
+  return 4;
+}
+
+/*
+ * Write message (to the reader control pipe)
  */
 static ssize_t _write_msg
   ( int fd, streaming_message_type_t type, int64_t time,
     const void *buf, size_t len )
 {
-  size_t len2 = len + sizeof(type) + sizeof(time);
-  ssize_t err, ret;
-  ret = err = _write(fd, &len2, sizeof(len2));
-  if (err < 0) return err;
-  err = _write(fd, &type, sizeof(type));
-  if (err < 0) return err;
-  ret += err;
-  err = _write(fd, &time, sizeof(time));
-  if (err < 0) return err;
-  ret += err;
-  if (len) {
-    err = _write(fd, buf, len);
-    if (err < 0) return err;
-    ret += err;
-  }
-  return ret;
+  struct iovec iov[4];
+  timeshift_msg_hdr_t hdr;
+  int n = _msg_iov(iov, &hdr, type, time, buf, len);
+  return tvh_writev(fd, iov, n) ? -1 : sizeof(hdr.len) + hdr.len;
 }
 
 /*
- * Write packet buffer
+ * Write message (to file)
  */
-static int _write_pktbuf ( int fd, pktbuf_t *pktbuf )
+static ssize_t _write_msg_file
+  ( timeshift_file_t *tsf, streaming_message_type_t type, int64_t time,
+    const void *buf, size_t len )
 {
-  ssize_t ret, err;
-  if (pktbuf) {
-    ret = err = _write(fd, &pktbuf->pb_size, sizeof(pktbuf->pb_size));
-    if (err < 0) return err;
-    err = _write(fd, pktbuf->pb_data, pktbuf->pb_size);
-    if (err < 0) return err;
-    ret += err;
-  } else {
-    size_t sz = 0;
-    ret = _write(fd, &sz, sizeof(sz));
-  }
-  return ret;
+  struct iovec iov[4];
+  timeshift_msg_hdr_t hdr;
+  return _write_buf(tsf, iov, _msg_iov(iov, &hdr, type, time, buf, len));
+}
+
+/*
+ * Packet buffer vectors
+ */
+static int _pktbuf_iov ( struct iovec *iov, size_t *sz, pktbuf_t *pktbuf )
+{
+  *sz = pktbuf ? pktbuf->pb_size : 0;
+  iov[0].iov_base = sz;
+  iov[0].iov_len  = sizeof(*sz);
+  if (!pktbuf)
+    return 1;
+  iov[1].iov_base = pktbuf->pb_data;
+  iov[1].iov_len  = pktbuf->pb_size;
+  return 2;
 }
 
 /*
  * Write signal status
  */
 ssize_t timeshift_write_sigstat
-  ( int fd, int64_t time, signal_status_t *sigstat )
+  ( timeshift_file_t *tsf, int64_t time, signal_status_t *sigstat )
 {
-  return _write_msg(fd, SMT_SIGNAL_STATUS, time, sigstat,
-                    sizeof(signal_status_t));
+  return _write_msg_file(tsf, SMT_SIGNAL_STATUS, time, sigstat,
+                         sizeof(signal_status_t));
 }
 
 /*
  * Write packet
  */
-ssize_t timeshift_write_packet ( int fd, int64_t time, th_pkt_t *pkt )
+ssize_t timeshift_write_packet
+  ( timeshift_file_t *tsf, int64_t time, th_pkt_t *pkt )
 {
-  ssize_t ret = 0, err;
-  ret = err = _write_msg(fd, SMT_PACKET, time, pkt, sizeof(th_pkt_t));
-  if (err <= 0) return err;
-  err = _write_pktbuf(fd, pkt->pkt_header);
-  if (err <= 0) return err;
-  ret += err;
-  err = _write_pktbuf(fd, pkt->pkt_payload);
-  if (err <= 0) return err;
-  ret += err;
-  return ret;
+  struct iovec iov[8];
+  timeshift_msg_hdr_t hdr;
+  size_t hsz, psz;
+  int n;
+
+  n  = _msg_iov(iov, &hdr, SMT_PACKET, time, pkt, sizeof(th_pkt_t));
+  n += _pktbuf_iov(iov + n, &hsz, pkt->pkt_header);
+  n += _pktbuf_iov(iov + n, &psz, pkt->pkt_payload);
+  return _write_buf(tsf, iov, n);
 }
 
 /*
  * Write MPEGTS data
  */
-ssize_t timeshift_write_mpegts ( int fd, int64_t time, void *data )
+ssize_t timeshift_write_mpegts
+  ( timeshift_file_t *tsf, int64_t time, void *data )
 {
-  return _write_msg(fd, SMT_MPEGTS, time, data, 188);
+  return _write_msg_file(tsf, SMT_MPEGTS, time, data, 188);
 }
 
 /*
@@ -169,10 +243,118 @@ ssize_t timeshift_write_exit ( int fd )
 /*
  * Write end of file (special internal message)
  */
-ssize_t timeshift_write_eof ( int fd )
+ssize_t timeshift_write_eof ( timeshift_file_t *tsf )
 {
+  struct iovec iov;
   size_t sz = 0;
-  return _write(fd, &sz, sizeof(sz));
+  iov.iov_base = &sz;
+  iov.iov_len  = sizeof(sz);
+  return _write_buf(tsf, &iov, 1);
+}
+
+/*
+ * Write stored message
+ */
+static ssize_t _write_record ( timeshift_file_t *tsf, streaming_message_t *sm )
+{
+  switch (sm->sm_type) {
+    case SMT_SIGNAL_STATUS:
+      return timeshift_write_sigstat(tsf, sm->sm_time, sm->sm_data);
+    case SMT_PACKET:
+      return timeshift_write_packet(tsf, sm->sm_time, sm->sm_data);
+    case SMT_MPEGTS:
+      return timeshift_write_mpegts(tsf, sm->sm_time, sm->sm_data);
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Write out the records (a copy of those of a file held in memory) to path
+ *
+ * The records land at the offsets already handed out, so the indexes
+ * and any reader positions stay valid. Nothing of the file is touched,
+ * so this runs without rdwr_mutex. Returns the descriptor or -1 on error.
+ */
+int timeshift_write_spill
+  ( timeshift_ram_t *rams, int count, const char *path )
+{
+  timeshift_file_t out;
+  int i, fd;
+  char *dir;
+
+  /* The directory is created on the first spill (and goes again
+   * once the last file on disk is removed) */
+  if ((fd = open(path, O_WRONLY | O_CREAT, 0600)) < 0 && errno == ENOENT) {
+    dir = tvh_strdupa(path);
+    if (!makedirs(dirname(dir), 0700))
+      fd = open(path, O_WRONLY | O_CREAT, 0600);
+  }
+  if (fd < 0) {
+    tvhlog(LOG_ERR, "timeshift", "failed to create %s [e=%s]",
+           path, strerror(errno));
+    return -1;
+  }
+  memset(&out, 0, sizeof(out));
+  out.fd = fd;
+  for (i = 0; i < count && !out.bad; i++)
+    if (_write_record(&out, rams[i].sm) != rams[i].len)
+      out.bad = 1;
+  if (!out.bad)
+    timeshift_write_sync(&out);
+  free(out.wbuf);
+  if (out.bad) {
+    tvhlog(LOG_ERR, "timeshift", "failed to write %s", path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/*
+ * Switch a spilled file over to the disk (rdwr_mutex held)
+ *
+ * Any records added after the first count are written as well.
+ */
+int timeshift_write_spill_done
+  ( timeshift_file_t *tsf, int fd, int count )
+{
+  int i;
+
+  tsf->fd  = fd;
+  tsf->ram = 0;
+  for (i = count; i < tsf->ram_count && !tsf->bad; i++)
+    if (_write_record(tsf, tsf->rams[i].sm) != tsf->rams[i].len)
+      tsf->bad = 1;
+  if (tsf->ram_eof) {
+    if (!tsf->bad && timeshift_write_eof(tsf) < 0)
+      tsf->bad = 1;
+    timeshift_write_sync(tsf);
+    free(tsf->wbuf);
+    tsf->wbuf = NULL;
+    close(tsf->fd);
+    tsf->fd = -1;
+  }
+  timeshift_filemgr_ram_free(tsf);
+  return tsf->bad ? -1 : 0;
+}
+
+/*
+ * Keep message in memory
+ */
+static void _write_ram
+  ( timeshift_file_t *tsf, streaming_message_t *sm, size_t len )
+{
+  timeshift_ram_t *r;
+
+  if (tsf->ram_count == tsf->ram_alloc) {
+    tsf->ram_alloc = tsf->ram_alloc ? tsf->ram_alloc * 2 : 1024;
+    tsf->rams = realloc(tsf->rams, tsf->ram_alloc * sizeof(*r));
+  }
+  r = &tsf->rams[tsf->ram_count++];
+  r->pos = tsf->size;
+  r->len = len;
+  r->sm  = sm;
 }
 
 /* **************************************************************************
@@ -180,7 +362,7 @@ ssize_t timeshift_write_eof ( int fd )
  * *************************************************************************/
 
 static inline ssize_t _process_msg0
-  ( timeshift_t *ts, timeshift_file_t *tsf, streaming_message_t **smp )
+  ( timeshift_store_t *tss, timeshift_file_t *tsf, streaming_message_t **smp )
 {
   int i;
   ssize_t err;
@@ -198,39 +380,44 @@ static inline ssize_t _process_msg0
     ss = sm->sm_data;
     for (i = 0; i < ss->ss_num_components; i++)
       if (SCT_ISVIDEO(ss->ss_components[i].ssc_type))
-        ts->vididx = ss->ss_components[i].ssc_index;
-  } else if (sm->sm_type == SMT_SIGNAL_STATUS)
-    err = timeshift_write_sigstat(tsf->fd, sm->sm_time, sm->sm_data);
-  else if (sm->sm_type == SMT_PACKET) {
-    err = timeshift_write_packet(tsf->fd, sm->sm_time, sm->sm_data);
-    if (err > 0) {
+        tss->vididx = ss->ss_components[i].ssc_index;
+  } else {
+    err = _write_record(tsf, sm);
+    if (err > 0 && sm->sm_type == SMT_PACKET) {
       th_pkt_t *pkt = sm->sm_data;
 
       /* Index video iframes */
-      if (pkt->pkt_componentindex == ts->vididx &&
-          pkt->pkt_frametype      == PKT_I_FRAME) {
-        timeshift_index_iframe_t *ti = calloc(1, sizeof(timeshift_index_iframe_t));
-        ti->pos  = tsf->size;
-        ti->time = sm->sm_time;
-        TAILQ_INSERT_TAIL(&tsf->iframes, ti, link);
-      }
+      if (pkt->pkt_componentindex == tss->vididx &&
+          pkt->pkt_frametype      == PKT_I_FRAME)
+        timeshift_filemgr_index_add(tss, tsf, sm->sm_time);
     }
-  } else if (sm->sm_type == SMT_MPEGTS)
-    err = timeshift_write_mpegts(tsf->fd, sm->sm_time, sm->sm_data);
-  else
-    err = 0;
+  }
 
   /* OK */
   if (err > 0) {
     tsf->last  = sm->sm_time;
+    if (tsf->ram) {
+      _write_ram(tsf, sm, err);
+      *smp = NULL;
+      tsf->size += err;
+      tss->ram_size += err;
+      atomic_add_u64(&timeshift_total_ram_size, err);
+      return err;
+    }
     tsf->size += err;
     atomic_add_u64(&timeshift_total_size, err);
+
+    /* Don't hold back data for too long */
+    if (tsf->wbuf_len &&
+        getmonoclock() - tsf->wbuf_time >= TIMESHIFT_WBUF_PERIOD)
+      if (timeshift_write_sync(tsf))
+        err = -1;
   }
   return err;
 }
 
 static void _process_msg
-  ( timeshift_t *ts, streaming_message_t *sm, int *run )
+  ( timeshift_store_t *tss, streaming_message_t *sm, int *run )
 {
   int err;
   timeshift_file_t *tsf;
@@ -264,16 +451,18 @@ static void _process_msg
     case SMT_START:
     case SMT_MPEGTS:
     case SMT_PACKET:
-      pthread_mutex_lock(&ts->rdwr_mutex);
-      if ((tsf = timeshift_filemgr_get(ts, 1)) && (tsf->fd != -1)) {
-        if ((err = _process_msg0(ts, tsf, &sm)) < 0) {
-          timeshift_filemgr_close(tsf);
+      pthread_mutex_lock(&tss->rdwr_mutex);
+      if ((tsf = timeshift_filemgr_get(tss, 1)) && timeshift_file_open(tsf)) {
+        if ((err = _process_msg0(tss, tsf, &sm)) < 0) {
+          timeshift_filemgr_close(tss, tsf);
           tsf->bad = 1;
-          ts->full = 1; ///< Stop any more writing
+          tss->full = 1; ///< Stop any more writing
         }
         tsf->refcount--;
       }
-      pthread_mutex_unlock(&ts->rdwr_mutex);
+      if (tss->ram_size)
+        timeshift_filemgr_spill(tss);
+      pthread_mutex_unlock(&tss->rdwr_mutex);
       break;
   }
 
@@ -285,8 +474,8 @@ static void _process_msg
 void *timeshift_writer ( void *aux )
 {
   int run = 1;
-  timeshift_t *ts = aux;
-  streaming_queue_t *sq = &ts->wr_queue;
+  timeshift_store_t *tss = aux;
+  streaming_queue_t *sq = &tss->wr_queue;
   streaming_message_t *sm;
 
   pthread_mutex_lock(&sq->sq_mutex);
@@ -299,10 +488,10 @@ void *timeshift_writer ( void *aux )
       pthread_cond_wait(&sq->sq_cond, &sq->sq_mutex);
       continue;
     }
-    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+    streaming_queue_remove(sq, sm);
     pthread_mutex_unlock(&sq->sq_mutex);
 
-    _process_msg(ts, sm, &run);
+    _process_msg(tss, sm, &run);
 
     pthread_mutex_lock(&sq->sq_mutex);
   }
@@ -315,16 +504,16 @@ void *timeshift_writer ( void *aux )
  * Utilities
  * *************************************************************************/
 
-void timeshift_writer_flush ( timeshift_t *ts )
+void timeshift_writer_flush ( timeshift_store_t *tss )
 
 {
   streaming_message_t *sm;
-  streaming_queue_t *sq = &ts->wr_queue;
+  streaming_queue_t *sq = &tss->wr_queue;
 
   pthread_mutex_lock(&sq->sq_mutex);
   while ((sm = TAILQ_FIRST(&sq->sq_queue))) {
-    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
-    _process_msg(ts, sm, NULL);
+    streaming_queue_remove(sq, sm);
+    _process_msg(tss, sm, NULL);
   }
   pthread_mutex_unlock(&sq->sq_mutex);
 }
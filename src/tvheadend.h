@@ -491,6 +491,7 @@ typedef struct streaming_queue {
   pthread_mutex_t sq_mutex;    /* Protects sp_queue */
   pthread_cond_t  sq_cond;     /* Condvar for signalling new packets */
 
+  size_t          sq_size;     /* Actual queue size (bytes) */
   size_t          sq_maxsize;  /* Max queue size (bytes) */
   
   struct streaming_message_queue sq_queue;
@@ -619,6 +620,9 @@ void tvh_pipe_close(th_pipe_t *pipe);
 
 int tvh_write(int fd, const void *buf, size_t len);
 
+struct iovec;
+int tvh_writev(int fd, struct iovec *iov, int iovcnt);
+
 void hexdump(const char *pfx, const uint8_t *data, int len);
 
 uint32_t tvh_crc32(const uint8_t *data, size_t datalen, uint32_t crc);
@@ -516,6 +516,8 @@ extjs_config(http_connection_t *hc, const char *remain, void *opaque)
       save |= config_set_language(str);
     if ((str = http_arg_get(&hc->hc_req_args, "piconpath")))
       save |= config_set_picon_path(str);
+    if ((str = http_arg_get(&hc->hc_req_args, "descrambler_threads")))
+      save |= config_set_descrambler_threads(atoi(str));
     if (save)
       config_save();
 
@@ -690,6 +692,7 @@ extjs_timeshift(http_connection_t *hc, const char *remain, void *opaque)
     htsmsg_add_u32(m, "timeshift_max_period", timeshift_max_period / 60);
     htsmsg_add_u32(m, "timeshift_unlimited_size", timeshift_unlimited_size);
     htsmsg_add_u32(m, "timeshift_max_size", timeshift_max_size / 1048576);
+    htsmsg_add_u32(m, "timeshift_ram_size", timeshift_ram_size / 1048576);
     pthread_mutex_unlock(&global_lock);
     out = json_single_record(m, "config");
 
@@ -709,6 +712,8 @@ extjs_timeshift(http_connection_t *hc, const char *remain, void *opaque)
     timeshift_unlimited_size = http_arg_get(&hc->hc_req_args, "timeshift_unlimited_size") ? 1 : 0;
     if ((str = http_arg_get(&hc->hc_req_args, "timeshift_max_size")))
       timeshift_max_size   = atol(str) * 1048576LL;
+    if ((str = http_arg_get(&hc->hc_req_args, "timeshift_ram_size")))
+      timeshift_ram_size   = atol(str) * 1048576LL;
     timeshift_save();
     pthread_mutex_unlock(&global_lock);
 
@@ -44,7 +44,7 @@ tvheadend.miscconf = function(panel, index) {
         'muxconfpath', 'language',
         'tvhtime_update_enabled', 'tvhtime_ntp_enabled',
         'tvhtime_tolerance', 'transcoding_enabled',
-        'piconpath'
+        'piconpath', 'descrambler_threads'
     ]);
 
     /* ****************************************************************
@@ -146,6 +146,27 @@ tvheadend.miscconf = function(panel, index) {
         items: [piconPath]
     });
 
+    /*
+    * Descrambler
+    */
+
+    var descramblerThreads = new Ext.form.NumberField({
+        name: 'descrambler_threads',
+        fieldLabel: 'Descrambling threads (0 = inline, needs restart)',
+        allowDecimals: false,
+        allowNegative: false,
+        maxValue: 32
+    });
+
+    var descramblerPanel = new Ext.form.FieldSet({
+        title: 'Descrambler',
+        width: 700,
+        autoHeight: true,
+        collapsible: true,
+        animCollapse: true,
+        items: [descramblerThreads]
+    });
+
     /*
     * Image cache
     */
@@ -252,7 +273,8 @@ tvheadend.miscconf = function(panel, index) {
         layout: 'form',
         defaultType: 'textfield',
         autoHeight: true,
-        items: [languageWrap, dvbscanWrap, tvhtimePanel, transcodingPanel, piconPanel]
+        items: [languageWrap, dvbscanWrap, tvhtimePanel, transcodingPanel, piconPanel,
+                descramblerPanel]
     });
 
     var _items = [confpanel];
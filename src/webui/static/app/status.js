@@ -21,6 +21,8 @@ tvheadend.status_subs = function(panel, index)
             r.data.service = m.service;
             r.data.state = m.state;
             r.data.errors = m.errors;
+            r.data.delay = m.delay;
+            r.data.drops = m.drops;
             r.data.in = m.in;
             r.data.out = m.out;
 
@@ -45,6 +47,8 @@ tvheadend.status_subs = function(panel, index)
                 { name: 'service' },
                 { name: 'state' },
                 { name: 'errors' },
+                { name: 'delay' },
+                { name: 'drops' },
                 { name: 'in' },
                 { name: 'out' },
                 {
@@ -120,6 +124,18 @@ tvheadend.status_subs = function(panel, index)
                 header: "Errors",
                 dataIndex: 'errors'
             },
+            {
+                width: 50,
+                id: 'delay',
+                header: "Queue Delay (ms)",
+                dataIndex: 'delay'
+            },
+            {
+                width: 50,
+                id: 'drops',
+                header: "Drops",
+                dataIndex: 'drops'
+            },
             {
                 width: 50,
                 id: 'in',
@@ -216,6 +232,10 @@ tvheadend.status_streams = function(panel, index)
         r.data.bps = m.bps;
         r.data.cc = m.cc;
         r.data.te = m.te;
+        r.data.drop = m.drop;
+        r.data.qfill = m.qfill;
+        r.data.tbatch = m.tbatch;
+        r.data.tlock = m.tlock;
         r.data.signal_scale = m.signal_scale;
         r.data.snr_scale = m.snr_scale;
         r.data.ec_bit = m.ec_bit;
@@ -248,6 +268,10 @@ tvheadend.status_streams = function(panel, index)
                 { name: 'bps' },
                 { name: 'cc' },
                 { name: 'te' },
+                { name: 'drop' },
+                { name: 'qfill' },
+                { name: 'tbatch' },
+                { name: 'tlock' },
                 { name: 'signal_scale' },
                 { name: 'snr_scale' },
                 { name: 'ec_bit' },
@@ -341,6 +365,26 @@ tvheadend.status_streams = function(panel, index)
                 width: 50,
                 header: "Continuity Errors",
                 dataIndex: 'cc'
+            },
+            {
+                width: 50,
+                header: "Dropped Packets",
+                dataIndex: 'drop'
+            },
+            {
+                width: 50,
+                header: "Queue Fill (%)",
+                dataIndex: 'qfill'
+            },
+            {
+                width: 50,
+                header: "Table Batch (pkts)",
+                dataIndex: 'tbatch'
+            },
+            {
+                width: 50,
+                header: "Table Lock (us)",
+                dataIndex: 'tlock'
             }
         ]);
 
@@ -312,7 +312,7 @@ http_stream_run(http_connection_t *hc, streaming_queue_t *sq,
     }
 
     timeouts = 0; //Reset timeout counter
-    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+    streaming_queue_remove(sq, sm);
     pthread_mutex_unlock(&sq->sq_mutex);
 
     switch(sm->sm_type) {
@@ -3,6 +3,7 @@
 #include <fcntl.h>
 #include <sys/types.h>          /* See NOTES */
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <signal.h>
 #include <pthread.h>
@@ -90,6 +91,34 @@ tvh_write(int fd, const void *buf, size_t len)
   return len ? 1 : 0;
 }
 
+int
+tvh_writev(int fd, struct iovec *iov, int iovcnt)
+{
+  ssize_t c;
+
+  while (iovcnt) {
+    c = writev(fd, iov, iovcnt);
+    if (c < 0) {
+      if (ERRNO_AGAIN(errno)) {
+        usleep(100);
+        continue;
+      }
+      break;
+    }
+    while (iovcnt && c >= iov->iov_len) {
+      c -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt) {
+      iov->iov_base += c;
+      iov->iov_len  -= c;
+    }
+  }
+
+  return iovcnt ? 1 : 0;
+}
+
 struct
 thread_state {
   void *(*run)(void*);
@@ -0,0 +1,168 @@
+/*
+ *  AES-128 ECB descrambler benchmark
+ *
+ *  Descrambles a synthetic AES scrambled transport stream with the
+ *  per-block AES_ecb_encrypt() loop libaesdec used before, with one
+ *  EVP call per packet and with the clustered aes_decrypt_packets()
+ *  tvhcsa uses, and checks that all of them give the clear stream.
+ *
+ *  Build: make aesbench
+ *  Usage: build.linux/aesbench [-r rounds] [-c cluster] [-p packets]
+ *
+ *  One packet in eight carries an adaptation field, the key parity
+ *  changes every 2000 packets.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/aes.h>
+#include <openssl/evp.h>
+#include "build.h"
+#include "descrambler/libaesdec/libaesdec.h"
+
+static const unsigned char key_even[16] = "0123456789abcdef";
+static const unsigned char key_odd[16]  = "fedcba9876543210";
+
+static AES_KEY old_even, old_odd;
+
+/*
+ * The per-block loop libaesdec used before (with the loop bound fixed,
+ * so packets with an adaptation field compare equal)
+ */
+static void
+old_decrypt_packet(unsigned char *pkt)
+{
+  AES_KEY k;
+  int xc0, offset, i;
+
+  xc0 = pkt[3] & 0xc0;
+  if (xc0 == 0x00 || xc0 == 0x40)
+    return;
+  pkt[3] &= 0x3f;
+  offset = pkt[3] & 0x20 ? 4 + pkt[4] + 1 : 4;
+  k = (xc0 & 0x40) ? old_odd : old_even;
+  for (i = offset; i <= 188 - 16; i += 16)
+    AES_ecb_encrypt(pkt + i, pkt + i, &k, AES_DECRYPT);
+}
+
+static void
+scramble(unsigned char *clear, unsigned char *ts, int count)
+{
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  unsigned char *pkt;
+  int i, j, odd, offset, len, outl;
+
+  srand(1);
+  for (i = 0; i < count; i++) {
+    pkt = clear + i * 188;
+    pkt[0] = 0x47;
+    pkt[1] = 0x01;
+    pkt[2] = 0x00;
+    pkt[3] = 0x10 | (i & 0x0f);
+    offset = 4;
+    if ((i & 7) == 7) {
+      pkt[3] |= 0x20;
+      pkt[4] = rand() % 120;
+      offset += 1 + pkt[4];
+    }
+    for (j = offset; j < 188; j++)
+      pkt[j] = rand();
+
+    memcpy(ts + i * 188, pkt, 188);
+    pkt = ts + i * 188;
+    odd = (i / 2000) & 1;
+    pkt[3] |= odd ? 0xc0 : 0x80;
+    len = (188 - offset) & ~15;
+    EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL,
+                       odd ? key_odd : key_even, NULL);
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    EVP_EncryptUpdate(ctx, pkt + offset, &outl, pkt + offset, len);
+  }
+  EVP_CIPHER_CTX_free(ctx);
+}
+
+int
+main(int argc, char **argv)
+{
+  int rounds = 50, cluster = 64, count = 20000, a, r, i, j, n, ret = 0;
+  unsigned char *clear, *ts, *work;
+  struct timespec t0, t1;
+  double t[3];
+  void *keys;
+  static const char *names[3] = { "per block", "EVP/packet", "EVP/cluster" };
+
+  for (a = 1; a + 1 < argc; a += 2) {
+    if (!strcmp(argv[a], "-r"))
+      rounds = atoi(argv[a + 1]);
+    else if (!strcmp(argv[a], "-c"))
+      cluster = atoi(argv[a + 1]);
+    else if (!strcmp(argv[a], "-p"))
+      count = atoi(argv[a + 1]);
+    else
+      break;
+  }
+  if (a < argc || rounds <= 0 || cluster <= 0 || count <= 0) {
+    fprintf(stderr, "usage: %s [-r rounds] [-c cluster] [-p packets]\n", argv[0]);
+    return 1;
+  }
+
+  clear = malloc(count * 188);
+  ts    = malloc(count * 188);
+  work  = malloc(count * 188);
+  scramble(clear, ts, count);
+
+  AES_set_decrypt_key(key_even, 128, &old_even);
+  AES_set_decrypt_key(key_odd, 128, &old_odd);
+  keys = aes_get_key_struct();
+  aes_set_control_words(keys, key_even, key_odd);
+
+  printf("%d packets, cluster %d, %d rounds\n", count, cluster, rounds);
+  for (j = 0; j < 3; j++) {
+    t[j] = 0;
+    for (r = 0; r < rounds; r++) {
+      memcpy(work, ts, count * 188);
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      for (i = 0; i < count; i += n) {
+        n = count - i < cluster ? count - i : cluster;
+        if (j == 0) {
+          for (a = 0; a < n; a++)
+            old_decrypt_packet(work + (i + a) * 188);
+        } else if (j == 1) {
+          for (a = 0; a < n; a++)
+            aes_decrypt_packet(keys, work + (i + a) * 188);
+        } else {
+          aes_decrypt_packets(keys, work + i * 188, n);
+        }
+      }
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      t[j] += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    }
+    n = memcmp(work, clear, count * 188) != 0;
+    printf("  %-12s %8.1f MB/s  %7.0f kpkt/s  %5.2fx%s\n",
+           names[j], (double)count * 188 * rounds / t[j] / 1e6,
+           (double)count * rounds / t[j] / 1e3, t[0] / t[j],
+           n ? "  MISMATCH" : "");
+    ret |= n;
+  }
+
+  aes_free_key_struct(keys);
+  free(work);
+  free(ts);
+  free(clear);
+  return ret;
+}
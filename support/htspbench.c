@@ -0,0 +1,210 @@
+/*
+ *  HTSP muxpkt encoding benchmark
+ *
+ *  Encodes and writes muxpkt messages the way htsp_stream_deliver() and
+ *  the HTSP write scheduler did before (an htsmsg map per packet,
+ *  serialized into a new buffer with a copy of the payload, one write())
+ *  and the way they do now (the header fields encoded straight into the
+ *  wire format behind a per-subscription template, header and payload
+ *  sent with one writev()). Checks that both give the same bytes.
+ *
+ *  Build: make htspbench
+ *  Usage: build.linux/htspbench [-n packets] [-o file] [size ...]
+ *
+ *  Output goes to /dev/null unless -o is given. The default payload
+ *  sizes are 200 (audio), 1500 and 20000 (video) bytes.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/uio.h>
+#include "htsmsg.h"
+#include "htsmsg_binary.h"
+
+#define HDR_MAX 192
+
+/*
+ * From utils.c, needed by the JSON and htsbuf code (not used here)
+ */
+int put_utf8(char *out, int c);
+void hexdump(const char *pfx, const uint8_t *data, int len);
+
+int
+put_utf8(char *out, int c)
+{
+  *out = c;
+  return 1;
+}
+
+void
+hexdump(const char *pfx, const uint8_t *data, int len)
+{
+}
+
+static uint8_t  tmpl[48];
+static size_t   tmpl_len;
+
+/*
+ * Before: build a map, serialize it (copying the payload), write()
+ */
+static size_t
+encode_htsmsg(int fd, uint32_t sid, int64_t pts, const uint8_t *pl,
+              size_t plen, void **out)
+{
+  htsmsg_t *m = htsmsg_create_map();
+  void *dptr;
+  size_t dlen;
+
+  htsmsg_add_str(m, "method", "muxpkt");
+  htsmsg_add_u32(m, "subscriptionId", sid);
+  htsmsg_add_u32(m, "frametype", 'P');
+  htsmsg_add_u32(m, "stream", 1);
+  htsmsg_add_u32(m, "com", 0);
+  htsmsg_add_s64(m, "pts", pts);
+  htsmsg_add_s64(m, "dts", pts - 3600);
+  htsmsg_add_u32(m, "duration", 3600);
+  htsmsg_add_binptr(m, "payload", pl, plen);
+  htsmsg_binary_serialize(m, &dptr, &dlen, INT32_MAX);
+  htsmsg_destroy(m);
+  if (write(fd, dptr, dlen) != dlen)
+    dlen = 0;
+  if (out)
+    *out = dptr;
+  else
+    free(dptr);
+  return dlen;
+}
+
+/*
+ * Now: template + single field encoders, writev() header and payload
+ */
+static size_t
+encode_template(int fd, int64_t pts, const uint8_t *pl, size_t plen,
+                void **out)
+{
+  uint8_t *hdr = malloc(HDR_MAX), *d = hdr + 4;
+  struct iovec iov[2];
+  size_t len;
+
+  memcpy(d, tmpl, tmpl_len);
+  d += tmpl_len;
+  d += htsmsg_binary_write_s64(d, "frametype", 'P');
+  d += htsmsg_binary_write_s64(d, "stream", 1);
+  d += htsmsg_binary_write_s64(d, "com", 0);
+  d += htsmsg_binary_write_s64(d, "pts", pts);
+  d += htsmsg_binary_write_s64(d, "dts", pts - 3600);
+  d += htsmsg_binary_write_s64(d, "duration", 3600);
+  d += htsmsg_binary_write_bin(d, "payload", plen);
+  len = d - hdr - 4 + plen;
+  hdr[0] = len >> 24;
+  hdr[1] = len >> 16;
+  hdr[2] = len >> 8;
+  hdr[3] = len;
+
+  iov[0].iov_base = hdr;
+  iov[0].iov_len  = d - hdr;
+  iov[1].iov_base = (void *)pl;
+  iov[1].iov_len  = plen;
+  len = iov[0].iov_len + plen;
+  if (writev(fd, iov, 2) != len)
+    len = 0;
+  if (out) {
+    *out = malloc(len);
+    memcpy(*out, hdr, iov[0].iov_len);
+    memcpy(*out + iov[0].iov_len, pl, plen);
+  }
+  free(hdr);
+  return len;
+}
+
+static double
+elapsed(struct timespec *t0)
+{
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+  static const int defsizes[] = { 200, 1500, 20000 };
+  const char *path = "/dev/null";
+  int a = 1, n = 1000000, i, j, nsizes, fd, ret = 0;
+  size_t plen, l0, l1;
+  struct timespec t0;
+  double t_old, t_new;
+  uint8_t *pl;
+  void *b0, *b1;
+
+  for ( ; a + 1 < argc && argv[a][0] == '-'; a += 2) {
+    if (!strcmp(argv[a], "-n"))
+      n = atoi(argv[a + 1]);
+    else if (!strcmp(argv[a], "-o"))
+      path = argv[a + 1];
+    else
+      break;
+  }
+  if (n <= 0 || (a < argc && argv[a][0] == '-')) {
+    fprintf(stderr, "usage: %s [-n packets] [-o file] [size ...]\n", argv[0]);
+    return 1;
+  }
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror(path);
+    return 1;
+  }
+
+  tmpl_len  = htsmsg_binary_write_str(tmpl, "method", "muxpkt");
+  tmpl_len += htsmsg_binary_write_s64(tmpl + tmpl_len, "subscriptionId", 7);
+
+  nsizes = a < argc ? argc - a : 3;
+  printf("%d packets per size, output %s\n", n, path);
+  for (j = 0; j < nsizes; j++) {
+    plen = a < argc ? atoi(argv[a + j]) : defsizes[j];
+    pl = malloc(plen);
+    for (i = 0; i < plen; i++)
+      pl[i] = i * 31;
+
+    l0 = encode_htsmsg(fd, 7, 123456789, pl, plen, &b0);
+    l1 = encode_template(fd, 123456789, pl, plen, &b1);
+    i = l0 != l1 || memcmp(b0, b1, l0);
+    free(b0);
+    free(b1);
+    ret |= i;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < n; i++)
+      encode_htsmsg(fd, 7, i * 3600LL, pl, plen, NULL);
+    t_old = elapsed(&t0);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < n; i++)
+      encode_template(fd, i * 3600LL, pl, plen, NULL);
+    t_new = elapsed(&t0);
+
+    printf("  %6zu bytes  htsmsg %8.0f kpkt/s  template %8.0f kpkt/s  %5.2fx%s\n",
+           plen, n / t_old / 1e3, n / t_new / 1e3, t_old / t_new,
+           ret ? "  MISMATCH" : "");
+    free(pl);
+  }
+  close(fd);
+  return ret;
+}
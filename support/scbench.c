@@ -0,0 +1,224 @@
+/*
+ *  Start code scanner benchmark
+ *
+ *  Runs the start code scanners (src/parsers/parser_sc*.c) over the
+ *  video payload of recorded transport streams, the same way parse_sc()
+ *  sees it, and checks that all variants find the same start codes.
+ *
+ *  Build: make scbench
+ *  Usage: build.linux/scbench [-r rounds] file.ts [pid] [file.ts [pid] ...]
+ *
+ *  Without a pid, the PID carrying the most video PES (stream id
+ *  0xE0-0xEF) is used. On x86 the throughput is also given in bytes
+ *  per TSC cycle; the TSC ticks at the nominal clock, so with turbo or
+ *  frequency scaling this is not the core cycle count.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include "build.h"
+#include "parsers/parser_sc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() __rdtsc()
+#else
+#define CYCLES() 0
+#endif
+
+typedef int (*scan_t)(const uint8_t *data, int len);
+
+typedef struct scanner {
+  const char *name;
+  scan_t      scan;
+} scanner_t;
+
+/*
+ * The byte loop parse_sc() used before the scanners
+ */
+static int
+scan_bytewise(const uint8_t *data, int len)
+{
+  uint32_t sc = 0xffffffff;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    sc = sc << 8 | data[i];
+    if ((sc & 0xffffff) == 1)
+      return i - 2;
+  }
+  return -1;
+}
+
+static const scanner_t scanners[] = {
+  { "bytewise", scan_bytewise },
+  { "C",        parser_sc_find_c },
+#ifdef CONFIG_SSE2
+  { "SSE2",     parser_sc_find_sse2 },
+#endif
+#ifdef CONFIG_AVX2
+  { "AVX2",     parser_sc_find_avx2 },
+#endif
+};
+
+/*
+ * Called by the scanner selection in parser_sc.c (not used here)
+ */
+void _tvhlog(const char *file, int line, int notify, int severity,
+             const char *subsys, const char *fmt, ...);
+
+void
+_tvhlog(const char *file, int line, int notify, int severity,
+        const char *subsys, const char *fmt, ...)
+{
+}
+
+static int
+ts_payload(const uint8_t *tsb, const uint8_t **data)
+{
+  int off = 4;
+
+  if (tsb[0] != 0x47 || !(tsb[3] & 0x10))
+    return 0;
+  if (tsb[3] & 0x20)
+    off += 1 + tsb[4];
+  if (off >= 188)
+    return 0;
+  *data = tsb + off;
+  return 188 - off;
+}
+
+static int
+find_video_pid(const uint8_t *ts, size_t size)
+{
+  static int count[8192];
+  const uint8_t *d;
+  size_t o;
+  int pid, best = -1, len;
+
+  memset(count, 0, sizeof(count));
+  for (o = 0; o + 188 <= size; o += 188) {
+    if (!(ts[o + 1] & 0x40))
+      continue;
+    len = ts_payload(ts + o, &d);
+    if (len >= 4 && d[0] == 0 && d[1] == 0 && d[2] == 1 && (d[3] & 0xf0) == 0xe0) {
+      pid = (ts[o + 1] & 0x1f) << 8 | ts[o + 2];
+      if (++count[pid] > (best < 0 ? 0 : count[best]))
+        best = pid;
+    }
+  }
+  return best;
+}
+
+static double
+bench(const scanner_t *s, const uint8_t *ts, size_t size, int pid,
+      int rounds, size_t *bytes, long *hits, uint64_t *cycles)
+{
+  struct timespec t0, t1;
+  const uint8_t *d;
+  size_t o;
+  int n, r, i, len;
+  uint64_t c0;
+
+  *bytes = 0;
+  *hits  = 0;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  c0 = CYCLES();
+  for (n = 0; n < rounds; n++)
+    for (o = 0; o + 188 <= size; o += 188) {
+      if (((ts[o + 1] & 0x1f) << 8 | ts[o + 2]) != pid)
+        continue;
+      if ((len = ts_payload(ts + o, &d)) == 0)
+        continue;
+      *bytes += len;
+      for (i = 0; (r = s->scan(d + i, len - i)) >= 0; i += r + 3)
+        (*hits)++;
+    }
+  *cycles = CYCLES() - c0;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+  const int nscanners = sizeof(scanners) / sizeof(scanners[0]);
+  int a = 1, rounds = 20, pid, j, ret = 0;
+  size_t size, bytes;
+  long hits, hits0;
+  uint64_t cycles;
+  uint8_t *ts;
+  double t, t0;
+  FILE *f;
+
+  if (a + 1 < argc && !strcmp(argv[a], "-r")) {
+    rounds = atoi(argv[a + 1]);
+    a += 2;
+  }
+  if (a >= argc || rounds <= 0) {
+    fprintf(stderr, "usage: %s [-r rounds] file.ts [pid] ...\n", argv[0]);
+    return 1;
+  }
+
+  for ( ; a < argc; a++) {
+    if ((f = fopen(argv[a], "rb")) == NULL) {
+      perror(argv[a]);
+      return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    ts = malloc(size);
+    if (fread(ts, 1, size, f) != size) {
+      perror(argv[a]);
+      return 1;
+    }
+    fclose(f);
+
+    if (a + 1 < argc && argv[a + 1][0] >= '0' && argv[a + 1][0] <= '9')
+      pid = strtol(argv[++a], NULL, 0);
+    else
+      pid = find_video_pid(ts, size);
+    if (pid < 0) {
+      fprintf(stderr, "%s: no video PID found\n", argv[a]);
+      free(ts);
+      continue;
+    }
+
+    printf("%s: pid %d, %d rounds\n", argv[a], pid, rounds);
+    t0 = 0;
+    hits0 = 0;
+    for (j = 0; j < nscanners; j++) {
+      t = bench(&scanners[j], ts, size, pid, rounds, &bytes, &hits, &cycles);
+      if (j == 0) {
+        t0 = t;
+        hits0 = hits;
+      }
+      printf("  %-9s %8.1f MB/s", scanners[j].name, bytes / t / 1e6);
+      if (cycles)
+        printf("  %6.2f B/cycle", (double)bytes / cycles);
+      printf("  %5.2fx  %ld start codes%s\n", t0 / t, hits / rounds,
+             hits != hits0 ? "  MISMATCH" : "");
+      if (hits != hits0)
+        ret = 1;
+    }
+    free(ts);
+  }
+  return ret;
+}